@@ -0,0 +1,107 @@
+#include <random>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "decoder.h"
+
+namespace {
+
+void AppendSegment(std::string* jpeg, uint8_t marker, const std::string& payload) {
+    jpeg->push_back(static_cast<char>(0xff));
+    jpeg->push_back(static_cast<char>(marker));
+    jpeg->push_back(static_cast<char>((payload.size() + 2) >> 8));
+    jpeg->push_back(static_cast<char>((payload.size() + 2) & 0xff));
+    *jpeg += payload;
+}
+
+// Bit length of the magnitude and the bits JPEG stores for a coefficient.
+std::pair<uint8_t, uint32_t> Category(int value) {
+    uint32_t magnitude = value < 0 ? -value : value;
+    uint8_t size = 0;
+    while ((magnitude >> size) != 0) {
+        ++size;
+    }
+    uint32_t bits = value < 0 ? value + (1 << size) - 1 : value;
+    return {size, bits};
+}
+
+// Baseline 4:4:4 colour image with the standard tables and about 3.5 bytes of entropy-coded
+// data per block, close to what a camera writes at high quality. Every block has a DC
+// difference and a few low-frequency AC coefficients.
+std::string SyntheticJPEG(uint16_t width, uint16_t height) {
+    std::string jpeg = "\xff\xd8";
+    for (char id : {0, 1}) {
+        AppendSegment(&jpeg, 0xdb, id + std::string(64, 1));
+    }
+    AppendSegment(&jpeg, 0xc0,
+                  {8, static_cast<char>(height >> 8), static_cast<char>(height & 0xff),
+                   static_cast<char>(width >> 8), static_cast<char>(width & 0xff), 3, 1, 0x11, 0,
+                   2, 0x11, 1, 3, 0x11, 1});
+
+    std::vector<huffman::Code> codes[2][2];
+    for (const auto& table : commands::DHT::Standard()) {
+        std::string payload(1, static_cast<char>((table.is_ac << 4) | table.id));
+        payload.append(table.num_values.begin(), table.num_values.end());
+        payload.append(table.values.begin(), table.values.end());
+        AppendSegment(&jpeg, 0xc4, payload);
+        codes[table.is_ac][table.id] = huffman::CanonicalCodes(table.num_values, table.values);
+    }
+    AppendSegment(&jpeg, 0xda, {3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0});
+
+    std::mt19937 generator(1);
+    std::uniform_int_distribution<int> dc(-20, 20), ac(-15, 15), num_ac(2, 8);
+    std::vector<uint8_t> entropy_coded;
+    byte_streams::BitWriter writer(&entropy_coded);
+    auto put = [&](const huffman::Code& code, uint8_t size, uint32_t bits) {
+        writer.Write(code.bits, code.length);
+        writer.Write(bits, size);
+    };
+
+    size_t num_blocks = size_t((width + 7) / 8) * ((height + 7) / 8);
+    for (size_t block = 0; block < num_blocks; ++block) {
+        for (size_t channel = 0; channel < 3; ++channel) {
+            const auto& dc_codes = codes[0][channel > 0];
+            const auto& ac_codes = codes[1][channel > 0];
+
+            auto [dc_size, dc_bits] = Category(dc(generator));
+            put(dc_codes[dc_size], dc_size, dc_bits);
+            for (int idx = num_ac(generator); idx > 0; --idx) {
+                int value = ac(generator);
+                value += value == 0;
+                auto [size, bits] = Category(value);
+                put(ac_codes[size], size, bits);
+            }
+            // End of block.
+            put(ac_codes[0x00], 0, 0);
+        }
+    }
+    writer.Flush();
+
+    jpeg.append(entropy_coded.begin(), entropy_coded.end());
+    jpeg += "\xff\xd9";
+    return jpeg;
+}
+
+}  // namespace
+
+// Arguments: megapixels and speculative threads, 0 decoding sequentially.
+static void BM_DecodeSpeculative(benchmark::State& state) {
+    const uint16_t width = state.range(0) == 20 ? 5472 : 1024;
+    const uint16_t height = state.range(0) == 20 ? 3648 : 1024;
+    auto jpeg = SyntheticJPEG(width, height);
+
+    decode::DecodeOptions options;
+    options.speculative_threads = state.range(1);
+    for (auto _ : state) {
+        byte_streams::MemoryStream stream(jpeg.data(), jpeg.size());
+        benchmark::DoNotOptimize(decode::Decode(stream, options));
+    }
+    state.SetBytesProcessed(state.iterations() * jpeg.size());
+    state.counters["pixels"] = size_t(width) * height;
+}
+BENCHMARK(BM_DecodeSpeculative)
+    ->ArgsProduct({{1, 20}, {0, 1, 2, 4}})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
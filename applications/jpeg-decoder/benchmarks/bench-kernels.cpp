@@ -0,0 +1,114 @@
+#include <array>
+#include <vector>
+#include <random>
+
+#include <benchmark/benchmark.h>
+
+#include "kernels.h"
+
+// Every benchmark takes the level as its argument; levels the CPU lacks are skipped.
+const kernels::Kernels* KernelsOrSkip(benchmark::State& state) {
+    auto level = static_cast<kernels::Level>(state.range(0));
+    if (level > kernels::DetectLevel()) {
+        state.SkipWithError("level not supported by this CPU");
+        return nullptr;
+    }
+    state.SetLabel(kernels::LevelName(level));
+    return &kernels::ForLevel(level);
+}
+
+void ApplyLevels(benchmark::internal::Benchmark* benchmark) {
+    for (int level = 0; level <= static_cast<int>(kernels::Level::kAVX512); ++level) {
+        benchmark->Arg(level);
+    }
+}
+
+static void BM_IDCT(benchmark::State& state) {
+    const auto* kernels = KernelsOrSkip(state);
+    if (kernels == nullptr) {
+        return;
+    }
+
+    std::array<double, 64> coefficients, samples;
+    std::mt19937 generator(0);
+    std::uniform_real_distribution<double> distribution(-1024, 1024);
+    for (auto& value : coefficients) {
+        value = distribution(generator);
+    }
+
+    for (auto _ : state) {
+        kernels->idct(coefficients.data(), samples.data());
+        benchmark::DoNotOptimize(samples);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_IDCT)->Apply(ApplyLevels);
+
+static void BM_Dequantize(benchmark::State& state) {
+    const auto* kernels = KernelsOrSkip(state);
+    if (kernels == nullptr) {
+        return;
+    }
+
+    std::array<int16_t, 64> coefficients, table, output;
+    coefficients.fill(-7);
+    table.fill(13);
+
+    for (auto _ : state) {
+        kernels->dequantize(coefficients.data(), table.data(), output.data());
+        benchmark::DoNotOptimize(output);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Dequantize)->Apply(ApplyLevels);
+
+static void BM_YCbCrToRGB(benchmark::State& state) {
+    const auto* kernels = KernelsOrSkip(state);
+    if (kernels == nullptr) {
+        return;
+    }
+
+    const size_t width = 1024;
+    std::vector<int16_t> luma(width, 100), blue(width, 90), red(width, 200);
+    std::vector<RGB> output(width);
+
+    for (auto _ : state) {
+        kernels->ycbcr_to_rgb(luma.data(), blue.data(), red.data(), output.data(), width);
+        benchmark::DoNotOptimize(output.data());
+    }
+    state.SetItemsProcessed(state.iterations() * width);
+}
+BENCHMARK(BM_YCbCrToRGB)->Apply(ApplyLevels);
+
+static void BM_UpsampleH2(benchmark::State& state) {
+    const auto* kernels = KernelsOrSkip(state);
+    if (kernels == nullptr) {
+        return;
+    }
+
+    const size_t width = 1024;
+    std::vector<int16_t> input(width, 3), output(2 * width);
+
+    for (auto _ : state) {
+        kernels->upsample_h2(input.data(), output.data(), width);
+        benchmark::DoNotOptimize(output.data());
+    }
+    state.SetItemsProcessed(state.iterations() * width);
+}
+BENCHMARK(BM_UpsampleH2)->Apply(ApplyLevels);
+
+static void BM_FindMarkerByte(benchmark::State& state) {
+    const auto* kernels = KernelsOrSkip(state);
+    if (kernels == nullptr) {
+        return;
+    }
+
+    std::vector<uint8_t> data(1 << 16, 0x5a);
+    data.back() = 0xff;
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(kernels->find_marker_byte(data.data(), 0, data.size()));
+    }
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_FindMarkerByte)->Apply(ApplyLevels);
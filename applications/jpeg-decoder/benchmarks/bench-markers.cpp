@@ -0,0 +1,52 @@
+#include <string>
+
+#include <benchmark/benchmark.h>
+
+#include "decoder.h"
+
+void AppendSegment(std::string* jpeg, uint8_t marker, const std::string& payload) {
+    jpeg->push_back(static_cast<char>(0xff));
+    jpeg->push_back(static_cast<char>(marker));
+    jpeg->push_back(static_cast<char>((payload.size() + 2) >> 8));
+    jpeg->push_back(static_cast<char>((payload.size() + 2) & 0xff));
+    *jpeg += payload;
+}
+
+// Everything up to the scan of a camera file: several full-size APP segments holding EXIF data,
+// maker notes and a preview, followed by the tables and frame header of a 3 channel image.
+std::string CameraHeader(size_t num_app_segments) {
+    std::string jpeg = "\xff\xd8";
+    for (size_t segment = 0; segment < num_app_segments; ++segment) {
+        std::string payload = "Exif";
+        payload.resize(65533, static_cast<char>(segment));
+        AppendSegment(&jpeg, 0xe1, payload);
+    }
+    AppendSegment(&jpeg, 0xfe, std::string(1000, 'c'));
+
+    for (char id : {0, 1}) {
+        AppendSegment(&jpeg, 0xdb, id + std::string(64, 1));
+    }
+    AppendSegment(&jpeg, 0xc0, {8, 0, 16, 0, 16, 3, 1, 0x11, 0, 2, 0x11, 1, 3, 0x11, 1});
+
+    for (const auto& table : commands::DHT::Standard()) {
+        std::string payload(1, static_cast<char>((table.is_ac << 4) | table.id));
+        payload.append(table.num_values.begin(), table.num_values.end());
+        payload.append(table.values.begin(), table.values.end());
+        AppendSegment(&jpeg, 0xc4, payload);
+    }
+
+    AppendSegment(&jpeg, 0xda, {3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0});
+    return jpeg;
+}
+
+// Argument: number of 64KB APP segments.
+static void BM_ReadMeta(benchmark::State& state) {
+    auto jpeg = CameraHeader(state.range(0));
+
+    for (auto _ : state) {
+        byte_streams::MemoryStream stream(jpeg.data(), jpeg.size());
+        benchmark::DoNotOptimize(decode::JPEGMeta(stream));
+    }
+    state.SetBytesProcessed(state.iterations() * jpeg.size());
+}
+BENCHMARK(BM_ReadMeta)->Arg(0)->Arg(1)->Arg(8);
@@ -70,8 +70,12 @@ struct DHT {
 
     struct Payload {
         HuffmanTree tree;
+        huffman::LookupDecoder<uint8_t> lookup;
         uint8_t is_ac = 0, id = 0;
         uint32_t content_length = 0;
+        // The table as it is stored in the segment: number of codes of each length from 1 to
+        // 16 bits and the values in code order.
+        std::vector<uint8_t> num_values, values;
     };
 
     static constexpr std::array<std::uint8_t, 1> kStart = {0xc4};
@@ -79,6 +83,10 @@ struct DHT {
     static Payload ReadSingle(std::istream &stream);
     static std::vector<Payload> ReadMultiple(std::istream &stream);
 
+    // Example tables of the standard (Annex K.3): DC and AC luminance with id 0, DC and AC
+    // chrominance with id 1. They code every value baseline 8-bit data can produce.
+    static std::vector<Payload> Standard();
+
 private:
     static Payload ReadStripped(byte_streams::ByteStream &bytes);
 
@@ -103,6 +111,8 @@ struct SOS {
 struct App {
     struct Payload {
         std::string exif;
+        // Second byte of the APPn marker. Not part of the payload, set by the caller.
+        uint8_t marker = 0xe0;
     };
 
     static constexpr std::array<std::uint8_t, 16> kStart = {0xe0, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5,
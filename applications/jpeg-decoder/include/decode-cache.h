@@ -0,0 +1,84 @@
+#pragma once
+
+#include "decoder.h"
+
+#include <list>
+#include <mutex>
+#include <future>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace decode {
+
+// Content-addressed cache of decoded images, kept under a byte budget with LRU eviction.
+// Images are identified by the JPEG bytes, so the same file reached through different paths is
+// decoded once. A hash of the bytes only picks the bucket: entries keep a copy of the bytes,
+// which counts towards the budget, and a hit requires them to be equal, so a file crafted to
+// collide with another one's hash never gets its image. The decode options are not part of
+// the key, as every decoder produces the same image.
+class DecodeCache {
+public:
+    struct Stats {
+        size_t hits = 0, misses = 0, evictions = 0;
+        size_t bytes = 0;
+    };
+
+    explicit DecodeCache(size_t byte_budget);
+
+    DecodeCache(const DecodeCache&) = delete;
+    DecodeCache& operator=(const DecodeCache&) = delete;
+
+    // Safe to call concurrently. A request for an image which is being decoded by another
+    // thread waits for that decode instead of starting its own.
+    std::shared_ptr<const Image> Decode(std::string_view bytes, const DecodeOptions& options = {});
+
+    std::shared_ptr<const Image> DecodeFile(const std::string& filename,
+                                            const DecodeOptions& options = {});
+
+    Stats GetStats() const;
+
+private:
+    struct Key {
+        uint64_t hash;
+        // Refers to the copy kept in the entry, or to the bytes being looked up.
+        std::string_view bytes;
+
+        bool operator==(const Key& other) const {
+            return hash == other.hash && bytes == other.bytes;
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            return key.hash;
+        }
+    };
+
+    using ImageFuture = std::shared_future<std::shared_ptr<const Image>>;
+
+    struct Entry {
+        std::unique_ptr<const std::string> bytes_copy;
+        ImageFuture image;
+        size_t bytes = 0;
+        bool ready = false;
+        std::list<Key>::iterator lru_position;
+    };
+
+    static Key MakeKey(std::string_view bytes);
+
+    void Insert(const Key& key, const std::shared_ptr<const Image>& image);
+
+    void EvictOverBudget();
+
+    size_t byte_budget_;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<Key, Entry, KeyHash> entries_;
+    // Most recently used first. Only holds entries which finished decoding.
+    std::list<Key> lru_;
+    Stats stats_;
+};
+
+}  // namespace decode
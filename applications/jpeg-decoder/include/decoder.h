@@ -7,11 +7,52 @@
 #include <vector>
 #include <iostream>
 #include <fstream>
+#include <type_traits>
 
 namespace decode {
 
-struct HuffmanStorage;
-struct JPEGMeta;
+struct HuffmanStorage {
+    std::vector<std::vector<commands::DHT::Payload>> trees;
+
+    static HuffmanStorage FromPayload(const std::vector<commands::DHT::Payload>& parsed_trees);
+    const commands::DHT::Payload& Get(uint8_t id, uint8_t is_ac) const;
+};
+
+struct JPEGMeta {
+    uint16_t width = 0, height = 0, precision = 0;
+    uint8_t mcu_x_step = 8, mcu_y_step = 8;
+    uint8_t max_granularity_h = 0, max_granularity_v = 0;
+
+    std::vector<commands::Comment::Payload> comments;
+    std::vector<commands::App::Payload> app_info;
+    std::vector<commands::DQT::Payload> q_tables;
+    std::vector<commands::DCT::ChannelProps> channels;
+
+    HuffmanStorage huffman_trees;
+
+    JPEGMeta() = default;
+
+    JPEGMeta(std::istream& input);
+
+    // The steps of the constructor after the segments are read, for callers which read them on
+    // their own. Quantization tables have to be set before the frame which refers to them.
+    void SetQuantTables(const std::vector<commands::DQT::Payload>& parsed_tables);
+    void SetFrame(const commands::DCT::Payload& dct);
+};
+
+struct DecodeOptions {
+    // Threads which Huffman-decode chunks of the scan speculatively, starting mid-stream and
+    // relying on the codes to resynchronize. 0 keeps the sequential decoder.
+    size_t speculative_threads = 0;
+    // Size of the unstuffed entropy-coded data each speculative decoder starts from, in bytes.
+    size_t speculative_chunk_size = 1 << 16;
+    // Threads which dequantize, transform and color-convert MCU rows while the calling thread
+    // keeps Huffman-decoding the following ones. 0 transforms inline. Ignored when the scan is
+    // decoded speculatively, which parallelizes the transforms already.
+    size_t pipeline_threads = 0;
+    // Number of MCU rows of coefficients the entropy decoder may run ahead of the transforms.
+    size_t pipeline_depth = 8;
+};
 
 struct ChannelProps {
     explicit ChannelProps(commands::SOS::ChannelProps init) : props(init), last_dc(0) {
@@ -41,8 +82,116 @@ struct MCU {
     RGB GetRGB(int8_t x_offset, int8_t y_offset, const JPEGMeta& meta);
 };
 
+template <class Bits>
+uint8_t DecodeByte(Bits& bits, const commands::DHT::HuffmanTree& tree) {
+    auto current = tree.root.get();
+
+    while (!current->IsTerminal()) {
+        bool bit = bits.Yield();
+
+        current = bit ? current->right : current->left;
+
+        if (current == nullptr) {
+            throw std::runtime_error("error getting huffman code");
+        }
+    }
+    return current->value.value();
+}
+
+// Bit readers over a buffer can look ahead, which allows decoding a whole code with one table
+// lookup instead of walking the tree a bit at a time.
+template <class Bits>
+uint8_t DecodeByte(Bits& bits, const commands::DHT::Payload& table) {
+    if constexpr (std::is_same_v<Bits, byte_streams::BufferBitStream>) {
+        return table.lookup.Decode(bits);
+    } else {
+        return DecodeByte(bits, table.tree);
+    }
+}
+
+template <class Bits>
+uint16_t ReadBits(Bits& bits, uint8_t num_bits) {
+    if constexpr (std::is_same_v<Bits, byte_streams::BufferBitStream>) {
+        return bits.Read(num_bits);
+    } else {
+        return byte_streams::ComposeNBitsLE(num_bits, bits);
+    }
+}
+
+inline int16_t MaybeNegate(uint8_t num_bits, int16_t raw) {
+    if ((raw >> (num_bits - 1)) == 0) {
+        return raw - (1 << num_bits) + 1;
+    }
+    return raw;
+}
+
+// Huffman-decodes the coefficients of one block in zigzag order. The DC slot holds the
+// difference to the previous block of the channel, as it is coded in the stream.
+template <class Bits>
+Block DecodeDifferences(Bits& bits, const commands::SOS::ChannelProps& channel,
+                        const JPEGMeta& meta) {
+    Block decoded;
+    decoded.channel_id = channel.id;
+    decoded.block.buffer.fill(0);
+
+    const auto& dc_tree = meta.huffman_trees.Get(channel.dc_ht_id, 0);
+    const auto& ac_tree = meta.huffman_trees.Get(channel.ac_ht_id, 1);
+
+    auto dc_byte = DecodeByte(bits, dc_tree);
+
+    if (dc_byte != 0x00) {
+        auto [num_zeros, num_bits] = byte_streams::SplitByte(dc_byte);
+        auto abs_c = ReadBits(bits, num_bits);
+        decoded.block.buffer[0] = MaybeNegate(num_bits, abs_c);
+    }
+
+    size_t position = 1;
+    const size_t size = decoded.block.buffer.size();
+
+    while (position < size && !bits.IsFinished()) {
+        auto ac_byte = DecodeByte(bits, ac_tree);
+        if (ac_byte == 0x00) {
+            break;
+        } else if (ac_byte == 0xf0) {
+            position += 16;
+        } else {
+            auto [num_zeros, num_bits] = byte_streams::SplitByte(ac_byte);
+            position += num_zeros;
+
+            if (position >= size) {
+                throw std::runtime_error("ac coefficient out of block bounds");
+            }
+
+            auto abs_c = ReadBits(bits, num_bits);
+            decoded.block.buffer[position] = MaybeNegate(num_bits, abs_c);
+            ++position;
+        }
+    }
+
+    if (position > size) {
+        throw std::runtime_error("ac coefficient out of block bounds");
+    }
+
+    return decoded;
+}
+
+// Dequantizes a block with absolute DC and transforms it to clipped sample values.
+CBlock TransformBlock(const Block& decoded, const JPEGMeta& meta);
+
+// Color-converts an MCU whose top left pixel is at (cur_x, cur_y) into the image.
+void PutMCU(MCU& mcu, uint16_t cur_x, uint16_t cur_y, const JPEGMeta& meta, Image* image);
+
+// Reads the SOS header the stream is left at by JPEGMeta.
+std::vector<ChannelProps> ReadScanHeader(std::istream& input, const JPEGMeta& meta);
+
+void ReadEndOfImage(std::istream& input);
+
 Image Decode(std::istream& input, const JPEGMeta& meta);
 
-Image Decode(const std::string& filename);
+Image Decode(std::istream& input, const JPEGMeta& meta, const DecodeOptions& options);
+
+Image Decode(std::istream& input, const DecodeOptions& options = {});
+
+Image Decode(const std::string& filename, const DecodeOptions& options = {});
 
 }  // namespace decode
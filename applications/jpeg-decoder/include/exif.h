@@ -0,0 +1,28 @@
+#pragma once
+
+#include "decoder.h"
+
+#include <string>
+#include <optional>
+#include <string_view>
+
+namespace exif {
+
+// The functions below take the payload of an APP1 segment, as in App::Payload::exif. Payloads
+// which are not EXIF, or whose TIFF structure is broken, are treated as having no tags.
+
+// Orientation tag of IFD0, 1 (upright) to 8.
+std::optional<uint16_t> GetOrientation(std::string_view payload);
+
+// Sets the orientation tag to 1 in place, if there is one.
+void ResetOrientation(std::string* payload);
+
+// Locates the JPEG thumbnail which IFD1 of the EXIF segment points at, walking only the
+// segments in front of the scan. The result is a view into jpeg.
+std::optional<std::string_view> FindThumbnail(std::string_view jpeg);
+
+// Decodes the thumbnail found by FindThumbnail, so listings can skip the full-size image.
+std::optional<Image> DecodeThumbnail(std::string_view jpeg,
+                                     const decode::DecodeOptions& options = {});
+
+}  // namespace exif
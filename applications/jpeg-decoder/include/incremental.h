@@ -0,0 +1,60 @@
+#pragma once
+
+#include "decoder.h"
+
+#include <optional>
+#include <functional>
+#include <string_view>
+
+namespace decode {
+
+// Receives rows [first_row, first_row + num_rows) of the image once they are final.
+using OnRows = std::function<void(const Image& image, size_t first_row, size_t num_rows)>;
+
+// Decodes a JPEG file which arrives in pieces, e.g. from a socket. Each Feed decodes as far as
+// the bytes received so far allow. When they run out in the middle of an MCU, the decoder rolls
+// back to the start of that MCU and resumes from there on the next Feed, so the input never
+// has to be seekable or complete. Finished MCU rows are reported through the callback.
+class IncrementalDecoder {
+public:
+    explicit IncrementalDecoder(OnRows on_rows = {});
+
+    // Returns true once the image is complete. Bytes after the end of the image are ignored.
+    bool Feed(const uint8_t* data, size_t size);
+
+    bool Feed(std::string_view data);
+
+    bool IsFinished() const;
+
+    // Rows which have not been reported yet are black. Throws until the header has arrived.
+    const Image& GetImage() const;
+
+private:
+    enum class Stage { kHeader, kScan, kEnd, kFinished };
+
+    void ParseHeader();
+    void Unstuff();
+    void DecodeMCUs();
+    void ParseEnd();
+    void ReportRows(uint16_t first_row);
+
+    OnRows on_rows_;
+    Stage stage_ = Stage::kHeader;
+    // Received bytes which have not been consumed yet.
+    std::vector<uint8_t> input_;
+    // Offset in input_ of the first header segment which has not been received completely.
+    size_t header_position_ = 2;
+
+    std::optional<JPEGMeta> meta_;
+    std::vector<ChannelProps> props_;
+
+    // Unstuffed entropy-coded data, starting with the byte the next MCU begins in.
+    std::vector<uint8_t> scan_;
+    size_t bit_position_ = 0;
+    bool scan_complete_ = false;
+
+    uint16_t cur_x_ = 0, cur_y_ = 0;
+    Image image_;
+};
+
+}  // namespace decode
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "rgb-image.h"
+
+#include <cstdint>
+#include <cstddef>
+
+namespace kernels {
+
+enum class Level { kScalar, kSSE2, kSSE41, kAVX2, kAVX512 };
+
+// Hot loops of the decoder, bound once to the best implementation the CPU supports. Every
+// level produces bit-identical results to the scalar reference.
+struct Kernels {
+    Level level;
+
+    // Inverse DCT of an 8x8 block of dequantized coefficients, both row-major.
+    void (*idct)(const double* coefficients, double* samples);
+
+    // Multiplies 64 coefficients by the quantization table, wrapping like int16_t arithmetic.
+    void (*dequantize)(const int16_t* coefficients, const int16_t* table, int16_t* output);
+
+    // Converts count full-range YCbCr samples to clamped RGB, rounding half away from zero.
+    void (*ycbcr_to_rgb)(const int16_t* y, const int16_t* cb, const int16_t* cr, RGB* output,
+                         size_t count);
+
+    // Doubles the horizontal resolution of a row by repeating every sample.
+    void (*upsample_h2)(const int16_t* input, int16_t* output, size_t count);
+
+    // Offset of the first 0xff byte in [position, size), or size if there is none.
+    size_t (*find_marker_byte)(const uint8_t* data, size_t position, size_t size);
+};
+
+// Highest level supported by the running CPU.
+Level DetectLevel();
+
+// Kernels for min(level, DetectLevel()).
+const Kernels& ForLevel(Level level);
+
+// Kernels for the detected level, unless the JPEG_DECODER_SIMD environment variable forces a
+// lower one: scalar, sse2, sse4.1, avx2 or avx512. Resolved on first use.
+const Kernels& Get();
+
+const char* LevelName(Level level);
+
+}  // namespace kernels
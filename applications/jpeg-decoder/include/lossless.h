@@ -0,0 +1,51 @@
+#pragma once
+
+#include "decoder.h"
+
+#include <string>
+#include <istream>
+#include <ostream>
+#include <optional>
+
+namespace lossless {
+
+enum class Operation {
+    kNone,
+    kFlipHorizontal,
+    kFlipVertical,
+    // Mirrors along the main diagonal.
+    kTranspose,
+    // Mirrors along the anti-diagonal.
+    kTransverse,
+    // Rotations are clockwise.
+    kRotate90,
+    kRotate180,
+    kRotate270,
+};
+
+// Region of the transformed image, in pixels. The offset has to be a multiple of the MCU size
+// of the output. A zero or too large width or height extends the region to the image edge.
+struct Crop {
+    uint16_t x = 0, y = 0, width = 0, height = 0;
+};
+
+struct TransformOptions {
+    Operation operation = Operation::kNone;
+    std::optional<Crop> crop = std::nullopt;
+    // Codes the output with Huffman tables built for its symbol statistics instead of the
+    // standard ones, at the cost of a second pass over the blocks.
+    bool optimize_huffman = false;
+};
+
+// Rotates, flips and crops a baseline JPEG without decoding it to pixels. The quantized DCT
+// blocks are permuted on the MCU grid, transposed and sign-flipped, and entropy-coded again,
+// so the image content is unchanged. Partial MCUs at an edge which a flip would move to the
+// opposite side are dropped, as there is no way to shift the block grid by less than an MCU.
+// Comments and APPn segments are copied, with the EXIF orientation reset to normal when the
+// image is rotated or flipped.
+void Transform(std::istream& input, std::ostream& output, const TransformOptions& options);
+
+void Transform(const std::string& input_filename, const std::string& output_filename,
+               const TransformOptions& options);
+
+}  // namespace lossless
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "decoder.h"
+
+#include <functional>
+#include <string_view>
+
+namespace decode {
+
+// Receives each decoded frame of a stream. The image is reused for the next frame.
+using OnFrame = std::function<void(const Image& image, size_t frame_index)>;
+
+// Decodes Motion-JPEG, a sequence of baseline JPEG frames which usually share their tables.
+// The raw bytes of the DQT and DHT segments are compared with those of the previous frame and
+// the parsed tables, Huffman lookups included, are only rebuilt when they differ. Frames
+// without DHT segments use the standard tables of Annex K, as MJPEG allows. The output image
+// and the scratch buffers are kept between frames as well.
+class MJPEGDecoder {
+public:
+    struct Stats {
+        size_t frames = 0;
+        // Frames whose quantization or Huffman tables had to be parsed.
+        size_t table_parses = 0;
+        // Frames which failed to decode.
+        size_t dropped_frames = 0;
+    };
+
+    explicit MJPEGDecoder(OnFrame on_frame = {});
+
+    // Appends bytes of the stream and decodes every frame they complete. Anything between the
+    // end of one frame and the start of the next, e.g. multipart boundaries, is skipped. A frame
+    // which fails to decode is dropped and the frames after it are decoded all the same; the
+    // error of the first one dropped is then rethrown.
+    void Feed(const uint8_t* data, size_t size);
+
+    void Feed(std::string_view data);
+
+    // Decodes one complete frame, starting at its SOI marker. Rows the frame does not cover keep
+    // the pixels of the previous frame of the same size.
+    const Image& DecodeFrame(std::string_view frame);
+
+    Stats GetStats() const;
+
+private:
+    // Offset one past the EOI marker of the frame at the start of input_, 0 if it is incomplete.
+    size_t FindFrameEnd();
+    void Drop(size_t num_bytes);
+
+    void ReadHeader(std::string_view frame, size_t* scan_offset);
+    void DecodeScan(std::string_view frame, size_t scan_offset);
+
+    OnFrame on_frame_;
+    Stats stats_;
+
+    std::vector<uint8_t> input_;
+    // How far the entropy-coded data of the frame at the start of input_ has been searched for
+    // the end marker.
+    size_t searched_ = 0;
+
+    JPEGMeta meta_;
+    std::vector<ChannelProps> props_;
+    // Segments the current tables were parsed from, marker and length included.
+    std::string quant_segments_, huffman_segments_;
+    bool has_tables_ = false;
+
+    std::vector<uint8_t> scan_;
+    Image image_;
+};
+
+}  // namespace decode
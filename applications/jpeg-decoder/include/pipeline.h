@@ -0,0 +1,31 @@
+#pragma once
+
+#include "rgb-image.h"
+
+#include <string>
+#include <vector>
+#include <functional>
+
+namespace decode {
+
+struct PipelineOptions {
+    // Number of files read ahead of the decoders. Bounds the memory held by the prefetch stage.
+    size_t queue_depth = 4;
+    // Number of threads decoding the prefetched files.
+    size_t num_decoders = 1;
+};
+
+// Called from the decoder threads, so it has to be thread-safe when num_decoders > 1.
+using OnDecoded =
+    std::function<void(size_t file_idx, const std::string& filename, Image image)>;
+
+// Reads upcoming files into pooled buffers on a dedicated thread while earlier files decode.
+// The first error stops the pipeline and is rethrown to the caller.
+void DecodeFiles(const std::vector<std::string>& filenames, const PipelineOptions& options,
+                 const OnDecoded& on_decoded);
+
+// Decodes every regular file of the directory, in lexicographic order of their paths.
+void DecodeDirectory(const std::string& directory, const PipelineOptions& options,
+                     const OnDecoded& on_decoded);
+
+}  // namespace decode
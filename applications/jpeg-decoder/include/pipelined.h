@@ -0,0 +1,15 @@
+#pragma once
+
+#include "decoder.h"
+
+namespace decode {
+
+// Decodes the entropy-coded data of a scan, the stream positioned right after the SOS header,
+// in two stages. The calling thread Huffman-decodes the coefficients of one MCU row after the
+// other into a ring of row buffers, while worker threads dequantize, transform and
+// color-convert the finished rows into the image. The stages only share the row buffers, so
+// no restart markers are needed and the result is bit-exact with the sequential decoder.
+Image DecodePipelined(std::istream& input, const std::vector<ChannelProps>& props,
+                      const JPEGMeta& meta, const DecodeOptions& options);
+
+}  // namespace decode
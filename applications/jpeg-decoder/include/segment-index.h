@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace segments {
+
+struct Segment {
+    // Offset of the 0xff byte which starts the marker.
+    uint32_t offset;
+    // Value of the length field, i.e. the payload size plus two. 0 for standalone markers.
+    uint16_t length;
+    // Second byte of the marker, e.g. 0xdb for DQT.
+    uint8_t marker;
+};
+
+struct Range {
+    uint32_t begin, end;
+};
+
+// Positions of all markers of a JPEG file, so that later passes can jump straight to a segment
+// or to the entropy-coded data without parsing everything in front of it.
+struct SegmentIndex {
+    // Every marker segment in file order, SOI and EOI included.
+    std::vector<Segment> segments;
+    // Entropy-coded data following each SOS segment, restart markers included.
+    std::vector<Range> entropy_coded;
+    // Offsets of the RSTn markers inside the entropy-coded data.
+    std::vector<uint32_t> restarts;
+
+    // Offsets are stored in 32 bits, so inputs over 4 GiB are rejected.
+    static SegmentIndex Build(const uint8_t* data, size_t size);
+
+    // First segment with the given marker, nullptr if there is none.
+    const Segment* Find(uint8_t marker) const;
+};
+
+// Returns the offset of the first 0xff byte in [position, size), or size if there is none.
+// Uses the widest byte compare the CPU supports.
+size_t FindMarkerByte(const uint8_t* data, size_t position, size_t size);
+
+}  // namespace segments
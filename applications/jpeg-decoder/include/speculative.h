@@ -0,0 +1,16 @@
+#pragma once
+
+#include "decoder.h"
+
+namespace decode {
+
+// Decodes the entropy-coded data of a scan, the stream positioned right after the SOS header,
+// with several threads. The data is split into chunks and each thread starts decoding at a
+// chunk boundary as if an MCU began there. Huffman codes resynchronize quickly, so once a
+// thread lands on a block boundary the previous chunk also produced, the rest of its work is
+// valid. Boundaries are reconciled sequentially and DC predictors are resolved afterwards, so
+// the result is bit-exact with the sequential decoder.
+Image DecodeSpeculative(std::istream& input, const std::vector<ChannelProps>& props,
+                        const JPEGMeta& meta, const DecodeOptions& options);
+
+}  // namespace decode
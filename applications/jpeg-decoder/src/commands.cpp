@@ -1,9 +1,11 @@
 #include "commands.h"
 
+#include <numeric>
+
 namespace commands {
 
 uint16_t GetContentLength(byte_streams::ByteStream& bytes) {
-    auto length = byte_streams::ComposeBytes<uint16_t>({bytes.Yield(), bytes.Yield()});
+    auto length = bytes.ReadBE<uint16_t>();
 
     if (length < 2) {
         throw std::runtime_error("block length is less than 2");
@@ -17,12 +19,8 @@ Comment::Payload Comment::Read(std::istream& stream) {
     auto content_length = GetContentLength(bytes);
 
     Payload content;
-
-    std::stringstream content_stream;
-    for (uint16_t byte_count = 0; byte_count < content_length; ++byte_count) {
-        content_stream << bytes.Yield();
-    }
-    content.comment = content_stream.str();
+    content.comment.resize(content_length);
+    bytes.ReadInto(content.comment.data(), content_length);
     return content;
 }
 
@@ -34,8 +32,8 @@ DCT::Payload DCT::Read(std::istream& stream) {
     Payload content;
 
     content.precision = bytes.Yield();
-    content.height = byte_streams::ComposeBytes<uint16_t>({bytes.Yield(), bytes.Yield()});
-    content.width = byte_streams::ComposeBytes<uint16_t>({bytes.Yield(), bytes.Yield()});
+    content.height = bytes.ReadBE<uint16_t>();
+    content.width = bytes.ReadBE<uint16_t>();
 
     content.channels.resize(bytes.Yield());
 
@@ -64,13 +62,15 @@ DQT::Payload DQT::ReadStripped(byte_streams::ByteStream& bytes, uint16_t content
         throw std::runtime_error("dqt read failed");
     }
 
-    for (uint16_t byte_count = 0; byte_count < expected_length; ++byte_count) {
+    std::array<uint8_t, 128> raw;
+    bytes.ReadInto(raw.data(), expected_length);
+
+    for (uint16_t idx = 0; idx < 64; ++idx) {
         if (content.precision == 1) {
-            content.block.At(byte_count) =
-                static_cast<int16_t>(byte_streams::ComposeBytes<uint16_t>({bytes.Yield()}));
+            content.block.At(idx) = raw[idx];
         } else if (content.precision == 2) {
-            content.block.At(byte_count) = static_cast<int16_t>(
-                byte_streams::ComposeBytes<uint16_t>({bytes.Yield(), bytes.Yield()}));
+            content.block.At(idx) = static_cast<int16_t>(
+                byte_streams::ComposeBytes<uint16_t>({raw[2 * idx], raw[2 * idx + 1]}));
         } else {
             throw std::runtime_error("unexpected precision value");
         }
@@ -113,21 +113,17 @@ DHT::Payload DHT::ReadStripped(byte_streams::ByteStream& bytes) {
         throw std::runtime_error("invalid ac/dc flag in huffman table");
     }
 
-    uint16_t num_values_accumulated = 0;
-
-    std::vector<uint8_t> values, num_values;
-
-    for (uint8_t entry_id = 1; entry_id < kNumEntries + 1; ++entry_id) {
-        num_values.push_back(bytes.Yield());
-        num_values_accumulated += num_values.back();
-    }
+    std::vector<uint8_t> num_values(kNumEntries);
+    bytes.ReadInto(num_values.data(), num_values.size());
 
-    for (uint16_t value_idx = 0; value_idx < num_values_accumulated; ++value_idx) {
-        values.push_back(bytes.Yield());
-    }
+    std::vector<uint8_t> values(std::accumulate(num_values.begin(), num_values.end(), 0));
+    bytes.ReadInto(values.data(), values.size());
 
     content.tree = huffman::HuffmanTree<uint8_t, uint8_t>::FromSequence(num_values, values);
+    content.lookup = huffman::LookupDecoder<uint8_t>::FromSequence(num_values, values);
     content.content_length = values.size() + num_values.size() + 1;
+    content.num_values = std::move(num_values);
+    content.values = std::move(values);
     return content;
 }
 
@@ -155,6 +151,64 @@ std::vector<DHT::Payload> DHT::ReadMultiple(std::istream& stream) {
     return returned;
 }
 
+std::vector<DHT::Payload> DHT::Standard() {
+    static const std::vector<uint8_t> kDCLuminanceCounts = {0, 1, 5, 1, 1, 1, 1, 1,
+                                                            1, 0, 0, 0, 0, 0, 0, 0};
+    static const std::vector<uint8_t> kDCChrominanceCounts = {0, 3, 1, 1, 1, 1, 1, 1,
+                                                              1, 1, 1, 0, 0, 0, 0, 0};
+    static const std::vector<uint8_t> kDCValues = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+
+    static const std::vector<uint8_t> kACLuminanceCounts = {0, 2, 1, 3, 3, 2, 4, 3,
+                                                            5, 5, 4, 4, 0, 0, 1, 0x7d};
+    static const std::vector<uint8_t> kACLuminanceValues = {
+        0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51,
+        0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1,
+        0x15, 0x52, 0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18,
+        0x19, 0x1a, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39,
+        0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57,
+        0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75,
+        0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x92,
+        0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+        0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+        0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8,
+        0xd9, 0xda, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2,
+        0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa};
+
+    static const std::vector<uint8_t> kACChrominanceCounts = {0, 2, 1, 2, 4, 4, 3, 4,
+                                                              7, 5, 4, 4, 0, 1, 2, 0x77};
+    static const std::vector<uint8_t> kACChrominanceValues = {
+        0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07,
+        0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09,
+        0x23, 0x33, 0x52, 0xf0, 0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25,
+        0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38,
+        0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56,
+        0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74,
+        0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+        0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+        0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba,
+        0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6,
+        0xd7, 0xd8, 0xd9, 0xda, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2,
+        0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa};
+
+    auto make = [](uint8_t is_ac, uint8_t id, const std::vector<uint8_t>& num_values,
+                   const std::vector<uint8_t>& values) {
+        Payload table;
+        table.is_ac = is_ac;
+        table.id = id;
+        table.tree = HuffmanTree::FromSequence(num_values, values);
+        table.lookup = huffman::LookupDecoder<uint8_t>::FromSequence(num_values, values);
+        table.content_length = values.size() + num_values.size() + 1;
+        table.num_values = num_values;
+        table.values = values;
+        return table;
+    };
+
+    return {make(0, 0, kDCLuminanceCounts, kDCValues),
+            make(1, 0, kACLuminanceCounts, kACLuminanceValues),
+            make(0, 1, kDCChrominanceCounts, kDCValues),
+            make(1, 1, kACChrominanceCounts, kACChrominanceValues)};
+}
+
 SOS::Payload SOS::Read(std::istream& stream) {
     byte_streams::ByteStream bytes(stream);
     GetContentLength(bytes);
@@ -195,12 +249,8 @@ App::Payload App::Read(std::istream& stream) {
     auto content_length = GetContentLength(bytes);
 
     Payload content;
-
-    std::stringstream content_stream;
-    for (uint16_t byte_count = 0; byte_count < content_length; ++byte_count) {
-        content_stream << bytes.Yield();
-    }
-    content.exif = content_stream.str();
+    content.exif.resize(content_length);
+    bytes.ReadInto(content.exif.data(), content_length);
     return content;
 }
 
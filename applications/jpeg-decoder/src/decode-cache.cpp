@@ -0,0 +1,155 @@
+#include "decode-cache.h"
+
+#include <cstring>
+#include <filesystem>
+
+namespace decode {
+
+namespace {
+
+constexpr uint64_t kMultiplier = 0x9e3779b97f4a7c15ull;
+
+uint64_t Mix(uint64_t value) {
+    value ^= value >> 32;
+    value *= 0xd6e8feb86659fd93ull;
+    value ^= value >> 32;
+    return value;
+}
+
+// Word at a time multiplicative hash. Not cryptographic, as collisions only share a bucket, but
+// it keeps up with memory bandwidth, which matters since every lookup hashes the whole file.
+uint64_t HashBytes(std::string_view bytes) {
+    uint64_t hash = bytes.size() * kMultiplier;
+
+    size_t position = 0;
+    for (; position + 8 <= bytes.size(); position += 8) {
+        uint64_t word;
+        std::memcpy(&word, bytes.data() + position, 8);
+        hash = (hash ^ Mix(word)) * kMultiplier;
+    }
+
+    uint64_t tail = 0;
+    std::memcpy(&tail, bytes.data() + position, bytes.size() - position);
+    hash = (hash ^ Mix(tail)) * kMultiplier;
+
+    return Mix(hash);
+}
+
+size_t ImageBytes(const Image& image) {
+    return image.Width() * image.Height() * sizeof(RGB) + image.GetComment().size();
+}
+
+}  // namespace
+
+DecodeCache::DecodeCache(size_t byte_budget) : byte_budget_(byte_budget) {
+}
+
+DecodeCache::Key DecodeCache::MakeKey(std::string_view bytes) {
+    return {HashBytes(bytes), bytes};
+}
+
+std::shared_ptr<const Image> DecodeCache::Decode(std::string_view bytes,
+                                                 const DecodeOptions& options) {
+    auto key = MakeKey(bytes);
+
+    std::promise<std::shared_ptr<const Image>> promise;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        auto found = entries_.find(key);
+        if (found != entries_.end()) {
+            ++stats_.hits;
+
+            auto& entry = found->second;
+            if (entry.ready) {
+                lru_.splice(lru_.begin(), lru_, entry.lru_position);
+            }
+
+            auto image = entry.image;
+            lock.unlock();
+            return image.get();
+        }
+
+        ++stats_.misses;
+        auto bytes_copy = std::make_unique<const std::string>(bytes);
+        key.bytes = *bytes_copy;
+        auto& entry = entries_[key];
+        entry.bytes_copy = std::move(bytes_copy);
+        entry.image = promise.get_future().share();
+    }
+
+    std::shared_ptr<const Image> image;
+    try {
+        byte_streams::MemoryStream stream(bytes.data(), bytes.size());
+        image = std::make_shared<const Image>(decode::Decode(stream, options));
+    } catch (...) {
+        // Drop the entry so that later requests retry, waiting ones get the error.
+        std::lock_guard<std::mutex> lock(mutex_);
+        // By iterator, as the key refers into the entry.
+        entries_.erase(entries_.find(key));
+        promise.set_exception(std::current_exception());
+        throw;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    promise.set_value(image);
+    Insert(key, image);
+    return image;
+}
+
+std::shared_ptr<const Image> DecodeCache::DecodeFile(const std::string& filename,
+                                                     const DecodeOptions& options) {
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file) {
+        throw std::runtime_error("failed to open " + filename);
+    }
+
+    // A directory opens as well, with a meaningless size.
+    auto size = file.tellg();
+    if (size < 0 || !std::filesystem::is_regular_file(filename)) {
+        throw std::runtime_error("failed to read " + filename);
+    }
+    std::string bytes(static_cast<size_t>(size), '\0');
+    file.seekg(0);
+    file.read(bytes.data(), bytes.size());
+    if (static_cast<size_t>(file.gcount()) != bytes.size()) {
+        throw std::runtime_error("failed to read " + filename);
+    }
+
+    return Decode(bytes, options);
+}
+
+DecodeCache::Stats DecodeCache::GetStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void DecodeCache::Insert(const Key& key, const std::shared_ptr<const Image>& image) {
+    auto& entry = entries_.at(key);
+    entry.bytes = ImageBytes(*image) + entry.bytes_copy->size();
+
+    // Waiters already hold the future, so an image over budget can simply be forgotten.
+    if (entry.bytes > byte_budget_) {
+        entries_.erase(entries_.find(key));
+        return;
+    }
+
+    entry.ready = true;
+    entry.lru_position = lru_.insert(lru_.begin(), key);
+    stats_.bytes += entry.bytes;
+
+    EvictOverBudget();
+}
+
+void DecodeCache::EvictOverBudget() {
+    while (stats_.bytes > byte_budget_ && !lru_.empty()) {
+        auto evicted = entries_.find(lru_.back());
+        stats_.bytes -= evicted->second.bytes;
+        ++stats_.evictions;
+
+        entries_.erase(evicted);
+        lru_.pop_back();
+    }
+}
+
+}  // namespace decode
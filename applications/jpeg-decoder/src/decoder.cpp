@@ -1,29 +1,11 @@
-#include "fourier.h"
 #include "decoder.h"
+#include "speculative.h"
+#include "pipelined.h"
+#include "kernels.h"
 
-namespace decode {
-
-struct HuffmanStorage {
-    std::vector<std::vector<commands::DHT::Payload>> trees;
-
-    static HuffmanStorage FromPayload(const std::vector<commands::DHT::Payload>& parsed_trees);
-    const commands::DHT::Payload& Get(uint8_t id, uint8_t is_ac) const;
-};
-
-struct JPEGMeta {
-    uint16_t width, height, precision;
-    uint8_t mcu_x_step = 8, mcu_y_step = 8;
-    uint8_t max_granularity_h = 0, max_granularity_v = 0;
-
-    std::vector<commands::Comment::Payload> comments;
-    std::vector<commands::App::Payload> app_info;
-    std::vector<commands::DQT::Payload> q_tables;
-    std::vector<commands::DCT::ChannelProps> channels;
-
-    HuffmanStorage huffman_trees;
+#include <cmath>
 
-    JPEGMeta(std::istream& input);
-};
+namespace decode {
 
 HuffmanStorage HuffmanStorage::FromPayload(
     const std::vector<commands::DHT::Payload>& parsed_trees) {
@@ -88,6 +70,7 @@ JPEGMeta::JPEGMeta(std::istream& input) {
             comments.push_back(commands::Comment::Read(input));
         } else if (commands::CheckToken<commands::App>(code)) {
             app_info.push_back(commands::App::Read(input));
+            app_info.back().marker = code;
         } else if (commands::CheckToken<commands::DQT>(code)) {
             auto payloads = commands::DQT::ReadMultiple(input);
             for (const auto& payload : payloads) {
@@ -103,6 +86,9 @@ JPEGMeta::JPEGMeta(std::istream& input) {
                 throw std::runtime_error("jpeg meta read failed: duplicated DCT field");
             }
             dct = commands::DCT::Read(input);
+        } else if (!stop) {
+            // Segments the decoder has no use for, e.g. DRI, are skipped by their length.
+            bytes.Skip(commands::GetContentLength(bytes));
         }
 
     } while (!stop && !bytes.IsFinished());
@@ -126,24 +112,30 @@ JPEGMeta::JPEGMeta(std::istream& input) {
     }
 
     huffman_trees = HuffmanStorage::FromPayload(trees_tmp);
+    SetQuantTables(q_tables_tmp);
+    SetFrame(dct.value());
+}
 
-    q_tables.resize(q_tables_tmp.size());
-    for (auto& q_table : q_tables_tmp) {
+void JPEGMeta::SetQuantTables(const std::vector<commands::DQT::Payload>& parsed_tables) {
+    q_tables.clear();
+    q_tables.resize(parsed_tables.size());
+    for (auto& q_table : parsed_tables) {
         q_tables[q_table.id] = q_table;
     }
+}
 
-    const auto& dct_value = dct.value();
-
-    width = dct_value.width;
-    height = dct_value.height;
-    precision = dct_value.precision;
+void JPEGMeta::SetFrame(const commands::DCT::Payload& dct) {
+    width = dct.width;
+    height = dct.height;
+    precision = dct.precision;
 
     if (width * height == 0) {
         throw std::runtime_error("empty images not supported");
     }
 
-    channels.resize(dct_value.channels.size() + 1);  // + 1 because of data indexing
-    for (auto& props : dct_value.channels) {
+    max_granularity_h = max_granularity_v = 0;
+    channels.assign(dct.channels.size() + 1, {});  // + 1 because of data indexing
+    for (auto& props : dct.channels) {
         if (props.dqt_table_id >= q_tables.size()) {
             throw std::runtime_error("q table is not defined");
         }
@@ -221,83 +213,33 @@ RGB MCU::GetRGB(int8_t x_offset, int8_t y_offset, const JPEGMeta& meta) {
     };
 }
 
-uint8_t DecodeByte(byte_streams::BitStream& bits, const commands::DHT::HuffmanTree& tree) {
-    auto current = tree.root.get();
+CBlock TransformBlock(const Block& decoded, const JPEGMeta& meta) {
+    const auto& kernels = kernels::Get();
+    const auto& rescaler = meta.q_tables[meta.channels[decoded.channel_id].dqt_table_id].block;
 
-    while (!current->IsTerminal()) {
-        bool bit = bits.Yield();
+    blocks::Block<int16_t, 8> dequantized;
+    kernels.dequantize(decoded.block.buffer.data(), rescaler.buffer.data(), dequantized.Data());
 
-        current = bit ? current->right : current->left;
+    auto cartesian = blocks::ToCartesianZZ<int16_t, double, 8>(dequantized);
+    blocks::Cartesian<double, 8> samples;
+    kernels.idct(cartesian.buffer.data()->data(), samples.buffer.data()->data());
 
-        if (current == nullptr) {
-            throw std::runtime_error("error getting huffman code");
-        }
-    }
-    return current->value.value();
-}
+    auto samples16 = blocks::As<double, std::int16_t, 8>(samples);
 
-int16_t MaybeNegate(uint8_t num_bits, int16_t raw) {
-    if ((raw >> (num_bits - 1)) == 0) {
-        return raw - (1 << num_bits) + 1;
-    }
-    return raw;
+    auto clipped = Clip(samples16 + std::int16_t(128), std::int16_t(0), std::int16_t(255));
+    return {clipped, decoded.channel_id};
 }
 
-CBlock DecodeBlock(byte_streams::BitStream& bits, ChannelProps& channel, fft::IDCT88V2& idct,
-                   const JPEGMeta& meta) {
-    Block decoded;
-    decoded.channel_id = channel.props.id;
-    decoded.block.buffer.fill(0);
-
-    const auto& dc_tree = meta.huffman_trees.Get(channel.props.dc_ht_id, 0);
-    const auto& ac_tree = meta.huffman_trees.Get(channel.props.ac_ht_id, 1);
-
-    auto dc_byte = DecodeByte(bits, dc_tree.tree);
-
-    auto decoded_it = decoded.block.buffer.begin();
-
-    if (dc_byte == 0x00) {
-        *decoded_it = dc_byte;
-    } else {
-        auto [num_zeros, num_bits] = byte_streams::SplitByte(dc_byte);
-        auto abs_c = byte_streams::ComposeNBitsLE(num_bits, bits);
-        auto negated = MaybeNegate(num_bits, abs_c);
-        *decoded_it = negated;
-    }
+CBlock DecodeBlock(byte_streams::BitStream& bits, ChannelProps& channel, const JPEGMeta& meta) {
+    auto decoded = DecodeDifferences(bits, channel.props, meta);
 
     decoded.block.buffer[0] += channel.last_dc;
     channel.last_dc = decoded.block.buffer[0];
 
-    decoded_it = std::next(decoded_it);
-
-    while (decoded_it != decoded.block.buffer.end() && !bits.IsFinished()) {
-        auto ac_byte = DecodeByte(bits, ac_tree.tree);
-        if (ac_byte == 0x00) {
-            break;
-        } else if (ac_byte == 0xf0) {
-            decoded_it = std::next(decoded_it, 16);
-        } else {
-            auto [num_zeros, num_bits] = byte_streams::SplitByte(ac_byte);
-            decoded_it = std::next(decoded_it, num_zeros);
-
-            auto abs_c = byte_streams::ComposeNBitsLE(num_bits, bits);
-            *decoded_it = MaybeNegate(num_bits, abs_c);
-            decoded_it = std::next(decoded_it);
-        }
-    }
-
-    const auto& rescaler = meta.q_tables[meta.channels[channel.props.id].dqt_table_id].block;
-    decoded.block = decoded.block * rescaler;
-
-    auto cartesian = blocks::ToCartesianZZ<int16_t, double, 8>(decoded.block);
-    auto fft = idct.Transform(cartesian);
-    auto fft16 = blocks::As<double, std::int16_t, 8>(fft);
-
-    auto clipped = Clip(fft16 + std::int16_t(128), std::int16_t(0), std::int16_t(255));
-    return {clipped, decoded.channel_id};
+    return TransformBlock(decoded, meta);
 }
 
-MCU DecodeMCU(byte_streams::BitStream& bits, std::vector<ChannelProps>& props, fft::IDCT88V2& idct,
+MCU DecodeMCU(byte_streams::BitStream& bits, std::vector<ChannelProps>& props,
               const JPEGMeta& meta) {
 
     MCU decoded(props.size());
@@ -309,7 +251,7 @@ MCU DecodeMCU(byte_streams::BitStream& bits, std::vector<ChannelProps>& props, f
         uint8_t num_blocks = card.horizontal_sp * card.vertical_sp;
 
         for (uint8_t block_idx = 0; block_idx < num_blocks; ++block_idx) {
-            auto block = DecodeBlock(bits, channel, idct, meta);
+            auto block = DecodeBlock(bits, channel, meta);
             decoded.per_channel_blocks[channel_idx].push_back(block);
         }
     }
@@ -317,7 +259,56 @@ MCU DecodeMCU(byte_streams::BitStream& bits, std::vector<ChannelProps>& props, f
     return decoded;
 }
 
-Image Decode(std::istream& input, const JPEGMeta& meta) {
+// Samples of one channel along a row of the MCU, upsampled to the MCU width.
+void GetRow(const std::vector<CBlock>& blocks, uint8_t y_offset, const JPEGMeta& meta,
+            int16_t* row) {
+    const auto& props = meta.channels[blocks[0].channel_id];
+
+    if (meta.max_granularity_h == 2 && props.horizontal_sp == 1 && props.vertical_sp == 1) {
+        std::array<int16_t, 8> half_row;
+        uint8_t block_row = meta.max_granularity_v == 2 ? y_offset / 2 : y_offset;
+        for (uint8_t x_offset = 0; x_offset < half_row.size(); ++x_offset) {
+            half_row[x_offset] = blocks[0].block.buffer[x_offset][block_row];
+        }
+        kernels::Get().upsample_h2(half_row.data(), row, half_row.size());
+        return;
+    }
+
+    for (uint8_t x_offset = 0; x_offset < meta.mcu_x_step; ++x_offset) {
+        row[x_offset] = MCU::GetValue(blocks, x_offset, y_offset, meta);
+    }
+}
+
+void PutMCU(MCU& mcu, uint16_t cur_x, uint16_t cur_y, const JPEGMeta& meta, Image* image) {
+    std::array<std::array<int16_t, 16>, 3> rows;
+    rows[1].fill(128);
+    rows[2].fill(128);
+
+    std::array<RGB, 16> pixels;
+    size_t row_width = std::min<size_t>(meta.mcu_x_step, meta.width - cur_x);
+
+    for (uint8_t y_offset = 0; y_offset < meta.mcu_y_step; ++y_offset) {
+        uint16_t y_image = y_offset + cur_y;
+        if (y_image >= meta.height) {
+            break;
+        }
+
+        GetRow(mcu.per_channel_blocks[0], y_offset, meta, rows[0].data());
+        if (mcu.per_channel_blocks.size() == 3) {
+            GetRow(mcu.per_channel_blocks[1], y_offset, meta, rows[1].data());
+            GetRow(mcu.per_channel_blocks[2], y_offset, meta, rows[2].data());
+        }
+
+        kernels::Get().ycbcr_to_rgb(rows[0].data(), rows[1].data(), rows[2].data(),
+                                    pixels.data(), row_width);
+
+        for (size_t x_offset = 0; x_offset < row_width; ++x_offset) {
+            image->SetPixel(y_image, cur_x + x_offset, pixels[x_offset]);
+        }
+    }
+}
+
+std::vector<ChannelProps> ReadScanHeader(std::istream& input, const JPEGMeta& meta) {
     auto bytes = byte_streams::ByteStream(input);
     if (bytes.Yield() != 0xff) {
         throw std::runtime_error("0xff expected");
@@ -327,10 +318,7 @@ Image Decode(std::istream& input, const JPEGMeta& meta) {
         throw std::runtime_error("0xda expected");
     }
 
-    auto idct = fft::IDCT88V2();
-
     auto sos = commands::SOS::Read(input);
-    auto bits = byte_streams::BitStream(input, true);
 
     std::vector<ChannelProps> props;
 
@@ -341,24 +329,33 @@ Image Decode(std::istream& input, const JPEGMeta& meta) {
             throw std::runtime_error("unexpected channel id in sos information");
         }
     }
+    return props;
+}
+
+void ReadEndOfImage(std::istream& input) {
+    auto bytes = byte_streams::ByteStream(input);
+
+    if (bytes.Yield() != 0xff) {
+        throw std::runtime_error("0xff expected: premature end of image");
+    }
+
+    if (bytes.Yield() != 0xd9) {
+        throw std::runtime_error("0xd9 expected: premature end of image");
+    }
+}
+
+Image Decode(std::istream& input, const JPEGMeta& meta) {
+    auto props = ReadScanHeader(input, meta);
+
+    auto bits = byte_streams::BitStream(input, true);
 
     Image image(meta.width, meta.height);
     uint16_t cur_x = 0, cur_y = 0;
 
     while (!bits.IsFinished() && cur_x < meta.width && cur_y < meta.height) {
-        auto mcu = DecodeMCU(bits, props, idct, meta);
-        for (uint8_t x_offset = 0; x_offset < meta.mcu_x_step; ++x_offset) {
-            for (uint8_t y_offset = 0; y_offset < meta.mcu_y_step; ++y_offset) {
-                uint16_t x_image = x_offset + cur_x, y_image = y_offset + cur_y;
-
-                if (x_image >= meta.width || y_image >= meta.height) {
-                    continue;
-                }
+        auto mcu = DecodeMCU(bits, props, meta);
+        PutMCU(mcu, cur_x, cur_y, meta, &image);
 
-                auto rgb = mcu.GetRGB(x_offset, y_offset, meta);
-                image.SetPixel(y_image, x_image, rgb);
-            }
-        }
         cur_x += meta.mcu_x_step;
         if (cur_x >= meta.width) {
             cur_x = 0;
@@ -366,23 +363,27 @@ Image Decode(std::istream& input, const JPEGMeta& meta) {
         }
     }
 
-    if (bytes.Yield() != 0xff) {
-        throw std::runtime_error("0xff expected: premature end of image");
-    }
+    ReadEndOfImage(input);
+    return image;
+}
 
-    if (bytes.Yield() != 0xd9) {
-        throw std::runtime_error("0xd9 expected: premature end of image");
+Image Decode(std::istream& input, const JPEGMeta& meta, const DecodeOptions& options) {
+    if (options.speculative_threads == 0 && options.pipeline_threads == 0) {
+        return Decode(input, meta);
     }
 
+    auto props = ReadScanHeader(input, meta);
+    auto image = options.speculative_threads > 0 ? DecodeSpeculative(input, props, meta, options)
+                                                 : DecodePipelined(input, props, meta, options);
+
+    ReadEndOfImage(input);
     return image;
 }
 
-Image Decode(const std::string& filename) {
-    std::ifstream jpeg_stream(filename, std::ios::binary);
-
-    decode::JPEGMeta meta(jpeg_stream);
+Image Decode(std::istream& input, const DecodeOptions& options) {
+    decode::JPEGMeta meta(input);
 
-    auto image = decode::Decode(jpeg_stream, meta);
+    auto image = decode::Decode(input, meta, options);
 
     if (!meta.comments.empty()) {
         image.SetComment(meta.comments.back().comment);
@@ -391,4 +392,9 @@ Image Decode(const std::string& filename) {
     return image;
 }
 
+Image Decode(const std::string& filename, const DecodeOptions& options) {
+    std::ifstream jpeg_stream(filename, std::ios::binary);
+    return Decode(jpeg_stream, options);
+}
+
 }  // namespace decode
@@ -0,0 +1,197 @@
+#include "exif.h"
+
+namespace exif {
+
+namespace {
+
+constexpr std::string_view kHeader("Exif\0\0", 6);
+
+constexpr uint16_t kOrientationTag = 0x0112;
+constexpr uint16_t kThumbnailOffsetTag = 0x0201;
+constexpr uint16_t kThumbnailLengthTag = 0x0202;
+
+constexpr uint16_t kShortType = 3;
+constexpr uint16_t kLongType = 4;
+
+// TIFF structure following the EXIF header. All offsets are relative to its start.
+class TiffView {
+public:
+    static std::optional<TiffView> FromPayload(std::string_view payload) {
+        if (payload.size() < kHeader.size() + 8 || payload.substr(0, kHeader.size()) != kHeader) {
+            return std::nullopt;
+        }
+
+        TiffView tiff;
+        tiff.data_ = reinterpret_cast<const uint8_t*>(payload.data()) + kHeader.size();
+        tiff.size_ = payload.size() - kHeader.size();
+        tiff.little_endian_ = tiff.data_[0] == 'I';
+        return tiff;
+    }
+
+    bool Contains(size_t offset, size_t size) const {
+        return offset <= size_ && size <= size_ - offset;
+    }
+
+    uint32_t Read(size_t offset, size_t num_bytes) const {
+        uint32_t value = 0;
+        for (size_t idx = 0; idx < num_bytes; ++idx) {
+            size_t byte = little_endian_ ? offset + num_bytes - 1 - idx : offset + idx;
+            value = (value << 8) | data_[byte];
+        }
+        return value;
+    }
+
+    size_t FirstIFD() const {
+        return Read(4, 4);
+    }
+
+    // Offset of the IFD after the one at ifd, 0 if there is none.
+    size_t NextIFD(size_t ifd) const {
+        if (!Contains(ifd, 2)) {
+            return 0;
+        }
+        size_t next = ifd + 2 + 12 * Read(ifd, 2);
+        return Contains(next, 4) ? Read(next, 4) : 0;
+    }
+
+    // Offset of the 12 byte entry with the tag in the IFD at ifd.
+    std::optional<size_t> FindEntry(size_t ifd, uint16_t tag) const {
+        if (ifd == 0 || !Contains(ifd, 2)) {
+            return std::nullopt;
+        }
+
+        size_t num_entries = Read(ifd, 2);
+        for (size_t idx = 0; idx < num_entries; ++idx) {
+            size_t entry = ifd + 2 + 12 * idx;
+            if (!Contains(entry, 12)) {
+                return std::nullopt;
+            }
+            if (Read(entry, 2) == tag) {
+                return entry;
+            }
+        }
+        return std::nullopt;
+    }
+
+    // A single SHORT or LONG value, which is stored inside the entry.
+    std::optional<uint32_t> ReadValue(size_t entry) const {
+        switch (Read(entry + 2, 2)) {
+            case kShortType:
+                return Read(entry + 8, 2);
+            case kLongType:
+                return Read(entry + 8, 4);
+            default:
+                return std::nullopt;
+        }
+    }
+
+    bool IsLittleEndian() const {
+        return little_endian_;
+    }
+
+private:
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    bool little_endian_ = false;
+};
+
+std::optional<std::string_view> FindThumbnailInPayload(std::string_view payload) {
+    auto tiff = TiffView::FromPayload(payload);
+    if (!tiff.has_value()) {
+        return std::nullopt;
+    }
+
+    auto ifd1 = tiff->NextIFD(tiff->FirstIFD());
+    auto offset_entry = tiff->FindEntry(ifd1, kThumbnailOffsetTag);
+    auto length_entry = tiff->FindEntry(ifd1, kThumbnailLengthTag);
+    if (!offset_entry.has_value() || !length_entry.has_value()) {
+        return std::nullopt;
+    }
+
+    auto offset = tiff->ReadValue(*offset_entry), length = tiff->ReadValue(*length_entry);
+    if (!offset.has_value() || !length.has_value() || !tiff->Contains(*offset, *length)) {
+        return std::nullopt;
+    }
+
+    auto thumbnail = payload.substr(kHeader.size() + *offset, *length);
+    if (thumbnail.size() < 2 || static_cast<uint8_t>(thumbnail[0]) != 0xff ||
+        !commands::CheckToken<commands::Start>(thumbnail[1])) {
+        return std::nullopt;
+    }
+    return thumbnail;
+}
+
+}  // namespace
+
+std::optional<uint16_t> GetOrientation(std::string_view payload) {
+    auto tiff = TiffView::FromPayload(payload);
+    if (!tiff.has_value()) {
+        return std::nullopt;
+    }
+
+    auto entry = tiff->FindEntry(tiff->FirstIFD(), kOrientationTag);
+    if (!entry.has_value() || tiff->Read(*entry + 2, 2) != kShortType) {
+        return std::nullopt;
+    }
+    return tiff->Read(*entry + 8, 2);
+}
+
+void ResetOrientation(std::string* payload) {
+    auto tiff = TiffView::FromPayload(*payload);
+    if (!tiff.has_value()) {
+        return;
+    }
+
+    auto entry = tiff->FindEntry(tiff->FirstIFD(), kOrientationTag);
+    if (!entry.has_value() || tiff->Read(*entry + 2, 2) != kShortType) {
+        return;
+    }
+
+    size_t value = kHeader.size() + *entry + 8;
+    (*payload)[value] = tiff->IsLittleEndian() ? 1 : 0;
+    (*payload)[value + 1] = tiff->IsLittleEndian() ? 0 : 1;
+}
+
+std::optional<std::string_view> FindThumbnail(std::string_view jpeg) {
+    auto data = reinterpret_cast<const uint8_t*>(jpeg.data());
+    if (jpeg.size() < 2 || data[0] != 0xff || !commands::CheckToken<commands::Start>(data[1])) {
+        throw std::runtime_error("start token not found");
+    }
+
+    size_t position = 2;
+    while (position + 4 <= jpeg.size() && data[position] == 0xff) {
+        auto code = data[position + 1];
+        if (commands::CheckToken<commands::SOS>(code) ||
+            commands::CheckToken<commands::End>(code)) {
+            break;
+        }
+
+        auto length =
+            byte_streams::ComposeBytes<uint16_t>({data[position + 2], data[position + 3]});
+        if (length < 2 || position + 2 + length > jpeg.size()) {
+            break;
+        }
+
+        if (code == commands::App::kStart[1]) {
+            auto thumbnail = FindThumbnailInPayload(jpeg.substr(position + 4, length - 2));
+            if (thumbnail.has_value()) {
+                return thumbnail;
+            }
+        }
+        position += 2 + length;
+    }
+
+    return std::nullopt;
+}
+
+std::optional<Image> DecodeThumbnail(std::string_view jpeg, const decode::DecodeOptions& options) {
+    auto thumbnail = FindThumbnail(jpeg);
+    if (!thumbnail.has_value()) {
+        return std::nullopt;
+    }
+
+    byte_streams::MemoryStream stream(thumbnail->data(), thumbnail->size());
+    return decode::Decode(stream, options);
+}
+
+}  // namespace exif
@@ -1,7 +1,17 @@
 #include "fourier.h"
 
+#include <mutex>
+
 namespace fft {
 
+namespace {
+
+// The FFTW planner is not thread-safe, and fftw_cleanup is only allowed once no plans are left.
+std::mutex planner_mutex;
+size_t num_live_plans = 0;
+
+}  // namespace
+
 IDCT88V1::IDCT88V1() {
     cu_.fill(1);
     cu_[0] = 1.0 / std::sqrt(2);
@@ -36,13 +46,18 @@ blocks::Cartesian<double, 8> IDCT88V1::Transform(const blocks::Cartesian<double,
 }
 
 IDCT88V2::IDCT88V2() {
+    std::lock_guard<std::mutex> lock(planner_mutex);
     plan_ = fftw_plan_r2r_2d(8, 8, input_.Data(), output_.Data(), FFTW_REDFT01, FFTW_REDFT01,
                              FFTW_ESTIMATE);
+    ++num_live_plans;
 }
 
 IDCT88V2::~IDCT88V2() {
+    std::lock_guard<std::mutex> lock(planner_mutex);
     fftw_destroy_plan(plan_);
-    fftw_cleanup();
+    if (--num_live_plans == 0) {
+        fftw_cleanup();
+    }
 }
 
 blocks::Cartesian<double, 8> IDCT88V2::Transform(const blocks::Cartesian<double, 8>& f) {
@@ -0,0 +1,223 @@
+#include "incremental.h"
+#include "segment-index.h"
+
+namespace decode {
+
+IncrementalDecoder::IncrementalDecoder(OnRows on_rows) : on_rows_(std::move(on_rows)) {
+}
+
+bool IncrementalDecoder::Feed(const uint8_t* data, size_t size) {
+    if (stage_ == Stage::kFinished) {
+        return true;
+    }
+
+    input_.insert(input_.end(), data, data + size);
+
+    if (stage_ == Stage::kHeader) {
+        ParseHeader();
+    }
+
+    if (stage_ == Stage::kScan) {
+        Unstuff();
+        DecodeMCUs();
+
+        if (scan_complete_) {
+            if (cur_x_ != 0) {
+                ReportRows(cur_y_);  // the data ended in the middle of an MCU row
+            }
+            stage_ = Stage::kEnd;
+        }
+    }
+
+    if (stage_ == Stage::kEnd) {
+        ParseEnd();
+    }
+
+    return stage_ == Stage::kFinished;
+}
+
+bool IncrementalDecoder::Feed(std::string_view data) {
+    return Feed(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+}
+
+bool IncrementalDecoder::IsFinished() const {
+    return stage_ == Stage::kFinished;
+}
+
+const Image& IncrementalDecoder::GetImage() const {
+    if (!meta_.has_value()) {
+        throw std::runtime_error("image header has not been received yet");
+    }
+    return image_;
+}
+
+// Waits until every segment up to and including SOS is complete, then hands them to the
+// regular parsers at once. The segments are walked from the first incomplete one, so that small
+// pieces do not make the walk quadratic.
+void IncrementalDecoder::ParseHeader() {
+    if (input_.size() < 2) {
+        return;
+    }
+
+    if (input_[0] != 0xff || !commands::CheckToken<commands::Start>(input_[1])) {
+        throw std::runtime_error("start token not found");
+    }
+
+    size_t position = header_position_;
+    while (true) {
+        if (position + 4 > input_.size()) {
+            header_position_ = position;
+            return;
+        }
+
+        if (input_[position] != 0xff) {
+            throw std::runtime_error("jpeg meta read failed: unexpected token");
+        }
+
+        auto code = input_[position + 1];
+        auto length =
+            byte_streams::ComposeBytes<uint16_t>({input_[position + 2], input_[position + 3]});
+        if (position + 2 + length > input_.size()) {
+            header_position_ = position;
+            return;
+        }
+
+        position += 2 + length;
+        if (commands::CheckToken<commands::SOS>(code)) {
+            break;
+        }
+    }
+
+    byte_streams::MemoryStream header(reinterpret_cast<const char*>(input_.data()), position);
+    meta_.emplace(header);
+    props_ = ReadScanHeader(header, *meta_);
+
+    image_.SetSize(meta_->width, meta_->height);
+    if (!meta_->comments.empty()) {
+        image_.SetComment(meta_->comments.back().comment);
+    }
+
+    input_.erase(input_.begin(), input_.begin() + position);
+    stage_ = Stage::kScan;
+}
+
+// Moves the received entropy-coded bytes into scan_ without the stuffing. A trailing 0xff
+// stays in input_ until the byte after it shows whether it starts a marker.
+void IncrementalDecoder::Unstuff() {
+    size_t position = 0;
+
+    while (position < input_.size()) {
+        auto marker = segments::FindMarkerByte(input_.data(), position, input_.size());
+        scan_.insert(scan_.end(), input_.begin() + position, input_.begin() + marker);
+        position = marker;
+
+        if (position + 1 >= input_.size()) {
+            break;
+        }
+
+        auto next = input_[position + 1];
+        if (next != 0x00 && next != 0xff) {
+            scan_complete_ = true;
+            break;
+        }
+
+        scan_.push_back(0xff);
+        position += 2;
+    }
+
+    input_.erase(input_.begin(), input_.begin() + position);
+}
+
+void IncrementalDecoder::DecodeMCUs() {
+    const auto& meta = *meta_;
+    const size_t num_bits = 8 * scan_.size();
+    byte_streams::BufferBitStream bits(scan_.data(), scan_.size());
+
+    std::vector<Block> decoded;
+    std::vector<int16_t> last_dc(props_.size());
+
+    // Like the sequential decoder, an MCU is only started while there is data left.
+    while (cur_y_ < meta.height && bit_position_ < num_bits) {
+        decoded.clear();
+        for (size_t channel_idx = 0; channel_idx < props_.size(); ++channel_idx) {
+            last_dc[channel_idx] = props_[channel_idx].last_dc;
+        }
+
+        bits.Seek(bit_position_);
+        try {
+            for (size_t channel_idx = 0; channel_idx < props_.size(); ++channel_idx) {
+                const auto& card = meta.channels[props_[channel_idx].props.id];
+                for (uint8_t block_idx = 0; block_idx < card.horizontal_sp * card.vertical_sp;
+                     ++block_idx) {
+                    decoded.push_back(DecodeDifferences(bits, props_[channel_idx].props, meta));
+                    decoded.back().block.buffer[0] += last_dc[channel_idx];
+                    last_dc[channel_idx] = decoded.back().block.buffer[0];
+                }
+            }
+        } catch (const std::runtime_error&) {
+            // Bits past the end of the buffer read as zeros, so an error before the end of the
+            // scan may only mean the rest of the MCU has not arrived. It is decoded again then.
+            if (scan_complete_) {
+                throw;
+            }
+            break;
+        }
+
+        // A block which reaches the end of the buffer may continue in the next chunk.
+        if (!scan_complete_ && bits.Position() >= num_bits) {
+            break;
+        }
+
+        bit_position_ = bits.Position();
+
+        MCU mcu(props_.size());
+        auto block_it = decoded.begin();
+        for (size_t channel_idx = 0; channel_idx < props_.size(); ++channel_idx) {
+            props_[channel_idx].last_dc = last_dc[channel_idx];
+
+            const auto& card = meta.channels[props_[channel_idx].props.id];
+            for (uint8_t block_idx = 0; block_idx < card.horizontal_sp * card.vertical_sp;
+                 ++block_idx) {
+                mcu.per_channel_blocks[channel_idx].push_back(TransformBlock(*block_it++, meta));
+            }
+        }
+        PutMCU(mcu, cur_x_, cur_y_, meta, &image_);
+
+        cur_x_ += meta.mcu_x_step;
+        if (cur_x_ >= meta.width) {
+            ReportRows(cur_y_);
+            cur_x_ = 0;
+            cur_y_ += meta.mcu_y_step;
+        }
+    }
+
+    size_t consumed_bytes = std::min(bit_position_ / 8, scan_.size());
+    scan_.erase(scan_.begin(), scan_.begin() + consumed_bytes);
+    bit_position_ -= 8 * consumed_bytes;
+}
+
+void IncrementalDecoder::ParseEnd() {
+    if (input_.size() < 2) {
+        return;
+    }
+
+    if (input_[0] != 0xff) {
+        throw std::runtime_error("0xff expected: premature end of image");
+    }
+
+    if (!commands::CheckToken<commands::End>(input_[1])) {
+        throw std::runtime_error("0xd9 expected: premature end of image");
+    }
+
+    input_.clear();
+    stage_ = Stage::kFinished;
+}
+
+void IncrementalDecoder::ReportRows(uint16_t first_row) {
+    if (on_rows_) {
+        size_t num_rows = std::min<size_t>(meta_->mcu_y_step, meta_->height - first_row);
+        on_rows_(image_, first_row, num_rows);
+    }
+}
+
+}  // namespace decode
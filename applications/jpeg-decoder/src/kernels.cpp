@@ -0,0 +1,478 @@
+#include "kernels.h"
+
+#include <array>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KERNELS_X86
+#include <immintrin.h>
+#endif
+
+// SIMD variants have to reproduce the scalar results bit for bit, so this file is built with
+// floating point contraction disabled: a fused multiply-add rounds differently.
+
+namespace kernels {
+
+namespace {
+
+using Matrix = std::array<double, 64>;
+
+// basis[x * 8 + u] = C(u) / 2 * cos((2x + 1) u pi / 16), so that the 2D inverse transform is
+// basis * F * basis^T.
+const Matrix& IDCTBasis() {
+    static const Matrix basis = [] {
+        Matrix built;
+        const double pi = std::atan(1.0) * 4;
+        for (size_t x = 0; x < 8; ++x) {
+            for (size_t u = 0; u < 8; ++u) {
+                double cu = (u == 0) ? 1.0 / std::sqrt(2.0) : 1.0;
+                built[x * 8 + u] = cu / 2 * std::cos((2 * x + 1) * u * pi / 16.0);
+            }
+        }
+        return built;
+    }();
+    return basis;
+}
+
+// Same matrix transposed, rows of it are contiguous columns of the basis.
+const Matrix& IDCTBasisT() {
+    static const Matrix transposed = [] {
+        Matrix built;
+        const auto& basis = IDCTBasis();
+        for (size_t row = 0; row < 8; ++row) {
+            for (size_t col = 0; col < 8; ++col) {
+                built[col * 8 + row] = basis[row * 8 + col];
+            }
+        }
+        return built;
+    }();
+    return transposed;
+}
+
+void IDCTScalar(const double* coefficients, double* samples) {
+    const auto& basis = IDCTBasis();
+
+    double rows[64];
+    for (size_t x = 0; x < 8; ++x) {
+        for (size_t v = 0; v < 8; ++v) {
+            double sum = 0.0;
+            for (size_t u = 0; u < 8; ++u) {
+                sum += basis[x * 8 + u] * coefficients[u * 8 + v];
+            }
+            rows[x * 8 + v] = sum;
+        }
+    }
+
+    for (size_t x = 0; x < 8; ++x) {
+        for (size_t y = 0; y < 8; ++y) {
+            double sum = 0.0;
+            for (size_t v = 0; v < 8; ++v) {
+                sum += rows[x * 8 + v] * basis[y * 8 + v];
+            }
+            samples[x * 8 + y] = sum;
+        }
+    }
+}
+
+void DequantizeScalar(const int16_t* coefficients, const int16_t* table, int16_t* output) {
+    for (size_t idx = 0; idx < 64; ++idx) {
+        output[idx] = static_cast<int16_t>(coefficients[idx] * table[idx]);
+    }
+}
+
+int ClampToByte(double value) {
+    int rounded = std::round(value);
+    return std::max(0, std::min(255, rounded));
+}
+
+void YCbCrToRGBScalar(const int16_t* y, const int16_t* cb, const int16_t* cr, RGB* output,
+                      size_t count) {
+    for (size_t idx = 0; idx < count; ++idx) {
+        int cb_shifted = cb[idx] - 128, cr_shifted = cr[idx] - 128;
+        output[idx] = {
+            ClampToByte(y[idx] + 1.402 * cr_shifted),
+            ClampToByte(y[idx] - 0.34414 * cb_shifted - 0.71414 * cr_shifted),
+            ClampToByte(y[idx] + 1.772 * cb_shifted),
+        };
+    }
+}
+
+void UpsampleH2Scalar(const int16_t* input, int16_t* output, size_t count) {
+    for (size_t idx = 0; idx < count; ++idx) {
+        output[2 * idx] = output[2 * idx + 1] = input[idx];
+    }
+}
+
+size_t FindMarkerByteScalar(const uint8_t* data, size_t position, size_t size) {
+    for (; position < size; ++position) {
+        if (data[position] == 0xff) {
+            return position;
+        }
+    }
+    return size;
+}
+
+#ifdef KERNELS_X86
+
+// Both passes vectorize over the output columns, broadcasting one operand, which keeps the
+// summation order of the scalar version in every lane.
+
+__attribute__((target("sse2"))) void IDCTSSE2(const double* coefficients, double* samples) {
+    const auto& basis = IDCTBasis();
+    const auto& basis_t = IDCTBasisT();
+
+    alignas(16) double rows[64];
+    for (size_t x = 0; x < 8; ++x) {
+        for (size_t v = 0; v < 8; v += 2) {
+            __m128d sum = _mm_setzero_pd();
+            for (size_t u = 0; u < 8; ++u) {
+                sum = _mm_add_pd(sum, _mm_mul_pd(_mm_set1_pd(basis[x * 8 + u]),
+                                                 _mm_loadu_pd(coefficients + u * 8 + v)));
+            }
+            _mm_store_pd(rows + x * 8 + v, sum);
+        }
+    }
+
+    for (size_t x = 0; x < 8; ++x) {
+        for (size_t y = 0; y < 8; y += 2) {
+            __m128d sum = _mm_setzero_pd();
+            for (size_t v = 0; v < 8; ++v) {
+                sum = _mm_add_pd(sum, _mm_mul_pd(_mm_set1_pd(rows[x * 8 + v]),
+                                                 _mm_loadu_pd(basis_t.data() + v * 8 + y)));
+            }
+            _mm_storeu_pd(samples + x * 8 + y, sum);
+        }
+    }
+}
+
+__attribute__((target("avx2"))) void IDCTAVX2(const double* coefficients, double* samples) {
+    const auto& basis = IDCTBasis();
+    const auto& basis_t = IDCTBasisT();
+
+    alignas(32) double rows[64];
+    for (size_t x = 0; x < 8; ++x) {
+        for (size_t v = 0; v < 8; v += 4) {
+            __m256d sum = _mm256_setzero_pd();
+            for (size_t u = 0; u < 8; ++u) {
+                sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_set1_pd(basis[x * 8 + u]),
+                                                       _mm256_loadu_pd(coefficients + u * 8 + v)));
+            }
+            _mm256_store_pd(rows + x * 8 + v, sum);
+        }
+    }
+
+    for (size_t x = 0; x < 8; ++x) {
+        for (size_t y = 0; y < 8; y += 4) {
+            __m256d sum = _mm256_setzero_pd();
+            for (size_t v = 0; v < 8; ++v) {
+                sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_set1_pd(rows[x * 8 + v]),
+                                                       _mm256_loadu_pd(basis_t.data() + v * 8 + y)));
+            }
+            _mm256_storeu_pd(samples + x * 8 + y, sum);
+        }
+    }
+}
+
+__attribute__((target("avx512f"))) void IDCTAVX512(const double* coefficients, double* samples) {
+    const auto& basis = IDCTBasis();
+    const auto& basis_t = IDCTBasisT();
+
+    alignas(64) double rows[64];
+    for (size_t x = 0; x < 8; ++x) {
+        __m512d sum = _mm512_setzero_pd();
+        for (size_t u = 0; u < 8; ++u) {
+            sum = _mm512_add_pd(sum, _mm512_mul_pd(_mm512_set1_pd(basis[x * 8 + u]),
+                                                   _mm512_loadu_pd(coefficients + u * 8)));
+        }
+        _mm512_store_pd(rows + x * 8, sum);
+    }
+
+    for (size_t x = 0; x < 8; ++x) {
+        __m512d sum = _mm512_setzero_pd();
+        for (size_t v = 0; v < 8; ++v) {
+            sum = _mm512_add_pd(sum, _mm512_mul_pd(_mm512_set1_pd(rows[x * 8 + v]),
+                                                   _mm512_loadu_pd(basis_t.data() + v * 8)));
+        }
+        _mm512_storeu_pd(samples + x * 8, sum);
+    }
+}
+
+__attribute__((target("sse2"))) void DequantizeSSE2(const int16_t* coefficients,
+                                                    const int16_t* table, int16_t* output) {
+    for (size_t idx = 0; idx < 64; idx += 8) {
+        auto lhs = _mm_loadu_si128(reinterpret_cast<const __m128i*>(coefficients + idx));
+        auto rhs = _mm_loadu_si128(reinterpret_cast<const __m128i*>(table + idx));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + idx), _mm_mullo_epi16(lhs, rhs));
+    }
+}
+
+__attribute__((target("avx2"))) void DequantizeAVX2(const int16_t* coefficients,
+                                                    const int16_t* table, int16_t* output) {
+    for (size_t idx = 0; idx < 64; idx += 16) {
+        auto lhs = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(coefficients + idx));
+        auto rhs = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(table + idx));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(output + idx),
+                            _mm256_mullo_epi16(lhs, rhs));
+    }
+}
+
+__attribute__((target("avx512f,avx512bw"))) void DequantizeAVX512(const int16_t* coefficients,
+                                                                  const int16_t* table,
+                                                                  int16_t* output) {
+    for (size_t idx = 0; idx < 64; idx += 32) {
+        auto lhs = _mm512_loadu_si512(coefficients + idx);
+        auto rhs = _mm512_loadu_si512(table + idx);
+        _mm512_storeu_si512(output + idx, _mm512_mullo_epi16(lhs, rhs));
+    }
+}
+
+// std::round rounds half away from zero, which no SSE rounding mode does. Truncating first
+// makes the remainder exact, so comparing it against 0.5 gives the same result.
+__attribute__((target("sse4.1"))) __m128d RoundHalfAwaySSE41(__m128d value) {
+    __m128d truncated = _mm_round_pd(value, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+    __m128d remainder = _mm_sub_pd(value, truncated);
+    __m128d one = _mm_set1_pd(1.0);
+    truncated = _mm_add_pd(truncated, _mm_and_pd(_mm_cmpge_pd(remainder, _mm_set1_pd(0.5)), one));
+    return _mm_sub_pd(truncated, _mm_and_pd(_mm_cmple_pd(remainder, _mm_set1_pd(-0.5)), one));
+}
+
+__attribute__((target("sse4.1"))) __m128i ClampToByteSSE41(__m128d low, __m128d high) {
+    __m128i packed = _mm_unpacklo_epi64(_mm_cvttpd_epi32(RoundHalfAwaySSE41(low)),
+                                        _mm_cvttpd_epi32(RoundHalfAwaySSE41(high)));
+    return _mm_max_epi32(_mm_setzero_si128(), _mm_min_epi32(_mm_set1_epi32(255), packed));
+}
+
+__attribute__((target("sse4.1"))) void YCbCrToRGBSSE41(const int16_t* y, const int16_t* cb,
+                                                       const int16_t* cr, RGB* output,
+                                                       size_t count) {
+    size_t idx = 0;
+    for (; idx + 4 <= count; idx += 4) {
+        __m128d luma[2], blue[2], red[2];
+        for (size_t half = 0; half < 2; ++half) {
+            size_t at = idx + 2 * half;
+            luma[half] = _mm_set_pd(y[at + 1], y[at]);
+            blue[half] = _mm_set_pd(cb[at + 1] - 128, cb[at] - 128);
+            red[half] = _mm_set_pd(cr[at + 1] - 128, cr[at] - 128);
+        }
+
+        __m128d r[2], g[2], b[2];
+        for (size_t half = 0; half < 2; ++half) {
+            r[half] = _mm_add_pd(luma[half], _mm_mul_pd(_mm_set1_pd(1.402), red[half]));
+            g[half] = _mm_sub_pd(
+                _mm_sub_pd(luma[half], _mm_mul_pd(_mm_set1_pd(0.34414), blue[half])),
+                _mm_mul_pd(_mm_set1_pd(0.71414), red[half]));
+            b[half] = _mm_add_pd(luma[half], _mm_mul_pd(_mm_set1_pd(1.772), blue[half]));
+        }
+
+        alignas(16) int32_t rs[4], gs[4], bs[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(rs), ClampToByteSSE41(r[0], r[1]));
+        _mm_store_si128(reinterpret_cast<__m128i*>(gs), ClampToByteSSE41(g[0], g[1]));
+        _mm_store_si128(reinterpret_cast<__m128i*>(bs), ClampToByteSSE41(b[0], b[1]));
+
+        for (size_t lane = 0; lane < 4; ++lane) {
+            output[idx + lane] = {rs[lane], gs[lane], bs[lane]};
+        }
+    }
+    YCbCrToRGBScalar(y + idx, cb + idx, cr + idx, output + idx, count - idx);
+}
+
+__attribute__((target("avx2"))) __m128i ClampToByteAVX2(__m256d value) {
+    __m256d truncated = _mm256_round_pd(value, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+    __m256d remainder = _mm256_sub_pd(value, truncated);
+    __m256d one = _mm256_set1_pd(1.0);
+    truncated = _mm256_add_pd(
+        truncated, _mm256_and_pd(_mm256_cmp_pd(remainder, _mm256_set1_pd(0.5), _CMP_GE_OQ), one));
+    truncated = _mm256_sub_pd(
+        truncated, _mm256_and_pd(_mm256_cmp_pd(remainder, _mm256_set1_pd(-0.5), _CMP_LE_OQ), one));
+
+    __m128i rounded = _mm256_cvttpd_epi32(truncated);
+    return _mm_max_epi32(_mm_setzero_si128(), _mm_min_epi32(_mm_set1_epi32(255), rounded));
+}
+
+__attribute__((target("avx2"))) __m128i LoadFourAVX2(const int16_t* from) {
+    return _mm_cvtepi16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(from)));
+}
+
+__attribute__((target("avx2"))) void YCbCrToRGBAVX2(const int16_t* y, const int16_t* cb,
+                                                    const int16_t* cr, RGB* output, size_t count) {
+    const __m128i offset = _mm_set1_epi32(128);
+
+    size_t idx = 0;
+    for (; idx + 4 <= count; idx += 4) {
+        __m256d luma = _mm256_cvtepi32_pd(LoadFourAVX2(y + idx));
+        __m256d blue = _mm256_cvtepi32_pd(_mm_sub_epi32(LoadFourAVX2(cb + idx), offset));
+        __m256d red = _mm256_cvtepi32_pd(_mm_sub_epi32(LoadFourAVX2(cr + idx), offset));
+
+        __m256d r = _mm256_add_pd(luma, _mm256_mul_pd(_mm256_set1_pd(1.402), red));
+        __m256d g = _mm256_sub_pd(_mm256_sub_pd(luma, _mm256_mul_pd(_mm256_set1_pd(0.34414), blue)),
+                                  _mm256_mul_pd(_mm256_set1_pd(0.71414), red));
+        __m256d b = _mm256_add_pd(luma, _mm256_mul_pd(_mm256_set1_pd(1.772), blue));
+
+        alignas(16) int32_t rs[4], gs[4], bs[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(rs), ClampToByteAVX2(r));
+        _mm_store_si128(reinterpret_cast<__m128i*>(gs), ClampToByteAVX2(g));
+        _mm_store_si128(reinterpret_cast<__m128i*>(bs), ClampToByteAVX2(b));
+
+        for (size_t lane = 0; lane < 4; ++lane) {
+            output[idx + lane] = {rs[lane], gs[lane], bs[lane]};
+        }
+    }
+    YCbCrToRGBScalar(y + idx, cb + idx, cr + idx, output + idx, count - idx);
+}
+
+__attribute__((target("sse2"))) void UpsampleH2SSE2(const int16_t* input, int16_t* output,
+                                                    size_t count) {
+    size_t idx = 0;
+    for (; idx + 8 <= count; idx += 8) {
+        auto samples = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + idx));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + 2 * idx),
+                         _mm_unpacklo_epi16(samples, samples));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + 2 * idx + 8),
+                         _mm_unpackhi_epi16(samples, samples));
+    }
+    UpsampleH2Scalar(input + idx, output + 2 * idx, count - idx);
+}
+
+__attribute__((target("sse2"))) size_t FindMarkerByteSSE2(const uint8_t* data, size_t position,
+                                                          size_t size) {
+    const __m128i markers = _mm_set1_epi8(static_cast<char>(0xff));
+    for (; position + 16 <= size; position += 16) {
+        auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + position));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, markers));
+        if (mask != 0) {
+            return position + __builtin_ctz(mask);
+        }
+    }
+    return FindMarkerByteScalar(data, position, size);
+}
+
+__attribute__((target("avx2"))) size_t FindMarkerByteAVX2(const uint8_t* data, size_t position,
+                                                          size_t size) {
+    const __m256i markers = _mm256_set1_epi8(static_cast<char>(0xff));
+    for (; position + 32 <= size; position += 32) {
+        auto chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + position));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, markers));
+        if (mask != 0) {
+            return position + __builtin_ctz(mask);
+        }
+    }
+    return FindMarkerByteScalar(data, position, size);
+}
+
+__attribute__((target("avx512f,avx512bw"))) size_t FindMarkerByteAVX512(const uint8_t* data,
+                                                                        size_t position,
+                                                                        size_t size) {
+    const __m512i markers = _mm512_set1_epi8(static_cast<char>(0xff));
+    for (; position + 64 <= size; position += 64) {
+        auto chunk = _mm512_loadu_si512(data + position);
+        uint64_t mask = _mm512_cmpeq_epi8_mask(chunk, markers);
+        if (mask != 0) {
+            return position + __builtin_ctzll(mask);
+        }
+    }
+    return FindMarkerByteScalar(data, position, size);
+}
+
+#endif
+
+// Each level starts from the one below and replaces the kernels it has a better version of.
+std::array<Kernels, 5> BuildLevels() {
+    std::array<Kernels, 5> levels;
+
+    levels[0] = {Level::kScalar,   IDCTScalar,       DequantizeScalar,
+                 YCbCrToRGBScalar, UpsampleH2Scalar, FindMarkerByteScalar};
+
+    for (size_t level = 1; level < levels.size(); ++level) {
+        levels[level] = levels[level - 1];
+        levels[level].level = static_cast<Level>(level);
+    }
+
+#ifdef KERNELS_X86
+    for (auto* sse2 : {&levels[1], &levels[2], &levels[3], &levels[4]}) {
+        sse2->idct = IDCTSSE2;
+        sse2->dequantize = DequantizeSSE2;
+        sse2->upsample_h2 = UpsampleH2SSE2;
+        sse2->find_marker_byte = FindMarkerByteSSE2;
+    }
+    for (auto* sse41 : {&levels[2], &levels[3], &levels[4]}) {
+        sse41->ycbcr_to_rgb = YCbCrToRGBSSE41;
+    }
+    for (auto* avx2 : {&levels[3], &levels[4]}) {
+        avx2->idct = IDCTAVX2;
+        avx2->dequantize = DequantizeAVX2;
+        avx2->ycbcr_to_rgb = YCbCrToRGBAVX2;
+        avx2->find_marker_byte = FindMarkerByteAVX2;
+    }
+    levels[4].idct = IDCTAVX512;
+    levels[4].dequantize = DequantizeAVX512;
+    levels[4].find_marker_byte = FindMarkerByteAVX512;
+#endif
+
+    return levels;
+}
+
+Level ParseLevel(const std::string& name) {
+    for (auto level : {Level::kScalar, Level::kSSE2, Level::kSSE41, Level::kAVX2, Level::kAVX512}) {
+        if (name == LevelName(level)) {
+            return level;
+        }
+    }
+    throw std::runtime_error("unknown JPEG_DECODER_SIMD level: " + name);
+}
+
+}  // namespace
+
+Level DetectLevel() {
+#ifdef KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+        return Level::kAVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return Level::kAVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return Level::kSSE41;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return Level::kSSE2;
+    }
+#endif
+    return Level::kScalar;
+}
+
+const Kernels& ForLevel(Level level) {
+    static const auto levels = BuildLevels();
+    static const auto detected = DetectLevel();
+    return levels[static_cast<size_t>(std::min(level, detected))];
+}
+
+const Kernels& Get() {
+    static const Kernels& bound = [] () -> const Kernels& {
+        const char* forced = std::getenv("JPEG_DECODER_SIMD");
+        return ForLevel(forced != nullptr ? ParseLevel(forced) : DetectLevel());
+    }();
+    return bound;
+}
+
+const char* LevelName(Level level) {
+    switch (level) {
+        case Level::kScalar:
+            return "scalar";
+        case Level::kSSE2:
+            return "sse2";
+        case Level::kSSE41:
+            return "sse4.1";
+        case Level::kAVX2:
+            return "avx2";
+        case Level::kAVX512:
+            return "avx512";
+    }
+    return "unknown";
+}
+
+}  // namespace kernels
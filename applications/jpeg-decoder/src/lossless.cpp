@@ -0,0 +1,444 @@
+#include "lossless.h"
+#include "exif.h"
+
+#include <array>
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+
+namespace lossless {
+
+namespace {
+
+using Coefficients = blocks::Block<int16_t, 8>;
+
+// An operation as a transposition followed by mirroring along the axes of the result.
+struct Geometry {
+    bool transpose = false, flip_h = false, flip_v = false;
+};
+
+Geometry GetGeometry(Operation operation) {
+    switch (operation) {
+        case Operation::kNone:
+            return {false, false, false};
+        case Operation::kFlipHorizontal:
+            return {false, true, false};
+        case Operation::kFlipVertical:
+            return {false, false, true};
+        case Operation::kTranspose:
+            return {true, false, false};
+        case Operation::kTransverse:
+            return {true, true, true};
+        case Operation::kRotate90:
+            return {true, true, false};
+        case Operation::kRotate180:
+            return {false, true, true};
+        case Operation::kRotate270:
+            return {true, false, true};
+    }
+    throw std::runtime_error("unknown lossless operation");
+}
+
+// For every zigzag position of an output block, the zigzag position of the input coefficient
+// it is taken from and whether its sign flips. Mirroring a block negates the basis functions
+// of odd frequency along the mirrored axis, transposing it swaps the two frequencies.
+struct CoefficientMap {
+    std::array<uint8_t, 64> source;
+    std::array<bool, 64> negate;
+};
+
+CoefficientMap MakeCoefficientMap(const Geometry& geometry) {
+    // AtZZ of the identity gives the zigzag position of a horizontal and vertical frequency.
+    blocks::Block<uint8_t, 8> positions;
+    for (uint8_t pos = 0; pos < 64; ++pos) {
+        positions.At(pos) = pos;
+    }
+
+    CoefficientMap map;
+    for (uint8_t u = 0; u < 8; ++u) {
+        for (uint8_t v = 0; v < 8; ++v) {
+            auto target = positions.AtZZ(u, v);
+            map.source[target] = geometry.transpose ? positions.AtZZ(v, u) : target;
+            map.negate[target] = (geometry.flip_h && u % 2 == 1) != (geometry.flip_v && v % 2 == 1);
+        }
+    }
+    return map;
+}
+
+// Quantized blocks of one component over the whole MCU grid, padding blocks included.
+struct Component {
+    commands::SOS::ChannelProps props;
+    commands::DCT::ChannelProps card;
+    size_t width = 0, height = 0;
+    std::vector<Coefficients> blocks;
+
+    const Coefficients& At(size_t x, size_t y) const {
+        return blocks[y * width + x];
+    }
+};
+
+std::vector<Component> ReadCoefficients(std::istream& input, const decode::JPEGMeta& meta) {
+    auto props = decode::ReadScanHeader(input, meta);
+    auto data = byte_streams::ReadStuffedSegment(input);
+    decode::ReadEndOfImage(input);
+
+    size_t mcus_x = (meta.width + meta.mcu_x_step - 1) / meta.mcu_x_step;
+    size_t mcus_y = (meta.height + meta.mcu_y_step - 1) / meta.mcu_y_step;
+
+    std::vector<Component> components;
+    for (const auto& channel : props) {
+        Component component;
+        component.props = channel.props;
+        component.card = meta.channels[channel.props.id];
+        component.width = mcus_x * component.card.horizontal_sp;
+        component.height = mcus_y * component.card.vertical_sp;
+        component.blocks.resize(component.width * component.height);
+        components.push_back(std::move(component));
+    }
+
+    byte_streams::BufferBitStream bits(data.data(), data.size());
+    std::vector<int16_t> last_dc(components.size(), 0);
+
+    for (size_t mcu_y = 0; mcu_y < mcus_y; ++mcu_y) {
+        for (size_t mcu_x = 0; mcu_x < mcus_x; ++mcu_x) {
+            for (size_t idx = 0; idx < components.size(); ++idx) {
+                auto& component = components[idx];
+                uint8_t h = component.card.horizontal_sp, v = component.card.vertical_sp;
+
+                for (uint8_t block_y = 0; block_y < v; ++block_y) {
+                    for (uint8_t block_x = 0; block_x < h; ++block_x) {
+                        auto decoded = decode::DecodeDifferences(bits, component.props, meta);
+                        decoded.block.buffer[0] += last_dc[idx];
+                        last_dc[idx] = decoded.block.buffer[0];
+
+                        size_t x = mcu_x * h + block_x, y = mcu_y * v + block_y;
+                        component.blocks[y * component.width + x] = decoded.block;
+                    }
+                }
+            }
+        }
+    }
+
+    return components;
+}
+
+uint8_t NumBits(int value) {
+    value = std::abs(value);
+    uint8_t num_bits = 0;
+    while (value > 0) {
+        value >>= 1;
+        ++num_bits;
+    }
+    return num_bits;
+}
+
+const huffman::Code& GetCode(const std::vector<huffman::Code>& codes, uint8_t value) {
+    if (value >= codes.size() || codes[value].length == 0) {
+        throw std::runtime_error("value has no huffman code");
+    }
+    return codes[value];
+}
+
+// Sinks for the Huffman-coded symbols of a scan, each followed by num_bits value bits.
+struct SymbolWriter {
+    // Indexed by table id and then by is_ac.
+    std::array<std::array<std::vector<huffman::Code>, 2>, 2> codes;
+    byte_streams::BitWriter* writer;
+
+    void Put(uint8_t table_id, uint8_t is_ac, uint8_t symbol, uint32_t bits, uint8_t num_bits) {
+        const auto& code = GetCode(codes[table_id][is_ac], symbol);
+        writer->Write((uint32_t(code.bits) << num_bits) | bits, code.length + num_bits);
+    }
+};
+
+struct SymbolCounter {
+    std::array<std::array<std::vector<uint64_t>, 2>, 2> frequencies;
+
+    SymbolCounter() {
+        for (auto& per_table : frequencies) {
+            per_table.fill(std::vector<uint64_t>(256, 0));
+        }
+    }
+
+    void Put(uint8_t table_id, uint8_t is_ac, uint8_t symbol, uint32_t, uint8_t) {
+        ++frequencies[table_id][is_ac][symbol];
+    }
+};
+
+// Codes the size category, with a zero run in the high nibble, followed by the value bits: the
+// value itself when positive, the one's complement of its magnitude when negative.
+template <class Sink>
+void PutValue(uint8_t table_id, uint8_t is_ac, uint8_t run, int value, Sink* sink) {
+    auto num_bits = NumBits(value);
+    uint32_t value_bits = (value < 0 ? value - 1 : value) & ((1u << num_bits) - 1);
+    sink->Put(table_id, is_ac, (run << 4) | num_bits, value_bits, num_bits);
+}
+
+template <class Sink>
+void EncodeBlock(const Coefficients& block, const CoefficientMap& map, uint8_t table_id,
+                 int16_t* last_dc, Sink* sink) {
+    std::array<int16_t, 64> coefficients;
+    for (uint8_t pos = 0; pos < coefficients.size(); ++pos) {
+        auto value = block.At(map.source[pos]);
+        coefficients[pos] = map.negate[pos] ? -value : value;
+    }
+
+    PutValue(table_id, 0, 0, coefficients[0] - *last_dc, sink);
+    *last_dc = coefficients[0];
+
+    uint8_t run = 0;
+    for (uint8_t pos = 1; pos < coefficients.size(); ++pos) {
+        if (coefficients[pos] == 0) {
+            ++run;
+            continue;
+        }
+        for (; run >= 16; run -= 16) {
+            sink->Put(table_id, 1, 0xf0, 0, 0);
+        }
+        PutValue(table_id, 1, run, coefficients[pos], sink);
+        run = 0;
+    }
+
+    if (run > 0) {
+        sink->Put(table_id, 1, 0x00, 0, 0);
+    }
+}
+
+// MCUs of the output which are written, and the size of the whole output grid in MCUs.
+struct OutputGrid {
+    size_t first_mcu_x, first_mcu_y, num_mcus_x, num_mcus_y;
+    size_t mcus_x, mcus_y;
+};
+
+// Walks the blocks in the order of the output scan. The first component uses the tables with
+// id 0, the others those with id 1.
+template <class Sink>
+void EncodeScan(const std::vector<Component>& components, const Geometry& geometry,
+                const CoefficientMap& map, const OutputGrid& grid, Sink* sink) {
+    std::vector<int16_t> last_dc(components.size(), 0);
+
+    for (size_t mcu_y = grid.first_mcu_y; mcu_y < grid.first_mcu_y + grid.num_mcus_y; ++mcu_y) {
+        for (size_t mcu_x = grid.first_mcu_x; mcu_x < grid.first_mcu_x + grid.num_mcus_x;
+             ++mcu_x) {
+            for (size_t idx = 0; idx < components.size(); ++idx) {
+                const auto& component = components[idx];
+                uint8_t table_id = idx == 0 ? 0 : 1;
+                uint8_t h = component.card.horizontal_sp, v = component.card.vertical_sp;
+                if (geometry.transpose) {
+                    std::swap(h, v);
+                }
+
+                for (uint8_t block_y = 0; block_y < v; ++block_y) {
+                    for (uint8_t block_x = 0; block_x < h; ++block_x) {
+                        size_t x = mcu_x * h + block_x, y = mcu_y * v + block_y;
+                        if (geometry.flip_h) {
+                            x = grid.mcus_x * h - 1 - x;
+                        }
+                        if (geometry.flip_v) {
+                            y = grid.mcus_y * v - 1 - y;
+                        }
+
+                        const auto& block =
+                            geometry.transpose ? component.At(y, x) : component.At(x, y);
+                        EncodeBlock(block, map, table_id, &last_dc[idx], sink);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Optimal tables for the symbol counts, limited to the 16 bits a DHT segment can describe.
+std::vector<commands::DHT::Payload> BuildTables(const SymbolCounter& counter) {
+    std::vector<commands::DHT::Payload> tables;
+    for (uint8_t id = 0; id < 2; ++id) {
+        for (uint8_t is_ac = 0; is_ac < 2; ++is_ac) {
+            const auto& frequencies = counter.frequencies[id][is_ac];
+            if (std::all_of(frequencies.begin(), frequencies.end(),
+                            [](uint64_t frequency) { return frequency == 0; })) {
+                continue;
+            }
+
+            auto canonical = huffman::BuildCanonicalTable(frequencies, 16, true);
+            commands::DHT::Payload table;
+            table.id = id;
+            table.is_ac = is_ac;
+            table.num_values = std::move(canonical.per_level);
+            table.values = std::move(canonical.values);
+            tables.push_back(std::move(table));
+        }
+    }
+    return tables;
+}
+
+void PutBE16(std::vector<uint8_t>* output, uint16_t value) {
+    output->push_back(value >> 8);
+    output->push_back(value & 0xff);
+}
+
+void PutMarker(std::vector<uint8_t>* output, uint8_t marker) {
+    output->push_back(0xff);
+    output->push_back(marker);
+}
+
+void PutSegment(std::vector<uint8_t>* output, uint8_t marker,
+                const std::vector<uint8_t>& payload) {
+    if (payload.size() + 2 > 0xffff) {
+        throw std::runtime_error("segment payload is too long");
+    }
+    PutMarker(output, marker);
+    PutBE16(output, payload.size() + 2);
+    output->insert(output->end(), payload.begin(), payload.end());
+}
+
+}  // namespace
+
+void Transform(std::istream& input, std::ostream& output, const TransformOptions& options) {
+    decode::JPEGMeta meta(input);
+    auto components = ReadCoefficients(input, meta);
+
+    auto geometry = GetGeometry(options.operation);
+    auto map = MakeCoefficientMap(geometry);
+
+    // Input axes which end up mirrored lose their partial MCU.
+    bool mirror_x = geometry.transpose ? geometry.flip_v : geometry.flip_h;
+    bool mirror_y = geometry.transpose ? geometry.flip_h : geometry.flip_v;
+    uint16_t width = mirror_x ? meta.width / meta.mcu_x_step * meta.mcu_x_step : meta.width;
+    uint16_t height = mirror_y ? meta.height / meta.mcu_y_step * meta.mcu_y_step : meta.height;
+
+    if (width == 0 || height == 0) {
+        throw std::runtime_error("image is smaller than the MCU it would be trimmed to");
+    }
+
+    uint16_t out_width = geometry.transpose ? height : width;
+    uint16_t out_height = geometry.transpose ? width : height;
+    uint8_t out_mcu_x = geometry.transpose ? meta.mcu_y_step : meta.mcu_x_step;
+    uint8_t out_mcu_y = geometry.transpose ? meta.mcu_x_step : meta.mcu_y_step;
+
+    auto crop = options.crop.value_or(Crop{});
+    if (crop.x % out_mcu_x != 0 || crop.y % out_mcu_y != 0) {
+        throw std::runtime_error("crop offset is not aligned to the MCU grid");
+    }
+    if (crop.x >= out_width || crop.y >= out_height) {
+        throw std::runtime_error("crop region is outside of the image");
+    }
+
+    uint16_t crop_width = out_width - crop.x, crop_height = out_height - crop.y;
+    if (crop.width != 0) {
+        crop_width = std::min(crop_width, crop.width);
+    }
+    if (crop.height != 0) {
+        crop_height = std::min(crop_height, crop.height);
+    }
+
+    OutputGrid grid;
+    grid.first_mcu_x = crop.x / out_mcu_x;
+    grid.first_mcu_y = crop.y / out_mcu_y;
+    grid.num_mcus_x = (crop_width + out_mcu_x - 1) / out_mcu_x;
+    grid.num_mcus_y = (crop_height + out_mcu_y - 1) / out_mcu_y;
+    grid.mcus_x = (out_width + out_mcu_x - 1) / out_mcu_x;
+    grid.mcus_y = (out_height + out_mcu_y - 1) / out_mcu_y;
+
+    std::vector<commands::DHT::Payload> tables;
+    if (options.optimize_huffman) {
+        SymbolCounter counter;
+        EncodeScan(components, geometry, map, grid, &counter);
+        tables = BuildTables(counter);
+    } else {
+        tables = commands::DHT::Standard();
+    }
+
+    std::vector<uint8_t> entropy_coded;
+    byte_streams::BitWriter writer(&entropy_coded);
+
+    SymbolWriter symbols;
+    symbols.writer = &writer;
+    for (const auto& table : tables) {
+        symbols.codes[table.id][table.is_ac] =
+            huffman::CanonicalCodes(table.num_values, table.values);
+    }
+    EncodeScan(components, geometry, map, grid, &symbols);
+    writer.Flush();
+
+    std::vector<uint8_t> result;
+    PutMarker(&result, commands::Start::kStart[1]);
+
+    for (auto app : meta.app_info) {
+        if (options.operation != Operation::kNone && app.marker == commands::App::kStart[1]) {
+            exif::ResetOrientation(&app.exif);
+        }
+        PutSegment(&result, app.marker, {app.exif.begin(), app.exif.end()});
+    }
+
+    for (const auto& comment : meta.comments) {
+        PutSegment(&result, commands::Comment::kStart[0],
+                   {comment.comment.begin(), comment.comment.end()});
+    }
+
+    for (const auto& q_table : meta.q_tables) {
+        if (q_table.precision == 0) {
+            continue;  // id not defined by the input
+        }
+        std::vector<uint8_t> payload = {static_cast<uint8_t>(((q_table.precision - 1) << 4) |
+                                                             q_table.id)};
+        for (uint8_t pos = 0; pos < 64; ++pos) {
+            auto value = static_cast<uint16_t>(q_table.block.At(map.source[pos]));
+            if (q_table.precision == 2) {
+                PutBE16(&payload, value);
+            } else {
+                payload.push_back(value);
+            }
+        }
+        PutSegment(&result, commands::DQT::kStart[0], payload);
+    }
+
+    std::vector<uint8_t> frame = {static_cast<uint8_t>(meta.precision)};
+    PutBE16(&frame, crop_height);
+    PutBE16(&frame, crop_width);
+    frame.push_back(components.size());
+    for (const auto& component : components) {
+        uint8_t h = component.card.horizontal_sp, v = component.card.vertical_sp;
+        if (geometry.transpose) {
+            std::swap(h, v);
+        }
+        frame.push_back(component.card.id);
+        frame.push_back((h << 4) | v);
+        frame.push_back(component.card.dqt_table_id);
+    }
+    PutSegment(&result, commands::DCT::kStart[0], frame);
+
+    std::vector<uint8_t> huffman_tables;
+    for (const auto& table : tables) {
+        huffman_tables.push_back((table.is_ac << 4) | table.id);
+        huffman_tables.insert(huffman_tables.end(), table.num_values.begin(),
+                              table.num_values.end());
+        huffman_tables.insert(huffman_tables.end(), table.values.begin(), table.values.end());
+    }
+    PutSegment(&result, commands::DHT::kStart[0], huffman_tables);
+
+    std::vector<uint8_t> scan = {static_cast<uint8_t>(components.size())};
+    for (size_t idx = 0; idx < components.size(); ++idx) {
+        uint8_t table_id = idx == 0 ? 0 : 1;
+        scan.push_back(components[idx].props.id);
+        scan.push_back((table_id << 4) | table_id);
+    }
+    scan.insert(scan.end(), {0x00, 0x3f, 0x00});
+    PutSegment(&result, commands::SOS::kStart[0], scan);
+
+    result.insert(result.end(), entropy_coded.begin(), entropy_coded.end());
+    PutMarker(&result, commands::End::kStart[1]);
+
+    output.write(reinterpret_cast<const char*>(result.data()), result.size());
+    if (!output) {
+        throw std::runtime_error("failed to write the transformed image");
+    }
+}
+
+void Transform(const std::string& input_filename, const std::string& output_filename,
+               const TransformOptions& options) {
+    std::ifstream input(input_filename, std::ios::binary);
+    std::ofstream output(output_filename, std::ios::binary);
+    Transform(input, output, options);
+}
+
+}  // namespace lossless
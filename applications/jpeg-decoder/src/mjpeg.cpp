@@ -0,0 +1,311 @@
+#include "mjpeg.h"
+#include "segment-index.h"
+
+#include <exception>
+
+namespace decode {
+
+namespace {
+
+uint16_t SegmentLength(const uint8_t* data, size_t position) {
+    return byte_streams::ComposeBytes<uint16_t>({data[position + 2], data[position + 3]});
+}
+
+// Calls parse with a stream at the length field of every segment in the concatenation.
+template <class Parse>
+void ForEachSegment(const std::string& segments, Parse parse) {
+    auto data = reinterpret_cast<const uint8_t*>(segments.data());
+    for (size_t position = 0; position < segments.size();) {
+        size_t length = SegmentLength(data, position);
+        byte_streams::MemoryStream stream(segments.data() + position + 2, length);
+        parse(stream);
+        position += 2 + length;
+    }
+}
+
+// Whether the byte after a 0xff is the code of the marker. CheckToken accepts the 0xff as well,
+// which here would take a fill byte for the marker.
+template <class Command>
+bool IsMarkerCode(uint8_t code) {
+    return code == Command::kStart[1];
+}
+
+}  // namespace
+
+MJPEGDecoder::MJPEGDecoder(OnFrame on_frame) : on_frame_(std::move(on_frame)) {
+}
+
+void MJPEGDecoder::Feed(const uint8_t* data, size_t size) {
+    input_.insert(input_.end(), data, data + size);
+
+    std::exception_ptr error;
+    while (true) {
+        // Drops everything in front of the next SOI marker.
+        size_t position = 0;
+        while (true) {
+            position = segments::FindMarkerByte(input_.data(), position, input_.size());
+            if (position + 1 >= input_.size() ||
+                IsMarkerCode<commands::Start>(input_[position + 1])) {
+                break;
+            }
+            ++position;
+        }
+        if (position > 0) {
+            Drop(position);
+        }
+
+        // A broken frame is dropped, or only its SOI marker if its end is unknown, and the
+        // stream goes on with the next one, so that the frames behind it are not held up.
+        size_t end = 0;
+        try {
+            end = FindFrameEnd();
+            if (end == 0) {
+                break;
+            }
+            DecodeFrame(std::string_view(reinterpret_cast<const char*>(input_.data()), end));
+        } catch (const std::runtime_error&) {
+            Drop(end == 0 ? 2 : end);
+            ++stats_.dropped_frames;
+            if (!error) {
+                error = std::current_exception();
+            }
+            continue;
+        }
+        Drop(end);
+
+        if (on_frame_) {
+            on_frame_(image_, stats_.frames - 1);
+        }
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void MJPEGDecoder::Feed(std::string_view data) {
+    Feed(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+}
+
+const Image& MJPEGDecoder::DecodeFrame(std::string_view frame) {
+    size_t scan_offset = 0;
+    ReadHeader(frame, &scan_offset);
+    DecodeScan(frame, scan_offset);
+    ++stats_.frames;
+    return image_;
+}
+
+MJPEGDecoder::Stats MJPEGDecoder::GetStats() const {
+    return stats_;
+}
+
+void MJPEGDecoder::Drop(size_t num_bytes) {
+    input_.erase(input_.begin(), input_.begin() + num_bytes);
+    searched_ = 0;
+}
+
+size_t MJPEGDecoder::FindFrameEnd() {
+    if (input_.size() < 2) {
+        return 0;
+    }
+
+    // The marker segments are skipped by their lengths, as their payloads, e.g. an EXIF
+    // thumbnail, may contain anything.
+    size_t position = 2;
+    while (true) {
+        if (position + 4 > input_.size()) {
+            return 0;
+        }
+        if (input_[position] != 0xff) {
+            throw std::runtime_error("jpeg meta read failed: unexpected token");
+        }
+
+        auto code = input_[position + 1];
+        auto length = SegmentLength(input_.data(), position);
+        if (length < 2) {
+            throw std::runtime_error("jpeg meta read failed: unexpected input stop");
+        }
+        position += 2 + length;
+        if (commands::CheckToken<commands::SOS>(code)) {
+            break;
+        }
+    }
+
+    // Stuffed bytes, restart markers and fill bytes do not end the entropy-coded data. Another
+    // SOI ends a truncated frame, which then fails to decode.
+    position = std::max(position, searched_);
+    while (true) {
+        position = segments::FindMarkerByte(input_.data(), position, input_.size());
+        if (position + 1 >= input_.size()) {
+            searched_ = position;
+            return 0;
+        }
+
+        auto next = input_[position + 1];
+        if (IsMarkerCode<commands::End>(next)) {
+            return position + 2;
+        }
+        if (IsMarkerCode<commands::Start>(next)) {
+            return position;
+        }
+        ++position;
+    }
+}
+
+void MJPEGDecoder::ReadHeader(std::string_view frame, size_t* scan_offset) {
+    auto data = reinterpret_cast<const uint8_t*>(frame.data());
+    if (frame.size() < 2 || data[0] != 0xff || !IsMarkerCode<commands::Start>(data[1])) {
+        throw std::runtime_error("start token not found");
+    }
+
+    std::string quant_segments, huffman_segments;
+    std::optional<commands::DCT::Payload> dct;
+    image_.SetComment({});
+
+    size_t position = 2;
+    while (true) {
+        if (position + 4 > frame.size()) {
+            throw std::runtime_error("jpeg meta read failed: unexpected input stop");
+        }
+        if (data[position] != 0xff) {
+            throw std::runtime_error("jpeg meta read failed: unexpected token");
+        }
+
+        auto code = data[position + 1];
+        auto length = SegmentLength(data, position);
+        if (length < 2 || position + 2 + length > frame.size()) {
+            throw std::runtime_error("jpeg meta read failed: unexpected input stop");
+        }
+
+        auto segment = frame.substr(position, 2 + length);
+        byte_streams::MemoryStream payload(segment.data() + 2, length);
+
+        if (commands::CheckToken<commands::DQT>(code)) {
+            quant_segments.append(segment);
+        } else if (commands::CheckToken<commands::DHT>(code)) {
+            huffman_segments.append(segment);
+        } else if (commands::CheckToken<commands::DCT>(code)) {
+            if (dct.has_value()) {
+                throw std::runtime_error("jpeg meta read failed: duplicated DCT field");
+            }
+            dct = commands::DCT::Read(payload);
+        } else if (commands::CheckToken<commands::Comment>(code)) {
+            image_.SetComment(commands::Comment::Read(payload).comment);
+        } else if (commands::CheckToken<commands::SOS>(code)) {
+            break;
+        }
+        position += segment.size();
+    }
+
+    if (!dct.has_value()) {
+        throw std::runtime_error("jpeg meta read failed: no dct image info provided");
+    }
+    if (quant_segments.empty()) {
+        throw std::runtime_error("jpeg meta read failed: no q tables provided");
+    }
+
+    bool quant_changed = !has_tables_ || quant_segments != quant_segments_;
+    bool huffman_changed = !has_tables_ || huffman_segments != huffman_segments_;
+
+    if (quant_changed || huffman_changed) {
+        // Stays false if parsing throws, so the next frame parses its tables again.
+        has_tables_ = false;
+
+        if (quant_changed) {
+            std::vector<commands::DQT::Payload> q_tables;
+            ForEachSegment(quant_segments, [&q_tables](std::istream& stream) {
+                for (auto& payload : commands::DQT::ReadMultiple(stream)) {
+                    q_tables.push_back(std::move(payload));
+                }
+            });
+            meta_.SetQuantTables(q_tables);
+        }
+
+        if (huffman_changed) {
+            std::vector<commands::DHT::Payload> trees;
+            ForEachSegment(huffman_segments, [&trees](std::istream& stream) {
+                for (auto& payload : commands::DHT::ReadMultiple(stream)) {
+                    trees.push_back(std::move(payload));
+                }
+            });
+            meta_.huffman_trees =
+                HuffmanStorage::FromPayload(trees.empty() ? commands::DHT::Standard() : trees);
+        }
+
+        quant_segments_ = std::move(quant_segments);
+        huffman_segments_ = std::move(huffman_segments);
+        has_tables_ = true;
+        ++stats_.table_parses;
+    }
+
+    meta_.SetFrame(*dct);
+
+    byte_streams::MemoryStream scan_header(frame.data() + position, frame.size() - position);
+    props_ = ReadScanHeader(scan_header, meta_);
+    *scan_offset = position + 2 + SegmentLength(data, position);
+
+    if (image_.Width() != meta_.width || image_.Height() != meta_.height) {
+        image_.SetSize(meta_.width, meta_.height);
+    }
+}
+
+void MJPEGDecoder::DecodeScan(std::string_view frame, size_t scan_offset) {
+    auto data = reinterpret_cast<const uint8_t*>(frame.data());
+
+    // Unstuffs the entropy-coded data into a buffer which keeps its capacity between frames.
+    scan_.clear();
+    size_t position = scan_offset;
+    while (true) {
+        auto marker = segments::FindMarkerByte(data, position, frame.size());
+        scan_.insert(scan_.end(), data + position, data + marker);
+        position = marker;
+
+        if (position + 1 >= frame.size()) {
+            throw std::runtime_error("0xff expected: premature end of image");
+        }
+        // Fill bytes may precede the marker which ends the data.
+        if (data[position + 1] == 0xff) {
+            ++position;
+            continue;
+        }
+        if (data[position + 1] != 0x00) {
+            break;
+        }
+        scan_.push_back(0xff);
+        position += 2;
+    }
+
+    byte_streams::BufferBitStream bits(scan_.data(), scan_.size());
+    MCU mcu(props_.size());
+    uint16_t cur_x = 0, cur_y = 0;
+
+    while (!bits.IsFinished() && cur_y < meta_.height) {
+        for (size_t channel_idx = 0; channel_idx < props_.size(); ++channel_idx) {
+            auto& channel = props_[channel_idx];
+            const auto& card = meta_.channels[channel.props.id];
+            auto& blocks = mcu.per_channel_blocks[channel_idx];
+
+            blocks.clear();
+            for (uint8_t block_idx = 0; block_idx < card.horizontal_sp * card.vertical_sp;
+                 ++block_idx) {
+                auto decoded = DecodeDifferences(bits, channel.props, meta_);
+                decoded.block.buffer[0] += channel.last_dc;
+                channel.last_dc = decoded.block.buffer[0];
+                blocks.push_back(TransformBlock(decoded, meta_));
+            }
+        }
+        PutMCU(mcu, cur_x, cur_y, meta_, &image_);
+
+        cur_x += meta_.mcu_x_step;
+        if (cur_x >= meta_.width) {
+            cur_x = 0;
+            cur_y += meta_.mcu_y_step;
+        }
+    }
+
+    if (!IsMarkerCode<commands::End>(data[position + 1])) {
+        throw std::runtime_error("0xd9 expected: premature end of image");
+    }
+}
+
+}  // namespace decode
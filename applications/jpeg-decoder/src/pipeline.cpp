@@ -0,0 +1,151 @@
+#include "pipeline.h"
+#include "decoder.h"
+#include "blocking-queue.h"
+
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include <fstream>
+#include <exception>
+#include <filesystem>
+
+namespace decode {
+
+namespace {
+
+using Buffer = std::vector<char>;
+
+struct PrefetchedFile {
+    size_t file_idx;
+    Buffer buffer;
+};
+
+void ReadFile(const std::string& filename, Buffer* buffer) {
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file) {
+        throw std::runtime_error("failed to open " + filename);
+    }
+
+    auto size = static_cast<size_t>(file.tellg());
+    file.seekg(0);
+
+    buffer->resize(size);
+    if (!file.read(buffer->data(), size)) {
+        throw std::runtime_error("failed to read " + filename);
+    }
+}
+
+class ErrorSlot {
+public:
+    void Set(std::exception_ptr error) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!error_) {
+            error_ = error;
+        }
+    }
+
+    bool IsSet() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return error_ != nullptr;
+    }
+
+    void RethrowIfSet() {
+        if (error_) {
+            std::rethrow_exception(error_);
+        }
+    }
+
+private:
+    std::mutex mutex_;
+    std::exception_ptr error_ = nullptr;
+};
+
+}  // namespace
+
+void DecodeFiles(const std::vector<std::string>& filenames, const PipelineOptions& options,
+                 const OnDecoded& on_decoded) {
+    size_t num_decoders = std::max<size_t>(options.num_decoders, 1);
+    size_t num_buffers = options.queue_depth + num_decoders;
+
+    // Free buffers keep their capacity between files. The reader blocks on this pool once every
+    // buffer is either queued or being decoded, which is what bounds the read-ahead.
+    concurrency::BlockingQueue<Buffer> free_buffers(num_buffers);
+    concurrency::BlockingQueue<PrefetchedFile> prefetched(num_buffers);
+
+    for (size_t buffer_idx = 0; buffer_idx < num_buffers; ++buffer_idx) {
+        free_buffers.Push(Buffer());
+    }
+
+    ErrorSlot error;
+
+    auto abort = [&](std::exception_ptr exception) {
+        error.Set(exception);
+        prefetched.Close();
+        free_buffers.Close();
+    };
+
+    std::thread reader([&] {
+        try {
+            for (size_t file_idx = 0; file_idx < filenames.size(); ++file_idx) {
+                auto buffer = free_buffers.Pop();
+                if (!buffer.has_value()) {
+                    break;
+                }
+
+                ReadFile(filenames[file_idx], &buffer.value());
+
+                if (!prefetched.Push({file_idx, std::move(buffer.value())})) {
+                    break;
+                }
+            }
+            prefetched.Close();
+        } catch (...) {
+            abort(std::current_exception());
+        }
+    });
+
+    std::vector<std::thread> decoders;
+    for (size_t decoder_idx = 0; decoder_idx < num_decoders; ++decoder_idx) {
+        decoders.emplace_back([&] {
+            try {
+                while (auto file = prefetched.Pop()) {
+                    if (error.IsSet()) {
+                        break;
+                    }
+
+                    auto& buffer = file.value().buffer;
+                    byte_streams::MemoryStream stream(buffer.data(), buffer.size());
+
+                    auto file_idx = file.value().file_idx;
+                    on_decoded(file_idx, filenames[file_idx], Decode(stream));
+
+                    free_buffers.Push(std::move(buffer));
+                }
+            } catch (...) {
+                abort(std::current_exception());
+            }
+        });
+    }
+
+    reader.join();
+    for (auto& decoder : decoders) {
+        decoder.join();
+    }
+
+    error.RethrowIfSet();
+}
+
+void DecodeDirectory(const std::string& directory, const PipelineOptions& options,
+                     const OnDecoded& on_decoded) {
+    std::vector<std::string> filenames;
+    for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+        if (entry.is_regular_file()) {
+            filenames.push_back(entry.path().string());
+        }
+    }
+    std::sort(filenames.begin(), filenames.end());
+
+    DecodeFiles(filenames, options, on_decoded);
+}
+
+}  // namespace decode
@@ -0,0 +1,130 @@
+#include "pipelined.h"
+#include "blocking-queue.h"
+
+#include <mutex>
+#include <thread>
+#include <exception>
+
+namespace decode {
+
+namespace {
+
+// Coefficients of one MCU row in stream order, with absolute DC values.
+struct RowBuffer {
+    size_t row = 0, num_mcus = 0;
+    std::vector<Block> blocks;
+};
+
+}  // namespace
+
+Image DecodePipelined(std::istream& input, const std::vector<ChannelProps>& props,
+                      const JPEGMeta& meta, const DecodeOptions& options) {
+    auto data = byte_streams::ReadStuffedSegment(input);
+    byte_streams::BufferBitStream bits(data.data(), data.size());
+
+    size_t mcus_per_row = (meta.width + meta.mcu_x_step - 1) / meta.mcu_x_step;
+    size_t mcu_rows = (meta.height + meta.mcu_y_step - 1) / meta.mcu_y_step;
+
+    size_t num_workers = std::max<size_t>(options.pipeline_threads, 1);
+    size_t num_buffers = std::max<size_t>(options.pipeline_depth, 1) + num_workers;
+
+    // Rows cycle from the entropy decoder to the workers and back, so the buffers keep their
+    // capacity and the entropy decoder blocks once it is num_buffers rows ahead.
+    concurrency::BlockingQueue<RowBuffer> free_rows(num_buffers), ready_rows(num_buffers);
+    for (size_t buffer_idx = 0; buffer_idx < num_buffers; ++buffer_idx) {
+        free_rows.Push(RowBuffer());
+    }
+
+    Image image(meta.width, meta.height);
+
+    std::mutex error_mutex;
+    std::exception_ptr error = nullptr;
+
+    auto abort = [&](std::exception_ptr exception) {
+        {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error) {
+                error = exception;
+            }
+        }
+        ready_rows.Close();
+        free_rows.Close();
+    };
+
+    // Rows cover disjoint pixels, so the workers write into the image without locking.
+    std::vector<std::thread> workers;
+    for (size_t worker_idx = 0; worker_idx < num_workers; ++worker_idx) {
+        workers.emplace_back([&] {
+            try {
+                MCU mcu(props.size());
+                while (auto row = ready_rows.Pop()) {
+                    auto block_it = row->blocks.cbegin();
+                    for (size_t mcu_idx = 0; mcu_idx < row->num_mcus; ++mcu_idx) {
+                        for (size_t channel_idx = 0; channel_idx < props.size(); ++channel_idx) {
+                            const auto& card = meta.channels[props[channel_idx].props.id];
+                            auto& blocks = mcu.per_channel_blocks[channel_idx];
+
+                            blocks.clear();
+                            for (uint8_t block_idx = 0;
+                                 block_idx < card.horizontal_sp * card.vertical_sp; ++block_idx) {
+                                blocks.push_back(TransformBlock(*block_it++, meta));
+                            }
+                        }
+                        PutMCU(mcu, mcu_idx * meta.mcu_x_step, row->row * meta.mcu_y_step, meta,
+                               &image);
+                    }
+
+                    if (!free_rows.Push(std::move(row.value()))) {
+                        break;
+                    }
+                }
+            } catch (...) {
+                abort(std::current_exception());
+            }
+        });
+    }
+
+    try {
+        auto channels = props;
+        for (size_t row = 0; row < mcu_rows && !bits.IsFinished(); ++row) {
+            auto buffer = free_rows.Pop();
+            if (!buffer.has_value()) {
+                break;
+            }
+
+            buffer->row = row;
+            buffer->blocks.clear();
+            for (buffer->num_mcus = 0; buffer->num_mcus < mcus_per_row && !bits.IsFinished();
+                 ++buffer->num_mcus) {
+                for (auto& channel : channels) {
+                    const auto& card = meta.channels[channel.props.id];
+                    for (uint8_t block_idx = 0; block_idx < card.horizontal_sp * card.vertical_sp;
+                         ++block_idx) {
+                        auto decoded = DecodeDifferences(bits, channel.props, meta);
+                        decoded.block.buffer[0] += channel.last_dc;
+                        channel.last_dc = decoded.block.buffer[0];
+                        buffer->blocks.push_back(decoded);
+                    }
+                }
+            }
+
+            if (!ready_rows.Push(std::move(buffer.value()))) {
+                break;
+            }
+        }
+        ready_rows.Close();
+    } catch (...) {
+        abort(std::current_exception());
+    }
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    return image;
+}
+
+}  // namespace decode
@@ -0,0 +1,110 @@
+#include "segment-index.h"
+#include "kernels.h"
+
+#include <limits>
+#include <stdexcept>
+
+namespace segments {
+
+namespace {
+
+constexpr uint8_t kStartOfImage = 0xd8, kEndOfImage = 0xd9, kStartOfScan = 0xda;
+
+bool IsRestart(uint8_t marker) {
+    return marker >= 0xd0 && marker <= 0xd7;
+}
+
+bool IsStandalone(uint8_t marker) {
+    return IsRestart(marker) || marker == kStartOfImage || marker == kEndOfImage ||
+           marker == 0x01;
+}
+
+// Skips the entropy-coded data starting at position and returns the offset of the marker which
+// ends it. Stuffed 0xff 0x00 pairs and fill bytes are part of the data.
+size_t SkipEntropyCoded(const uint8_t* data, size_t position, size_t size,
+                        std::vector<uint32_t>* restarts) {
+    while (true) {
+        position = FindMarkerByte(data, position, size);
+        if (position + 1 >= size) {
+            return size;
+        }
+
+        uint8_t next = data[position + 1];
+        if (next == 0x00 || next == 0xff) {
+            position += 1;
+        } else if (IsRestart(next)) {
+            restarts->push_back(position);
+            position += 2;
+        } else {
+            return position;
+        }
+    }
+}
+
+}  // namespace
+
+size_t FindMarkerByte(const uint8_t* data, size_t position, size_t size) {
+    return kernels::Get().find_marker_byte(data, position, size);
+}
+
+SegmentIndex SegmentIndex::Build(const uint8_t* data, size_t size) {
+    SegmentIndex index;
+
+    if (size > std::numeric_limits<uint32_t>::max()) {
+        throw std::runtime_error("segment index failed: input exceeds 4 GiB");
+    }
+    if (size < 2 || data[0] != 0xff || data[1] != kStartOfImage) {
+        throw std::runtime_error("start token not found");
+    }
+
+    size_t position = 0;
+    while (position + 1 < size) {
+        if (data[position] != 0xff) {
+            throw std::runtime_error("segment index failed: unexpected token");
+        }
+
+        uint8_t marker = data[position + 1];
+        if (marker == 0xff) {
+            ++position;
+            continue;
+        }
+
+        Segment segment{static_cast<uint32_t>(position), 0, marker};
+        if (!IsStandalone(marker)) {
+            if (position + 4 > size) {
+                throw std::runtime_error("segment index failed: unexpected input stop");
+            }
+            segment.length = (data[position + 2] << 8) | data[position + 3];
+        }
+        index.segments.push_back(segment);
+
+        if (marker == kEndOfImage) {
+            break;
+        }
+
+        position += 2 + segment.length;
+        if (position > size) {
+            throw std::runtime_error("segment index failed: segment exceeds input");
+        }
+
+        if (marker == kStartOfScan) {
+            auto end = SkipEntropyCoded(data, position, size, &index.restarts);
+            index.entropy_coded.push_back(
+                {static_cast<uint32_t>(position), static_cast<uint32_t>(end)});
+            position = end;
+        }
+    }
+
+    return index;
+}
+
+const Segment* SegmentIndex::Find(uint8_t marker) const {
+    for (const auto& segment : segments) {
+        if (segment.marker == marker) {
+            return &segment;
+        }
+    }
+    return nullptr;
+}
+
+}  // namespace segments
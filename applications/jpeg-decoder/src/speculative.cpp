@@ -0,0 +1,235 @@
+#include "speculative.h"
+
+#include <atomic>
+#include <exception>
+#include <limits>
+#include <mutex>
+#include <thread>
+
+namespace decode {
+
+namespace {
+
+struct LayoutEntry {
+    commands::SOS::ChannelProps props;
+    uint8_t channel_idx;
+};
+
+// Order in which blocks of the channels follow each other inside one MCU. The position of a
+// block in this cycle is its phase.
+using MCULayout = std::vector<LayoutEntry>;
+
+MCULayout BuildMCULayout(const std::vector<ChannelProps>& props, const JPEGMeta& meta) {
+    MCULayout layout;
+    for (uint8_t channel_idx = 0; channel_idx < props.size(); ++channel_idx) {
+        const auto& card = meta.channels[props[channel_idx].props.id];
+        for (uint8_t block_idx = 0; block_idx < card.horizontal_sp * card.vertical_sp;
+             ++block_idx) {
+            layout.push_back({props[channel_idx].props, channel_idx});
+        }
+    }
+    return layout;
+}
+
+struct DecoderState {
+    size_t bit_position = 0;
+    uint8_t phase = 0;
+
+    bool operator==(const DecoderState& other) const {
+        return bit_position == other.bit_position && phase == other.phase;
+    }
+};
+
+// A unit is a block with its coefficients. It only depends on the state it was decoded from,
+// so units decoded from the same state by different threads are identical.
+struct DecodedUnit {
+    DecoderState start, end;
+    Block block;
+};
+
+class UnitDecoder {
+public:
+    UnitDecoder(const std::vector<uint8_t>& data, const MCULayout& layout, const JPEGMeta& meta)
+        : bits_(data.data(), data.size()), num_bits_(8 * data.size()), layout_(layout),
+          meta_(meta) {
+    }
+
+    DecodedUnit Decode(DecoderState* state) {
+        bits_.Seek(state->bit_position);
+        DecodedUnit unit;
+        unit.start = *state;
+        unit.block = DecodeDifferences(bits_, layout_[state->phase].props, meta_);
+
+        state->bit_position = bits_.Position();
+        state->phase = (state->phase + 1) % layout_.size();
+        unit.end = *state;
+        return unit;
+    }
+
+    // Like the sequential decoder, a new MCU is only started while there is data left.
+    bool IsExhausted(const DecoderState& state) const {
+        return state.phase == 0 && state.bit_position >= num_bits_;
+    }
+
+private:
+    byte_streams::BufferBitStream bits_;
+    size_t num_bits_;
+    const MCULayout& layout_;
+    const JPEGMeta& meta_;
+};
+
+// Decodes the units starting inside [begin_bit, end_bit), guessing that an MCU starts at
+// begin_bit. The guess is wrong for most chunks, and so is every guess made after an invalid
+// code is hit, but the decoding converges to the true block boundaries after a while.
+std::vector<DecodedUnit> DecodeChunk(UnitDecoder* decoder, size_t begin_bit, size_t end_bit,
+                                     size_t max_units) {
+    std::vector<DecodedUnit> units;
+
+    DecoderState state{begin_bit, 0};
+    while (state.bit_position < end_bit && units.size() < max_units &&
+           !decoder->IsExhausted(state)) {
+        auto start = state;
+        try {
+            units.push_back(decoder->Decode(&state));
+        } catch (const std::runtime_error&) {
+            state = {start.bit_position + 1, 0};
+        }
+    }
+    return units;
+}
+
+// Walks the chunks in order, carrying the true decoder state. Whenever the state coincides
+// with the start of a unit some chunk decoded speculatively, the contiguous run of units from
+// there is taken over as is; otherwise units are decoded one by one until the two meet.
+std::vector<Block> Reconcile(std::vector<std::vector<DecodedUnit>>* chunks,
+                             const std::vector<size_t>& chunk_begins, UnitDecoder* decoder,
+                             size_t num_units) {
+    std::vector<Block> blocks;
+    blocks.reserve(num_units);
+
+    DecoderState state;
+    for (size_t chunk_idx = 0; chunk_idx < chunks->size(); ++chunk_idx) {
+        auto& units = (*chunks)[chunk_idx];
+        size_t chunk_end = chunk_idx + 1 < chunks->size() ? chunk_begins[chunk_idx + 1]
+                                                          : std::numeric_limits<size_t>::max();
+
+        size_t candidate = 0;
+        while (blocks.size() < num_units && !decoder->IsExhausted(state) &&
+               state.bit_position < chunk_end) {
+            while (candidate < units.size() &&
+                   units[candidate].start.bit_position < state.bit_position) {
+                ++candidate;
+            }
+
+            if (candidate < units.size() && units[candidate].start == state) {
+                for (; candidate < units.size() && units[candidate].start == state &&
+                       blocks.size() < num_units;
+                     ++candidate) {
+                    blocks.push_back(units[candidate].block);
+                    state = units[candidate].end;
+                }
+                continue;
+            }
+
+            blocks.push_back(decoder->Decode(&state).block);
+        }
+
+        units.clear();
+        units.shrink_to_fit();
+    }
+    return blocks;
+}
+
+// Calls function(thread_idx, task) for every task, spreading them over the threads. The first
+// exception a task throws stops the remaining tasks and is rethrown once the threads finish.
+template <class Function>
+void RunParallel(size_t num_threads, size_t num_tasks, Function function) {
+    std::atomic<size_t> next_task = 0;
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    auto work = [&](size_t thread_idx) {
+        for (size_t task = next_task++; task < num_tasks; task = next_task++) {
+            try {
+                function(thread_idx, task);
+            } catch (...) {
+                std::lock_guard lock(error_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                next_task = num_tasks;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t thread_idx = 1; thread_idx < num_threads; ++thread_idx) {
+        threads.emplace_back(work, thread_idx);
+    }
+    work(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+}  // namespace
+
+Image DecodeSpeculative(std::istream& input, const std::vector<ChannelProps>& props,
+                        const JPEGMeta& meta, const DecodeOptions& options) {
+    auto data = byte_streams::ReadStuffedSegment(input);
+    auto layout = BuildMCULayout(props, meta);
+
+    size_t mcus_per_row = (meta.width + meta.mcu_x_step - 1) / meta.mcu_x_step;
+    size_t mcu_rows = (meta.height + meta.mcu_y_step - 1) / meta.mcu_y_step;
+    size_t num_units = mcus_per_row * mcu_rows * layout.size();
+
+    size_t chunk_bits = 8 * std::max<size_t>(options.speculative_chunk_size, 1);
+    size_t num_chunks = std::max<size_t>((8 * data.size() + chunk_bits - 1) / chunk_bits, 1);
+
+    std::vector<size_t> chunk_begins(num_chunks);
+    for (size_t chunk_idx = 0; chunk_idx < num_chunks; ++chunk_idx) {
+        chunk_begins[chunk_idx] = chunk_idx * chunk_bits;
+    }
+
+    std::vector<std::vector<DecodedUnit>> chunks(num_chunks);
+    RunParallel(options.speculative_threads, num_chunks, [&](size_t, size_t chunk_idx) {
+        UnitDecoder decoder(data, layout, meta);
+        size_t end_bit = chunk_idx + 1 < num_chunks ? chunk_begins[chunk_idx + 1] : 8 * data.size();
+        chunks[chunk_idx] = DecodeChunk(&decoder, chunk_begins[chunk_idx], end_bit, num_units);
+    });
+
+    UnitDecoder decoder(data, layout, meta);
+    auto blocks = Reconcile(&chunks, chunk_begins, &decoder, num_units);
+
+    std::vector<int16_t> last_dc(meta.channels.size(), 0);
+    for (auto& decoded : blocks) {
+        decoded.block.buffer[0] += last_dc[decoded.channel_id];
+        last_dc[decoded.channel_id] = decoded.block.buffer[0];
+    }
+
+    Image image(meta.width, meta.height);
+    size_t num_mcus = blocks.size() / layout.size();
+
+    RunParallel(options.speculative_threads, mcu_rows, [&](size_t, size_t row) {
+        for (size_t mcu_idx = row * mcus_per_row;
+             mcu_idx < std::min((row + 1) * mcus_per_row, num_mcus); ++mcu_idx) {
+            MCU mcu(props.size());
+            for (size_t phase = 0; phase < layout.size(); ++phase) {
+                const auto& decoded = blocks[mcu_idx * layout.size() + phase];
+                mcu.per_channel_blocks[layout[phase].channel_idx].push_back(
+                    TransformBlock(decoded, meta));
+            }
+
+            PutMCU(mcu, (mcu_idx % mcus_per_row) * meta.mcu_x_step, row * meta.mcu_y_step, meta,
+                   &image);
+        }
+    });
+
+    return image;
+}
+
+}  // namespace decode
@@ -1,8 +1,25 @@
+#include <mutex>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
 #include <vector>
+#include <functional>
 
 #include <gtest/gtest.h>
 
 #include "decoder.h"
+#include "pipeline.h"
+#include "decode-cache.h"
+#include "segment-index.h"
+#include "kernels.h"
+#include "lossless.h"
+#include "incremental.h"
+#include "exif.h"
+#include "mjpeg.h"
+#include "fourier.h"
 
 #ifndef TEST_DATA_DIR
 #define TEST_DATA_DIR "."
@@ -15,6 +32,656 @@ std::string ConstructBasePath() {
 
 static const std::string kBasePath = ConstructBasePath();
 
+void ExpectSameImage(const Image& expected, const Image& actual) {
+    ASSERT_EQ(expected.Width(), actual.Width());
+    ASSERT_EQ(expected.Height(), actual.Height());
+    ASSERT_EQ(expected.GetComment(), actual.GetComment());
+
+    for (size_t y = 0; y < expected.Height(); ++y) {
+        for (size_t x = 0; x < expected.Width(); ++x) {
+            auto lhs = expected.GetPixel(y, x), rhs = actual.GetPixel(y, x);
+            ASSERT_EQ(lhs.r, rhs.r);
+            ASSERT_EQ(lhs.g, rhs.g);
+            ASSERT_EQ(lhs.b, rhs.b);
+        }
+    }
+}
+
+std::string ReadFile(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    std::stringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+
 TEST(Decoder, Lenna) {
     auto a = decode::Decode(kBasePath + "/lenna.jpg");
 }
+
+TEST(Pipeline, DecodeFiles) {
+    auto expected = decode::Decode(kBasePath + "/lenna.jpg");
+    std::vector<std::string> filenames(3, kBasePath + "/lenna.jpg");
+
+    decode::PipelineOptions options;
+    options.queue_depth = 1;
+    options.num_decoders = 2;
+
+    std::mutex mutex;
+    std::vector<size_t> decoded;
+    decode::DecodeFiles(filenames, options, [&](size_t file_idx, const std::string&, Image image) {
+        ExpectSameImage(expected, image);
+        std::lock_guard<std::mutex> lock(mutex);
+        decoded.push_back(file_idx);
+    });
+
+    std::sort(decoded.begin(), decoded.end());
+    ASSERT_EQ(decoded, std::vector<size_t>({0, 1, 2}));
+}
+
+TEST(Pipeline, MissingFile) {
+    std::vector<std::string> filenames = {kBasePath + "/lenna.jpg", kBasePath + "/missing.jpg"};
+    ASSERT_THROW(decode::DecodeFiles(filenames, {}, [](size_t, const std::string&, Image) {}),
+                 std::runtime_error);
+}
+
+TEST(Speculative, BitExact) {
+    auto expected = decode::Decode(kBasePath + "/lenna.jpg");
+
+    for (size_t chunk_size : {1 << 10, 1 << 13, 1 << 20}) {
+        decode::DecodeOptions options;
+        options.speculative_threads = 4;
+        options.speculative_chunk_size = chunk_size;
+
+        ExpectSameImage(expected, decode::Decode(kBasePath + "/lenna.jpg", options));
+    }
+}
+
+TEST(Pipelined, BitExact) {
+    auto expected = decode::Decode(kBasePath + "/lenna.jpg");
+
+    for (size_t num_threads : {1, 3}) {
+        for (size_t depth : {1, 16}) {
+            decode::DecodeOptions options;
+            options.pipeline_threads = num_threads;
+            options.pipeline_depth = depth;
+
+            ExpectSameImage(expected, decode::Decode(kBasePath + "/lenna.jpg", options));
+        }
+    }
+
+    decode::DecodeOptions options;
+    options.pipeline_threads = 2;
+    auto file = ReadFile(kBasePath + "/lenna.jpg");
+    byte_streams::MemoryStream truncated(file.data(), file.size() / 2);
+    ASSERT_THROW(decode::Decode(truncated, options), std::runtime_error);
+}
+
+TEST(DecodeCache, HitsAndEviction) {
+    auto bytes = ReadFile(kBasePath + "/lenna.jpg");
+    auto expected = decode::Decode(kBasePath + "/lenna.jpg");
+
+    decode::DecodeCache cache(4 * 512 * 512 * sizeof(RGB));
+    auto first = cache.Decode(bytes);
+    auto second = cache.DecodeFile(kBasePath + "/lenna.jpg");
+
+    ExpectSameImage(expected, *first);
+    ASSERT_EQ(first, second);
+    ASSERT_EQ(cache.GetStats().hits, 1);
+    ASSERT_EQ(cache.GetStats().misses, 1);
+
+    // A directory opens, but cannot be read, which fails before anything is decoded.
+    ASSERT_THROW(cache.DecodeFile(kBasePath), std::runtime_error);
+    ASSERT_EQ(cache.GetStats().misses, 1);
+
+    decode::DecodeCache small_cache(1024);
+    small_cache.Decode(bytes);
+    small_cache.Decode(bytes);
+    ASSERT_EQ(small_cache.GetStats().misses, 2);
+    ASSERT_EQ(small_cache.GetStats().bytes, 0);
+}
+
+TEST(DecodeCache, ConcurrentRequestsDecodeOnce) {
+    auto bytes = ReadFile(kBasePath + "/lenna.jpg");
+    decode::DecodeCache cache(1 << 24);
+
+    std::vector<std::shared_ptr<const Image>> images(4);
+    std::vector<std::thread> threads;
+    for (auto& image : images) {
+        threads.emplace_back([&] { image = cache.Decode(bytes); });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (const auto& image : images) {
+        ASSERT_EQ(images[0], image);
+    }
+    ASSERT_EQ(cache.GetStats().misses, 1);
+    ASSERT_EQ(cache.GetStats().hits, 3);
+}
+
+// Inverse of the mixing step of the cache's hash, x ^= x >> 32, x *= c, x ^= x >> 32.
+uint64_t UnmixForCollision(uint64_t value) {
+    constexpr uint64_t kMixMultiplier = 0xd6e8feb86659fd93ull;
+    uint64_t inverse = kMixMultiplier;
+    for (int step = 0; step < 5; ++step) {
+        inverse *= 2 - kMixMultiplier * inverse;
+    }
+    value ^= value >> 32;
+    value *= inverse;
+    value ^= value >> 32;
+    return value;
+}
+
+uint64_t MixForCollision(uint64_t value) {
+    value ^= value >> 32;
+    value *= 0xd6e8feb86659fd93ull;
+    value ^= value >> 32;
+    return value;
+}
+
+TEST(DecodeCache, HashCollisionIsAMiss) {
+    constexpr uint64_t kMultiplier = 0x9e3779b97f4a7c15ull;
+    auto bytes = ReadFile(kBasePath + "/lenna.jpg");
+    decode::DecodeCache cache(1 << 24);
+    cache.Decode(bytes);
+
+    // Changes the first word and compensates in the second, so that the hash chain
+    // hash = (hash ^ Mix(word)) * kMultiplier reaches the same state after both.
+    uint64_t words[2], forged[2];
+    std::memcpy(words, bytes.data(), sizeof(words));
+    forged[0] = words[0] ^ 0xff;
+    uint64_t hash = bytes.size() * kMultiplier;
+    uint64_t original = (hash ^ MixForCollision(words[0])) * kMultiplier;
+    uint64_t changed = (hash ^ MixForCollision(forged[0])) * kMultiplier;
+    forged[1] = UnmixForCollision(original ^ changed ^ MixForCollision(words[1]));
+    auto colliding = bytes;
+    std::memcpy(colliding.data(), forged, sizeof(forged));
+
+    // Not a JPEG any more, so the decode fails rather than returning lenna.
+    ASSERT_THROW(cache.Decode(colliding), std::runtime_error);
+    ASSERT_EQ(cache.GetStats().hits, 0);
+    ASSERT_EQ(cache.GetStats().misses, 2);
+}
+
+TEST(SegmentIndex, Lenna) {
+    auto bytes = ReadFile(kBasePath + "/lenna.jpg");
+    auto data = reinterpret_cast<const uint8_t*>(bytes.data());
+
+    auto index = segments::SegmentIndex::Build(data, bytes.size());
+
+    std::vector<uint8_t> markers;
+    for (const auto& segment : index.segments) {
+        markers.push_back(segment.marker);
+    }
+    ASSERT_EQ(markers, std::vector<uint8_t>({0xd8, 0xe0, 0xdb, 0xdb, 0xc0, 0xc4, 0xc4, 0xc4, 0xc4,
+                                             0xda, 0xd9}));
+
+    const auto* dqt = index.Find(0xdb);
+    ASSERT_NE(dqt, nullptr);
+    ASSERT_EQ(dqt->length, 67);
+
+    ASSERT_EQ(index.entropy_coded.size(), 1);
+    ASSERT_EQ(index.entropy_coded[0].end, index.segments.back().offset);
+    ASSERT_TRUE(index.restarts.empty());
+}
+
+TEST(SegmentIndex, StuffingAndRestarts) {
+    std::vector<uint8_t> data = {0xff, 0xd8, 0xff, 0xda, 0x00, 0x02, 0x12, 0xff, 0x00, 0x34,
+                                 0xff, 0xd0, 0x56, 0xff, 0xff, 0xd1, 0x78, 0xff, 0xd9};
+
+    auto index = segments::SegmentIndex::Build(data.data(), data.size());
+
+    ASSERT_EQ(index.segments.size(), 3);
+    ASSERT_EQ(index.entropy_coded[0].begin, 6);
+    ASSERT_EQ(index.entropy_coded[0].end, 17);
+    ASSERT_EQ(index.restarts, std::vector<uint32_t>({10, 14}));
+
+    // The size is checked before any byte is read.
+    ASSERT_THROW(segments::SegmentIndex::Build(data.data(), size_t(1) << 32), std::runtime_error);
+}
+
+TEST(SegmentIndex, FindMarkerByte) {
+    std::vector<uint8_t> data(1000);
+    for (size_t position = 0; position < data.size(); ++position) {
+        data[position] = (position * 7919) % 251;
+    }
+
+    for (size_t marker : {0, 15, 16, 17, 500, 999}) {
+        data[marker] = 0xff;
+        for (size_t from : {size_t(0), marker / 2, marker}) {
+            ASSERT_EQ(segments::FindMarkerByte(data.data(), from, data.size()), marker);
+        }
+        ASSERT_EQ(segments::FindMarkerByte(data.data(), marker + 1, data.size()), data.size());
+        data[marker] = 0;
+    }
+}
+
+std::vector<kernels::Level> SupportedLevels() {
+    std::vector<kernels::Level> levels;
+    for (auto level : {kernels::Level::kScalar, kernels::Level::kSSE2, kernels::Level::kSSE41,
+                       kernels::Level::kAVX2, kernels::Level::kAVX512}) {
+        if (level <= kernels::DetectLevel()) {
+            levels.push_back(level);
+        }
+    }
+    return levels;
+}
+
+TEST(Kernels, IDCTMatchesReference) {
+    std::mt19937 generator(17);
+    std::uniform_real_distribution<double> distribution(-1024, 1024);
+
+    blocks::Cartesian<double, 8> coefficients;
+    for (auto& row : coefficients.buffer) {
+        for (auto& value : row) {
+            value = distribution(generator);
+        }
+    }
+
+    auto expected = fft::IDCT88V1().Transform(coefficients);
+    const auto& scalar = kernels::ForLevel(kernels::Level::kScalar);
+
+    blocks::Cartesian<double, 8> reference;
+    scalar.idct(coefficients.buffer.data()->data(), reference.buffer.data()->data());
+    for (size_t i = 0; i < 8; ++i) {
+        for (size_t j = 0; j < 8; ++j) {
+            ASSERT_NEAR(expected.buffer[i][j], reference.buffer[i][j], 1e-9);
+        }
+    }
+
+    for (auto level : SupportedLevels()) {
+        blocks::Cartesian<double, 8> actual;
+        kernels::ForLevel(level).idct(coefficients.buffer.data()->data(),
+                                      actual.buffer.data()->data());
+        ASSERT_EQ(reference.buffer, actual.buffer) << kernels::LevelName(level);
+    }
+}
+
+TEST(Kernels, BitExactAcrossLevels) {
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<int16_t> coefficient(-2048, 2047), sample(-300, 600);
+
+    std::array<int16_t, 64> coefficients, table;
+    std::array<int16_t, 37> luma, blue, red;
+    for (auto* values : {&coefficients, &table}) {
+        std::generate(values->begin(), values->end(), [&] { return coefficient(generator); });
+    }
+    for (auto* values : {&luma, &blue, &red}) {
+        std::generate(values->begin(), values->end(), [&] { return sample(generator); });
+    }
+
+    const auto& scalar = kernels::ForLevel(kernels::Level::kScalar);
+
+    std::array<int16_t, 64> dequantized;
+    scalar.dequantize(coefficients.data(), table.data(), dequantized.data());
+
+    std::array<RGB, 37> rgb;
+    scalar.ycbcr_to_rgb(luma.data(), blue.data(), red.data(), rgb.data(), rgb.size());
+
+    std::array<int16_t, 74> upsampled;
+    scalar.upsample_h2(luma.data(), upsampled.data(), luma.size());
+
+    for (auto level : SupportedLevels()) {
+        const auto& current = kernels::ForLevel(level);
+        ASSERT_EQ(current.level, level);
+
+        std::array<int16_t, 64> actual_dequantized;
+        current.dequantize(coefficients.data(), table.data(), actual_dequantized.data());
+        ASSERT_EQ(dequantized, actual_dequantized) << kernels::LevelName(level);
+
+        std::array<RGB, 37> actual_rgb;
+        current.ycbcr_to_rgb(luma.data(), blue.data(), red.data(), actual_rgb.data(),
+                             actual_rgb.size());
+        for (size_t idx = 0; idx < rgb.size(); ++idx) {
+            ASSERT_EQ(rgb[idx].r, actual_rgb[idx].r) << kernels::LevelName(level);
+            ASSERT_EQ(rgb[idx].g, actual_rgb[idx].g) << kernels::LevelName(level);
+            ASSERT_EQ(rgb[idx].b, actual_rgb[idx].b) << kernels::LevelName(level);
+        }
+
+        std::array<int16_t, 74> actual_upsampled;
+        current.upsample_h2(luma.data(), actual_upsampled.data(), luma.size());
+        ASSERT_EQ(upsampled, actual_upsampled) << kernels::LevelName(level);
+
+        std::vector<uint8_t> bytes(300, 0x12);
+        for (size_t marker : {0, 31, 64, 200, 299}) {
+            bytes[marker] = 0xff;
+            ASSERT_EQ(current.find_marker_byte(bytes.data(), 0, bytes.size()), marker);
+            ASSERT_EQ(current.find_marker_byte(bytes.data(), marker + 1, bytes.size()),
+                      bytes.size());
+            bytes[marker] = 0x12;
+        }
+    }
+}
+
+std::string TransformFile(const std::string& filename, const lossless::TransformOptions& options) {
+    std::ifstream input(filename, std::ios::binary);
+    std::stringstream output;
+    lossless::Transform(input, output, options);
+    return output.str();
+}
+
+Image DecodeString(const std::string& bytes) {
+    std::stringstream input(bytes);
+    return decode::Decode(input);
+}
+
+// Compares against the pixels of the source image the transformation moves to each position.
+template <class SourcePosition>
+void ExpectTransformed(const Image& source, const Image& actual, SourcePosition position) {
+    for (size_t y = 0; y < actual.Height(); ++y) {
+        for (size_t x = 0; x < actual.Width(); ++x) {
+            auto [source_x, source_y] = position(x, y);
+            auto lhs = source.GetPixel(source_y, source_x), rhs = actual.GetPixel(y, x);
+            ASSERT_EQ(lhs.r, rhs.r) << x << " " << y;
+            ASSERT_EQ(lhs.g, rhs.g) << x << " " << y;
+            ASSERT_EQ(lhs.b, rhs.b) << x << " " << y;
+        }
+    }
+}
+
+TEST(Lossless, NoneKeepsPixels) {
+    auto expected = decode::Decode(kBasePath + "/lenna.jpg");
+    auto transformed = TransformFile(kBasePath + "/lenna.jpg", {});
+    ExpectSameImage(expected, DecodeString(transformed));
+}
+
+TEST(Lossless, OptimizedTables) {
+    auto expected = decode::Decode(kBasePath + "/lenna.jpg");
+    auto standard = TransformFile(kBasePath + "/lenna.jpg", {});
+
+    lossless::TransformOptions options;
+    options.optimize_huffman = true;
+    options.operation = lossless::Operation::kRotate180;
+    auto rotated = TransformFile(kBasePath + "/lenna.jpg", options);
+    options.operation = lossless::Operation::kNone;
+    auto optimized = TransformFile(kBasePath + "/lenna.jpg", options);
+
+    ASSERT_LT(optimized.size(), standard.size());
+    ExpectSameImage(expected, DecodeString(optimized));
+
+    // Turning it back with optimized tables again gives the same pixels.
+    lossless::TransformOptions back;
+    back.operation = lossless::Operation::kRotate180;
+    back.optimize_huffman = true;
+
+    std::stringstream input(rotated), output;
+    lossless::Transform(input, output, back);
+    ExpectSameImage(expected, DecodeString(output.str()));
+}
+
+TEST(Lossless, RotationsAndFlips) {
+    using Position = std::pair<size_t, size_t>;
+    using Operation = lossless::Operation;
+
+    auto source = decode::Decode(kBasePath + "/lenna.jpg");
+    size_t w = source.Width(), h = source.Height();
+
+    std::vector<std::pair<Operation, std::function<Position(size_t, size_t)>>> cases = {
+        {Operation::kFlipHorizontal, [&](size_t x, size_t y) { return Position{w - 1 - x, y}; }},
+        {Operation::kFlipVertical, [&](size_t x, size_t y) { return Position{x, h - 1 - y}; }},
+        {Operation::kTranspose, [&](size_t x, size_t y) { return Position{y, x}; }},
+        {Operation::kTransverse,
+         [&](size_t x, size_t y) { return Position{w - 1 - y, h - 1 - x}; }},
+        {Operation::kRotate90, [&](size_t x, size_t y) { return Position{y, h - 1 - x}; }},
+        {Operation::kRotate180,
+         [&](size_t x, size_t y) { return Position{w - 1 - x, h - 1 - y}; }},
+        {Operation::kRotate270, [&](size_t x, size_t y) { return Position{w - 1 - y, x}; }},
+    };
+
+    for (const auto& [operation, position] : cases) {
+        lossless::TransformOptions options;
+        options.operation = operation;
+        auto actual = DecodeString(TransformFile(kBasePath + "/lenna.jpg", options));
+        ExpectTransformed(source, actual, position);
+    }
+}
+
+TEST(Lossless, CropAndTrim) {
+    auto source = decode::Decode(kBasePath + "/lenna.jpg");
+
+    lossless::TransformOptions options;
+    options.crop = lossless::Crop{64, 128, 100, 60};
+    auto cropped = TransformFile(kBasePath + "/lenna.jpg", options);
+
+    auto actual = DecodeString(cropped);
+    ASSERT_EQ(actual.Width(), 100);
+    ASSERT_EQ(actual.Height(), 60);
+    ExpectTransformed(source, actual,
+                      [](size_t x, size_t y) { return std::pair{x + 64, y + 128}; });
+
+    // Mirroring drops the partial MCU column, which would otherwise end up on the left.
+    std::stringstream input(cropped), output;
+    lossless::TransformOptions flip;
+    flip.operation = lossless::Operation::kFlipHorizontal;
+    lossless::Transform(input, output, flip);
+
+    auto flipped = DecodeString(output.str());
+    ASSERT_EQ(flipped.Width(), 96);
+    ASSERT_EQ(flipped.Height(), 60);
+    ExpectTransformed(source, flipped,
+                      [](size_t x, size_t y) { return std::pair{64 + 95 - x, y + 128}; });
+
+    options.crop = lossless::Crop{4, 0, 16, 16};
+    ASSERT_THROW(TransformFile(kBasePath + "/lenna.jpg", options), std::runtime_error);
+}
+
+TEST(Incremental, RandomChunks) {
+    auto expected = decode::Decode(kBasePath + "/lenna.jpg");
+    auto file = ReadFile(kBasePath + "/lenna.jpg");
+
+    size_t next_row = 0;
+    std::vector<std::vector<RGB>> reported;
+    decode::IncrementalDecoder decoder([&](const Image& image, size_t first_row, size_t num_rows) {
+        ASSERT_EQ(first_row, next_row);
+        next_row += num_rows;
+        for (size_t y = first_row; y < first_row + num_rows; ++y) {
+            reported.emplace_back();
+            for (size_t x = 0; x < image.Width(); ++x) {
+                reported.back().push_back(image.GetPixel(y, x));
+            }
+        }
+    });
+
+    ASSERT_THROW(decoder.GetImage(), std::runtime_error);
+
+    std::mt19937 generator(7);
+    std::uniform_int_distribution<size_t> chunk_size(1, 4000);
+    size_t position = 0, rows_before_last_chunk = 0;
+    while (!decoder.IsFinished()) {
+        ASSERT_LT(position, file.size());
+        rows_before_last_chunk = next_row;
+
+        auto size = std::min(chunk_size(generator), file.size() - position);
+        decoder.Feed(std::string_view(file).substr(position, size));
+        position += size;
+    }
+
+    // Rows are reported while the data is still arriving.
+    ASSERT_GT(rows_before_last_chunk, expected.Height() / 2);
+    ASSERT_TRUE(decoder.IsFinished());
+    ASSERT_EQ(next_row, expected.Height());
+    ExpectSameImage(expected, decoder.GetImage());
+
+    for (size_t y = 0; y < expected.Height(); ++y) {
+        for (size_t x = 0; x < expected.Width(); ++x) {
+            ASSERT_EQ(expected.GetPixel(y, x).r, reported[y][x].r);
+        }
+    }
+}
+
+TEST(Incremental, HeaderByteByByte) {
+    auto file = ReadFile(kBasePath + "/lenna.jpg");
+    decode::IncrementalDecoder decoder;
+    for (size_t position = 0; position < 2000; ++position) {
+        decoder.Feed(std::string_view(file).substr(position, 1));
+    }
+    ASSERT_TRUE(decoder.Feed(std::string_view(file).substr(2000)));
+    ExpectSameImage(decode::Decode(kBasePath + "/lenna.jpg"), decoder.GetImage());
+}
+
+TEST(Incremental, Truncated) {
+    auto file = ReadFile(kBasePath + "/lenna.jpg");
+
+    size_t num_rows = 0;
+    decode::IncrementalDecoder decoder(
+        [&](const Image&, size_t, size_t rows) { num_rows += rows; });
+
+    ASSERT_FALSE(decoder.Feed(std::string_view(file).substr(0, file.size() / 2)));
+    ASSERT_FALSE(decoder.IsFinished());
+    ASSERT_GT(num_rows, 0);
+    ASSERT_LT(num_rows, decoder.GetImage().Height());
+}
+
+// APP1 payload with a little endian TIFF structure: IFD0 holds the orientation, IFD1 points at
+// the thumbnail which follows the IFDs.
+std::string MakeExifPayload(uint16_t orientation, const std::string& thumbnail) {
+    std::string payload("Exif\0\0II*\0", 10);
+    auto put = [&payload](uint32_t value, size_t num_bytes) {
+        for (size_t idx = 0; idx < num_bytes; ++idx) {
+            payload.push_back(static_cast<char>((value >> (8 * idx)) & 0xff));
+        }
+    };
+    auto put_entry = [&put](uint16_t tag, uint16_t type, uint32_t value) {
+        put(tag, 2);
+        put(type, 2);
+        put(1, 4);
+        put(value, 4);
+    };
+
+    put(8, 4);
+    put(1, 2);
+    put_entry(0x0112, 3, orientation);
+    put(26, 4);
+    put(2, 2);
+    put_entry(0x0201, 4, 56);
+    put_entry(0x0202, 4, thumbnail.size());
+    put(0, 4);
+    return payload + thumbnail;
+}
+
+TEST(Exif, Thumbnail) {
+    auto file = ReadFile(kBasePath + "/lenna.jpg");
+    ASSERT_FALSE(exif::FindThumbnail(file).has_value());
+
+    lossless::TransformOptions crop;
+    crop.crop = lossless::Crop{0, 0, 64, 48};
+    auto thumbnail = TransformFile(kBasePath + "/lenna.jpg", crop);
+
+    auto payload = MakeExifPayload(6, thumbnail);
+    std::string segment = {static_cast<char>(0xff), static_cast<char>(0xe1),
+                           static_cast<char>((payload.size() + 2) >> 8),
+                           static_cast<char>((payload.size() + 2) & 0xff)};
+    auto with_exif = file.substr(0, 2) + segment + payload + file.substr(2);
+
+    auto found = exif::FindThumbnail(with_exif);
+    ASSERT_TRUE(found.has_value());
+    ASSERT_EQ(*found, thumbnail);
+    ASSERT_GE(found->data(), with_exif.data());
+    ASSERT_LT(found->data(), with_exif.data() + with_exif.size());
+
+    auto decoded = exif::DecodeThumbnail(with_exif);
+    ASSERT_TRUE(decoded.has_value());
+    ASSERT_EQ(decoded->Width(), 64);
+    ASSERT_EQ(decoded->Height(), 48);
+    ExpectSameImage(DecodeString(thumbnail), *decoded);
+
+    // The full image still decodes with the segment in front of it.
+    ExpectSameImage(decode::Decode(kBasePath + "/lenna.jpg"), DecodeString(with_exif));
+}
+
+TEST(Exif, Orientation) {
+    auto payload = MakeExifPayload(6, "");
+    ASSERT_EQ(exif::GetOrientation(payload), 6);
+
+    exif::ResetOrientation(&payload);
+    ASSERT_EQ(exif::GetOrientation(payload), 1);
+
+    ASSERT_FALSE(exif::GetOrientation("JFIF").has_value());
+    ASSERT_FALSE(exif::GetOrientation(payload.substr(0, 20)).has_value());
+}
+
+// The file up to its EOI marker, without the segments with the given marker.
+std::string StripSegments(const std::string& jpeg, uint8_t marker) {
+    auto data = reinterpret_cast<const uint8_t*>(jpeg.data());
+    auto index = segments::SegmentIndex::Build(data, jpeg.size());
+
+    std::string stripped;
+    size_t position = 0;
+    for (const auto& segment : index.segments) {
+        if (segment.marker == marker) {
+            stripped += jpeg.substr(position, segment.offset - position);
+            position = segment.offset + 2 + segment.length;
+        }
+    }
+    return stripped + jpeg.substr(position, index.Find(0xd9)->offset + 2 - position);
+}
+
+TEST(MJPEG, StreamWithDefaultTables) {
+    auto expected = decode::Decode(kBasePath + "/lenna.jpg");
+    // Without a segment to strip, this only cuts off the data after the end of the image.
+    auto lenna = StripSegments(ReadFile(kBasePath + "/lenna.jpg"), 0);
+    // Transformed files are coded with the standard tables, so they decode without their DHT.
+    auto without_tables = StripSegments(TransformFile(kBasePath + "/lenna.jpg", {}), 0xc4);
+    ASSERT_EQ(without_tables.find("\xff\xc4"), std::string::npos);
+
+    auto stream = lenna + lenna + "\r\n--frame\r\nContent-Type: image/jpeg\r\n\r\n" +
+                  without_tables + without_tables + "\r\n--frame\r\n";
+
+    size_t num_frames = 0;
+    decode::MJPEGDecoder decoder([&](const Image& image, size_t frame_index) {
+        ASSERT_EQ(frame_index, num_frames++);
+        ExpectSameImage(expected, image);
+    });
+
+    std::mt19937 generator(11);
+    std::uniform_int_distribution<size_t> chunk_size(1, 50000);
+    for (size_t position = 0; position < stream.size();) {
+        auto size = std::min(chunk_size(generator), stream.size() - position);
+        decoder.Feed(std::string_view(stream).substr(position, size));
+        position += size;
+    }
+
+    ASSERT_EQ(num_frames, 4);
+    ASSERT_EQ(decoder.GetStats().frames, 4);
+    ASSERT_EQ(decoder.GetStats().table_parses, 2);
+}
+
+TEST(MJPEG, BrokenFrameIsDropped) {
+    auto expected = decode::Decode(kBasePath + "/lenna.jpg");
+    auto lenna = StripSegments(ReadFile(kBasePath + "/lenna.jpg"), 0);
+
+    size_t num_frames = 0;
+    decode::MJPEGDecoder decoder([&](const Image& image, size_t) {
+        ++num_frames;
+        ExpectSameImage(expected, image);
+    });
+
+    // The first frame is cut in the middle of its scan, the second one in its header, and the
+    // third has a segment length below 2. The good frame behind them is decoded all the same.
+    auto bad_length = lenna;
+    bad_length[4] = 0;
+    bad_length[5] = 1;
+    auto stream = lenna.substr(0, lenna.size() / 2) + lenna.substr(0, 100) + bad_length + lenna;
+    ASSERT_THROW(decoder.Feed(stream), std::runtime_error);
+    ASSERT_EQ(num_frames, 1);
+    ASSERT_GE(decoder.GetStats().dropped_frames, 3);
+    ASSERT_THROW(decoder.DecodeFrame(bad_length), std::runtime_error);
+
+    ASSERT_EQ(&decoder.DecodeFrame(lenna), &decoder.DecodeFrame(lenna));
+}
+
+TEST(MJPEG, FillBytesBeforeEnd) {
+    auto expected = decode::Decode(kBasePath + "/lenna.jpg");
+    auto lenna = StripSegments(ReadFile(kBasePath + "/lenna.jpg"), 0);
+    auto filled = lenna.substr(0, lenna.size() - 2) + "\xff\xff\xff\xd9";
+
+    size_t num_frames = 0;
+    decode::MJPEGDecoder decoder([&](const Image& image, size_t) {
+        ++num_frames;
+        ExpectSameImage(expected, image);
+    });
+    decoder.Feed(filled + filled);
+    ASSERT_EQ(num_frames, 2);
+    ASSERT_EQ(decoder.GetStats().dropped_frames, 0);
+}
@@ -0,0 +1,422 @@
+#include <cctype>
+#include <cstdio>
+#include <random>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "aho-corasick.h"
+#include "dynamic-automaton.h"
+#include "double-array-automaton.h"
+
+// Lowercase words of 4 to 12 letters, like the entries of a blocklist.
+std::vector<std::string> Dictionary(size_t num_words) {
+    std::mt19937 generator(1);
+    std::uniform_int_distribution<size_t> length(4, 12);
+    std::uniform_int_distribution<int> letter('a', 'z');
+
+    std::vector<std::string> words(num_words);
+    for (auto& word : words) {
+        word.resize(length(generator));
+        for (auto& character : word) {
+            character = static_cast<char>(letter(generator));
+        }
+    }
+    return words;
+}
+
+// Log-like text: printable ASCII with a dictionary word planted every hit_distance bytes.
+std::string Text(const std::vector<std::string>& words, size_t size, size_t hit_distance) {
+    std::mt19937 generator(2);
+    std::uniform_int_distribution<int> printable(' ', '~');
+    std::uniform_int_distribution<size_t> word(0, words.size() - 1);
+
+    std::string text(size, ' ');
+    for (auto& character : text) {
+        character = static_cast<char>(printable(generator));
+    }
+    for (size_t position = 0; position + 12 < size; position += hit_distance) {
+        const auto& planted = words[word(generator)];
+        text.replace(position, planted.size(), planted);
+    }
+    return text;
+}
+
+using Prefilter = aho_corasick::BuildOptions::Prefilter;
+
+std::unique_ptr<aho_corasick::Automaton> BuildAutomaton(const std::vector<std::string>& words,
+                                                        bool precompute = true,
+                                                        Prefilter prefilter = Prefilter::kAuto) {
+    aho_corasick::AutomatonBuilder builder;
+    for (size_t id = 0; id < words.size(); ++id) {
+        builder.Add(words[id], id);
+    }
+    return builder.Build({precompute, prefilter});
+}
+
+// Arguments: dictionary size, distance between planted words and whether the transitions are
+// precomputed.
+static void BM_NextPerByte(benchmark::State& state) {
+    auto words = Dictionary(state.range(0));
+    auto text = Text(words, 1 << 22, state.range(1));
+    auto automaton = BuildAutomaton(words, state.range(2));
+
+    for (auto _ : state) {
+        size_t hits = 0;
+        auto node = automaton->Root();
+        for (auto character : text) {
+            node = node.Next(character);
+            node.TraverseTerminal([&hits](size_t) { ++hits; });
+        }
+        benchmark::DoNotOptimize(hits);
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_NextPerByte)
+    ->Args({100, 4096, 1})
+    ->Args({10000, 4096, 1})
+    ->Args({10000, 64, 1})
+    ->Args({10000, 4096, 0});
+
+// Arguments: dictionary size and whether the transitions are precomputed.
+static void BM_Build(benchmark::State& state) {
+    auto words = Dictionary(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(BuildAutomaton(words, state.range(1)));
+    }
+    state.SetItemsProcessed(state.iterations() * words.size());
+
+    auto automaton = BuildAutomaton(words, state.range(1));
+    auto usage = automaton->GetMemoryUsage();
+    state.counters["states"] = automaton->NumStates();
+    state.counters["classes"] = automaton->NumClasses();
+    state.counters["transition_MiB"] = usage.transition_bytes / double(1 << 20);
+    state.counters["total_MiB"] = usage.Total() / double(1 << 20);
+}
+BENCHMARK(BM_Build)
+    ->Args({1000, 1})
+    ->Args({10000, 1})
+    ->Args({10000, 0})
+    ->Args({100000, 1})
+    ->Unit(benchmark::kMillisecond);
+
+// Arguments: dictionary size and distance between planted words.
+static void BM_Scan(benchmark::State& state) {
+    auto words = Dictionary(state.range(0));
+    auto text = Text(words, 1 << 22, state.range(1));
+    auto automaton = BuildAutomaton(words);
+
+    for (auto _ : state) {
+        size_t hits = 0;
+        automaton->Scan(text, [&hits](size_t, size_t) { ++hits; });
+        benchmark::DoNotOptimize(hits);
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_Scan)
+    ->Args({100, 4096})
+    ->Args({100, 12})
+    ->Args({10000, 4096})
+    ->Args({10000, 64})
+    ->Args({100000, 4096});
+
+static void BM_FindAll(benchmark::State& state) {
+    auto words = Dictionary(state.range(0));
+    auto text = Text(words, 1 << 22, state.range(1));
+    auto automaton = BuildAutomaton(words);
+
+    std::vector<aho_corasick::Match> matches;
+    for (auto _ : state) {
+        automaton->FindAll(text, &matches);
+        benchmark::DoNotOptimize(matches.data());
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_FindAll)
+    ->Args({100, 4096})
+    ->Args({100, 12})
+    ->Args({10000, 4096})
+    ->Args({10000, 64});
+
+// Arguments: dictionary size and number of threads.
+static void BM_FindAllParallel(benchmark::State& state) {
+    auto words = Dictionary(state.range(0));
+    auto text = Text(words, 1 << 24, 4096);
+    auto automaton = BuildAutomaton(words);
+
+    aho_corasick::Automaton::ParallelScanOptions options;
+    options.num_threads = state.range(1);
+
+    std::vector<aho_corasick::Match> matches;
+    for (auto _ : state) {
+        automaton->FindAllParallel(text, options, &matches);
+        benchmark::DoNotOptimize(matches.data());
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_FindAllParallel)
+    ->ArgsProduct({{100, 10000}, {1, 2, 4}})
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+// Arguments: dictionary size and size of the pieces fed.
+static void BM_StreamFeed(benchmark::State& state) {
+    auto words = Dictionary(state.range(0));
+    auto text = Text(words, 1 << 22, 4096);
+    auto automaton = BuildAutomaton(words);
+    const size_t piece_size = state.range(1);
+
+    for (auto _ : state) {
+        aho_corasick::StreamMatcher matcher(*automaton);
+        uint64_t checksum = 0;
+        for (size_t position = 0; position < text.size(); position += piece_size) {
+            auto piece = std::string_view(text).substr(position, piece_size);
+            matcher.Feed(piece, [&checksum](size_t, uint64_t start, uint64_t) {
+                checksum += start;
+            });
+        }
+        benchmark::DoNotOptimize(checksum);
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_StreamFeed)->ArgsProduct({{100, 10000}, {64, 65536}});
+
+// Arguments: dictionary size, distance between planted words and whether the prefilter is used.
+static void BM_ScanPrefilter(benchmark::State& state) {
+    auto words = Dictionary(state.range(0));
+    auto text = Text(words, 1 << 22, state.range(1));
+    auto automaton =
+        BuildAutomaton(words, true, state.range(2) ? Prefilter::kAlways : Prefilter::kNever);
+
+    for (auto _ : state) {
+        size_t hits = 0;
+        automaton->Scan(text, [&hits](size_t, size_t) { ++hits; });
+        benchmark::DoNotOptimize(hits);
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_ScanPrefilter)->ArgsProduct({{1, 8, 64, 1000}, {4096, 64, 12}, {0, 1}});
+
+// Arguments: dictionary size and whether the checksum is verified.
+static void BM_LoadImage(benchmark::State& state) {
+    auto path = "/tmp/bench-aho-corasick-image";
+    {
+        std::ofstream file(path, std::ios::binary);
+        BuildAutomaton(Dictionary(state.range(0)))->Save(file);
+    }
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(aho_corasick::Automaton::Load(path, state.range(1)));
+    }
+    std::remove(path);
+}
+BENCHMARK(BM_LoadImage)->ArgsProduct({{10000, 100000}, {0, 1}})->Unit(benchmark::kMillisecond);
+
+// Time to publish one added string into a dictionary of range(0) strings, compared with a full
+// rebuild of the same dictionary in BM_Build. The delta grows to 256 strings between merges.
+static void BM_DynamicAdd(benchmark::State& state) {
+    auto words = Dictionary(state.range(0) + 256);
+    aho_corasick::DynamicAutomaton::Options options;
+    options.background_merge = false;
+    aho_corasick::DynamicAutomaton automaton(options);
+    std::vector<std::pair<std::string, size_t>> base;
+    for (size_t idx = 0; idx < static_cast<size_t>(state.range(0)); ++idx) {
+        base.emplace_back(words[idx], idx);
+    }
+    automaton.Update({}, base);
+    automaton.Merge();
+
+    size_t next = state.range(0);
+    for (auto _ : state) {
+        automaton.Add(words[next], next);
+        if (++next == words.size()) {
+            state.PauseTiming();
+            automaton.Merge();
+            next = state.range(0);
+            state.ResumeTiming();
+        }
+    }
+}
+BENCHMARK(BM_DynamicAdd)->Arg(10000)->Arg(100000)->Unit(benchmark::kMicrosecond);
+
+// Scan of a snapshot with range(1) strings in the delta and range(1) removed ids.
+static void BM_DynamicScan(benchmark::State& state) {
+    auto words = Dictionary(state.range(0));
+    auto text = Text(words, 1 << 20, 64);
+
+    aho_corasick::DynamicAutomaton::Options options;
+    options.background_merge = false;
+    options.merge_threshold = std::numeric_limits<size_t>::max();
+    aho_corasick::DynamicAutomaton automaton(options);
+    const size_t num_base = words.size() - state.range(1);
+    std::vector<std::pair<std::string, size_t>> base;
+    for (size_t idx = 0; idx < num_base; ++idx) {
+        base.emplace_back(words[idx], idx);
+    }
+    automaton.Update({}, base);
+    automaton.Merge();
+    for (size_t idx = num_base; idx < words.size(); ++idx) {
+        automaton.Add(words[idx], idx);
+        automaton.Remove(idx - num_base);
+    }
+
+    auto snapshot = automaton.GetSnapshot();
+    for (auto _ : state) {
+        size_t count = 0;
+        snapshot->Scan(text, [&count](size_t, size_t) { ++count; });
+        benchmark::DoNotOptimize(count);
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_DynamicScan)->ArgsProduct({{10000}, {0, 10, 1000}});
+
+std::unique_ptr<aho_corasick::DoubleArrayAutomaton> BuildDoubleArray(
+    const std::vector<std::string>& words) {
+    aho_corasick::DoubleArrayBuilder builder;
+    for (size_t id = 0; id < words.size(); ++id) {
+        builder.Add(words[id], id);
+    }
+    return builder.Build();
+}
+
+// Memory counters to compare with those of BM_Build.
+static void BM_DoubleArrayBuild(benchmark::State& state) {
+    auto words = Dictionary(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(BuildDoubleArray(words));
+    }
+    state.SetItemsProcessed(state.iterations() * words.size());
+
+    auto automaton = BuildDoubleArray(words);
+    auto usage = automaton->GetMemoryUsage();
+    state.counters["states"] = automaton->NumStates();
+    state.counters["slots"] = automaton->NumSlots();
+    state.counters["transition_MiB"] = usage.transition_bytes / double(1 << 20);
+    state.counters["total_MiB"] = usage.Total() / double(1 << 20);
+}
+BENCHMARK(BM_DoubleArrayBuild)
+    ->Arg(1000)
+    ->Arg(10000)
+    ->Arg(100000)
+    ->Arg(1000000)
+    ->Unit(benchmark::kMillisecond);
+
+// Same arguments as BM_Scan.
+static void BM_DoubleArrayScan(benchmark::State& state) {
+    auto words = Dictionary(state.range(0));
+    auto text = Text(words, 1 << 22, state.range(1));
+    auto automaton = BuildDoubleArray(words);
+
+    for (auto _ : state) {
+        size_t hits = 0;
+        automaton->Scan(text, [&hits](size_t, size_t) { ++hits; });
+        benchmark::DoNotOptimize(hits);
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_DoubleArrayScan)
+    ->Args({100, 4096})
+    ->Args({100, 12})
+    ->Args({10000, 4096})
+    ->Args({10000, 64})
+    ->Args({100000, 4096})
+    ->Args({1000000, 4096});
+
+// Arguments: dictionary size and how case is ignored: 0 folds a copy of the text and scans it
+// with an automaton of folded strings, 1 and 2 scan the text as is with ASCII and UTF-8 folding
+// in the tables.
+static void BM_ScanCaseFolding(benchmark::State& state) {
+    using aho_corasick::CaseFolding;
+
+    auto words = Dictionary(state.range(0));
+    auto text = Text(words, 1 << 22, 4096);
+    const auto folding = state.range(1) == 2 ? CaseFolding::kUtf8 : CaseFolding::kAscii;
+
+    aho_corasick::AutomatonBuilder builder;
+    for (size_t id = 0; id < words.size(); ++id) {
+        builder.Add(words[id], id);
+    }
+    auto automaton =
+        builder.Build({true, Prefilter::kAuto, state.range(1) == 0 ? CaseFolding::kNone : folding});
+
+    for (auto _ : state) {
+        size_t hits = 0;
+        if (state.range(1) == 0) {
+            automaton->Scan(aho_corasick::FoldCase(text, CaseFolding::kAscii),
+                            [&hits](size_t, size_t) { ++hits; });
+        } else {
+            automaton->Scan(text, [&hits](size_t, size_t) { ++hits; });
+        }
+        benchmark::DoNotOptimize(hits);
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+    state.counters["states"] = automaton->NumStates();
+}
+BENCHMARK(BM_ScanCaseFolding)->ArgsProduct({{100, 10000}, {0, 1, 2}});
+
+// Arguments: dictionary size, whether the dictionary also holds every prefix of three or more
+// letters of its words, as vocabularies for tokenizing do, and match kind: 0 reports all
+// occurrences, 1 leftmost-first and 2 leftmost-longest ones. Words are planted every 12 bytes.
+static void BM_ScanMatchKind(benchmark::State& state) {
+    using aho_corasick::MatchKind;
+
+    auto words = Dictionary(state.range(0));
+    auto text = Text(words, 1 << 22, 12);
+    if (state.range(1) == 1) {
+        for (size_t idx = 0, size = words.size(); idx < size; ++idx) {
+            for (size_t length = 3; length < words[idx].size(); ++length) {
+                words.push_back(words[idx].substr(0, length));
+            }
+        }
+    }
+    const MatchKind kinds[] = {MatchKind::kAll, MatchKind::kLeftmostFirst,
+                               MatchKind::kLeftmostLongest};
+
+    aho_corasick::AutomatonBuilder builder;
+    for (size_t id = 0; id < words.size(); ++id) {
+        builder.Add(words[id], id);
+    }
+    aho_corasick::BuildOptions options;
+    options.match_kind = kinds[state.range(2)];
+    auto automaton = builder.Build(options);
+
+    size_t hits = 0;
+    for (auto _ : state) {
+        hits = 0;
+        automaton->Scan(text, [&hits](size_t, size_t) { ++hits; });
+        benchmark::DoNotOptimize(hits);
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+    state.counters["hits"] = hits;
+}
+BENCHMARK(BM_ScanMatchKind)->ArgsProduct({{100, 10000}, {0, 1}, {0, 1, 2}});
+
+// Arguments: whether a word is planted at the start of the text, which otherwise has no
+// occurrences, and whether Contains answers rather than a Scan which counts them.
+static void BM_Contains(benchmark::State& state) {
+    auto words = Dictionary(10000);
+    auto text = Text(words, 1 << 22, 1 << 22);
+    if (state.range(0) == 0) {
+        // The words are lowercase.
+        for (auto& character : text) {
+            character = static_cast<char>(std::toupper(static_cast<unsigned char>(character)));
+        }
+    }
+    auto automaton = BuildAutomaton(words);
+
+    for (auto _ : state) {
+        bool found;
+        if (state.range(1) == 1) {
+            found = automaton->Contains(text);
+        } else {
+            size_t hits = 0;
+            automaton->Scan(text, [&hits](size_t, size_t) { ++hits; });
+            found = hits > 0;
+        }
+        benchmark::DoNotOptimize(found);
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_Contains)->ArgsProduct({{0, 1}, {0, 1}});
@@ -0,0 +1,48 @@
+#include <cmath>
+#include <vector>
+#include <random>
+#include <algorithm>
+
+#include <benchmark/benchmark.h>
+
+#include "huffman.h"
+
+// Zipf distributed frequencies, as symbol statistics of real data tend to be. The tail is long
+// enough for unrestricted codes to exceed the length limits used below.
+std::vector<uint64_t> ZipfFrequencies(size_t num_symbols) {
+    std::vector<uint64_t> frequencies(num_symbols);
+    for (size_t rank = 0; rank < num_symbols; ++rank) {
+        frequencies[rank] = 1 + static_cast<uint64_t>(1e9 / std::pow(rank + 1, 1.2));
+    }
+    std::shuffle(frequencies.begin(), frequencies.end(), std::mt19937(0));
+    return frequencies;
+}
+
+// Arguments: alphabet size and code length limit.
+static void BM_LimitedCodeLengths(benchmark::State& state) {
+    auto frequencies = ZipfFrequencies(state.range(0));
+    auto max_length = static_cast<uint8_t>(state.range(1));
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(huffman::LimitedCodeLengths(frequencies, max_length));
+    }
+    state.SetItemsProcessed(state.iterations() * frequencies.size());
+}
+BENCHMARK(BM_LimitedCodeLengths)
+    ->Args({256, 16})
+    ->Args({4096, 16})
+    ->Args({4096, 24})
+    ->Args({65536, 16})
+    ->Args({65536, 32})
+    ->Args({1 << 20, 32});
+
+static void BM_BuildCanonicalTable(benchmark::State& state) {
+    auto frequencies = ZipfFrequencies(state.range(0));
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(
+            huffman::BuildCanonicalTable<uint32_t, uint32_t>(frequencies, 32, true));
+    }
+    state.SetItemsProcessed(state.iterations() * frequencies.size());
+}
+BENCHMARK(BM_BuildCanonicalTable)->Arg(256)->Arg(65536);
@@ -0,0 +1,44 @@
+#include <random>
+
+#include <benchmark/benchmark.h>
+
+#include "resample.h"
+
+// A 1080p frame of noise, the worst case for nothing but the arithmetic.
+const Image& FullHD() {
+    static const Image image = [] {
+        std::mt19937 generator(0);
+        std::uniform_int_distribution<int> value(0, 255);
+
+        Image built(1920, 1080);
+        for (size_t y = 0; y < built.Height(); ++y) {
+            for (size_t x = 0; x < built.Width(); ++x) {
+                built.SetPixel(y, x, {value(generator), value(generator), value(generator)});
+            }
+        }
+        return built;
+    }();
+    return image;
+}
+
+// Arguments: filter, output width and number of threads. The height keeps the aspect ratio.
+static void BM_Resize(benchmark::State& state) {
+    const auto& image = FullHD();
+    resample::ResizeOptions options;
+    options.filter = static_cast<resample::Filter>(state.range(0));
+    options.num_threads = state.range(2);
+
+    size_t width = state.range(1), height = width * image.Height() / image.Width();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(resample::Resize(image, width, height, options));
+    }
+    state.SetItemsProcessed(state.iterations() * image.Width() * image.Height());
+}
+BENCHMARK(BM_Resize)
+    ->ArgsProduct({{static_cast<int>(resample::Filter::kBox),
+                    static_cast<int>(resample::Filter::kBilinear),
+                    static_cast<int>(resample::Filter::kLanczos3)},
+                   {640, 320, 160},
+                   {1}})
+    ->Args({static_cast<int>(resample::Filter::kLanczos3), 320, 4})
+    ->Unit(benchmark::kMillisecond);
@@ -1,12 +1,26 @@
+#pragma once
+
 #include <map>
+#include <array>
+#include <algorithm>
+#include <limits>
+#include <functional>
+#include <memory>
+#include <optional>
 #include <vector>
 #include <string>
+#include <istream>
+#include <stdexcept>
+#include <string_view>
+#include <cstdint>
 
+#include "prefilter.h"
+#include "case-folding.h"
 #include "traverse.h"
-#include "itertools.h"
 
 namespace aho_corasick {
 
+// Trie node used while building. The built automaton does not keep these.
 struct AutomatonNode {
     AutomatonNode() : suffix_link(nullptr), terminal_link(nullptr) {
     }
@@ -16,104 +30,596 @@ struct AutomatonNode {
     // Stores tree structure of nodes.
     std::map<char, AutomatonNode> trie_transitions;
 
-    std::map<char, AutomatonNode *> automaton_transitions_cache;
     AutomatonNode *suffix_link;
     AutomatonNode *terminal_link;
 };
 
 AutomatonNode *GetTrieTransition(AutomatonNode *node, char character);
 
-AutomatonNode *GetAutomatonTransition(AutomatonNode *node, const AutomatonNode *root,
-                                      char character);
+class Automaton;
+class AutomatonBuilder;
+
+template <class AutomatonType>
+class BasicNodeReference;
 
+using NodeReference = BasicNodeReference<Automaton>;
 
+namespace internal {
 
-class NodeReference {
+// Read-only array which either owns its elements or refers to memory owned elsewhere, e.g. a
+// mapped image.
+template <class T>
+class Array {
 public:
-    NodeReference() : node_(nullptr), root_(nullptr) {
+    void Assign(std::vector<T> values) {
+        owned_ = std::move(values);
+        data_ = owned_.data();
+        size_ = owned_.size();
+    }
+
+    void Refer(const T *data, size_t size) {
+        owned_ = {};
+        data_ = data;
+        size_ = size;
+    }
+
+    const T &operator[](size_t idx) const {
+        return data_[idx];
+    }
+
+    const T *data() const {
+        return data_;
     }
 
-    NodeReference(AutomatonNode *node, AutomatonNode *root) : node_(node), root_(root) {
+    size_t size() const {
+        return size_;
     }
 
-    NodeReference Next(char character) const;
+    const T *begin() const {
+        return data_;
+    }
+
+    const T *end() const {
+        return data_ + size_;
+    }
 
+private:
+    std::vector<T> owned_;
+    const T *data_ = nullptr;
+    size_t size_ = 0;
+};
+
+}  // namespace internal
+
+struct Match {
+    size_t pattern_id;
+    // Offset one past the last byte of the match.
+    size_t end;
+
+    bool operator==(const Match &other) const {
+        return pattern_id == other.pattern_id && end == other.end;
+    }
+};
+
+// Which occurrences a scan reports.
+enum class MatchKind {
+    // Every occurrence of every string, overlapping ones included.
+    kAll,
+    // Non-overlapping occurrences from left to right. Of the strings occurring at the leftmost
+    // position, the one added first is reported and the scan resumes where it ends.
+    kLeftmostFirst,
+    // Same as kLeftmostFirst, but the longest string occurring at the leftmost position is
+    // reported, the one added first among equal ones.
+    kLeftmostLongest,
+};
+
+// The trie compiled into flat arrays indexed by 32-bit state ids, the root being state 0 and
+// the other states numbered in breadth-first order. Bytes are first mapped to classes: every byte
+// which occurs in the strings has a class of its own and all the others share one, as they act
+// alike in every state. Transitions form a dense table with a row per state and a column per
+// class, so a step is two indexed loads once the entry is known. Entries which are not trie
+// edges are filled in by the builder unless precomputation is disabled, in which case they are
+// resolved through the suffix links on every step. A built automaton is never modified, so any
+// number of threads may match with it at once.
+class Automaton {
+public:
+    using StateId = uint32_t;
+
+    static constexpr StateId kRoot = 0;
+    static constexpr StateId kNoState = std::numeric_limits<StateId>::max();
+
+    Automaton() = default;
+
+    Automaton(const Automaton &) = delete;
+    Automaton &operator=(const Automaton &) = delete;
+
+    NodeReference Root() const;
+
+    size_t NumStates() const {
+        return suffix_links_.size();
+    }
+
+    size_t NumClasses() const {
+        return num_classes_;
+    }
+
+    MatchKind GetMatchKind() const {
+        return match_kind_;
+    }
+
+    StateId Next(StateId state, char character) const {
+        auto byte_class = classes_[static_cast<uint8_t>(character)];
+        auto target = transitions_[RowStart(state) + byte_class];
+        if (target == kNoState) {
+            return ResolveTransition(state, byte_class);
+        }
+        return target;
+    }
+
+    struct MemoryUsage {
+        size_t transition_bytes = 0;
+        // Links, match outputs and the class map.
+        size_t other_bytes = 0;
+
+        size_t Total() const {
+            return transition_bytes + other_bytes;
+        }
+    };
+
+    MemoryUsage GetMemoryUsage() const;
+
+    // Writes the automaton as a binary image which FromImage and Load use in place. The arrays
+    // are stored in the byte order of the host at 64-byte aligned offsets from the start, after
+    // a header with a version and a checksum of everything that follows it.
+    void Save(std::ostream &stream) const;
+
+    // Automaton whose arrays refer into the image, which has to stay valid and 8-byte aligned;
+    // owner, if given, is kept alive for that. Nothing is parsed or copied beyond the header.
+    // The checksum is verified unless verify_checksum is false, which avoids touching every page
+    // but leaves the image to be trusted.
+    static std::unique_ptr<Automaton> FromImage(std::string_view image,
+                                                std::shared_ptr<const void> owner = nullptr,
+                                                bool verify_checksum = true);
+
+    // Maps the image file read-only, so processes loading the same file share its pages. The
+    // kernel is advised of random access, so it neither reads far ahead nor drops pages early.
+    static std::unique_ptr<Automaton> Load(const std::string &path, bool verify_checksum = true);
+
+    bool HasPrefilter() const {
+        return prefilter_.has_value();
+    }
+
+    // Length of the longest string, in bytes.
+    size_t MaxLength() const {
+        return max_length_;
+    }
+
+    // Calls on_match(pattern_id, end) for every occurrence of every string in the text, ordered
+    // by end and, for the same end, from the longest string to the shortest. Leftmost match kinds
+    // report their occurrences instead, in order. An empty string occurs at the leftmost
+    // position only if nothing longer does, and the scan then resumes a byte further.
     template <class Callback>
-    void TraverseTerminal(Callback on_hit) const {
-        for (auto string_id : TerminatedStringIds()) {
-            on_hit(string_id);
+    void Scan(std::string_view text, Callback on_match) const {
+        if (match_kind_ == MatchKind::kAll) {
+            ScanRange(text, 0, text.size(), on_match);
+            return;
+        }
+
+        Match match;
+        for (size_t position = 0; position <= text.size() && FindLeftmost(text, position, &match);
+             position = std::max(match.end, position + 1)) {
+            on_match(match.pattern_id, match.end);
+        }
+    }
+
+    // Same as Scan, restricted to the occurrences whose last byte lies in [begin, end). The scan
+    // starts MaxLength() - 1 bytes before begin, which is enough to reach the state a scan from
+    // the start of the text would be in, so the occurrences are exactly those Scan reports.
+    // Requires MatchKind::kAll, as leftmost occurrences depend on all the text before them.
+    template <class Callback>
+    void ScanRange(std::string_view text, size_t begin, size_t end, Callback on_match) const {
+        RequireAllMatches("ScanRange");
+        size_t position = begin - std::min(begin, std::max<size_t>(max_length_, 1) - 1);
+        StateId state = kRoot;
+        for (; position < begin; ++position) {
+            state = Next(state, text[position]);
+        }
+
+        Run(state, text.substr(begin, end - begin), [&](StateId output, size_t offset) {
+            ForEachOutput(output, [&](size_t pattern_id, size_t) {
+                on_match(pattern_id, begin + offset + 1);
+            });
+        });
+    }
+
+    // Replaces the contents of matches with the occurrences Scan reports, in the same order.
+    // Reusing the vector between calls saves its allocations.
+    void FindAll(std::string_view text, std::vector<Match> *matches) const;
+
+    // Whether Scan reports any occurrence. Stops at the first byte which completes one, without
+    // looking for the leftmost or longest.
+    bool Contains(std::string_view text) const;
+
+    // First occurrence Scan reports, if any. The scan stops there with MatchKind::kAll, and at
+    // the byte which rules out anything further left or longer with the leftmost kinds.
+    std::optional<Match> FindFirst(std::string_view text) const;
+
+    struct ParallelScanOptions {
+        // 0 uses one thread per core.
+        size_t num_threads = 0;
+        // Chunk chunk_idx holds the occurrences whose last byte lies in
+        // [chunk_idx * chunk_size, (chunk_idx + 1) * chunk_size).
+        size_t chunk_size = 1 << 20;
+    };
+
+    using OnChunk = std::function<void(size_t chunk_idx, const std::vector<Match> &matches)>;
+
+    // Splits the text into chunks which the threads scan with ScanRange, each chunk overlapping
+    // the previous one by MaxLength() - 1 bytes. on_chunk is called once per chunk, from the
+    // threads and in no particular order, so it has to be thread-safe. An exception it throws
+    // stops the scan and is rethrown. Requires MatchKind::kAll.
+    void ScanChunks(std::string_view text, const ParallelScanOptions &options,
+                    const OnChunk &on_chunk) const;
+
+    // FindAll over chunks scanned in parallel, the result being identical to that of FindAll.
+    // Requires MatchKind::kAll.
+    void FindAllParallel(std::string_view text, const ParallelScanOptions &options,
+                         std::vector<Match> *matches) const;
+
+private:
+    static constexpr size_t kAlphabetSize = 256;
+
+    StateId ResolveTransition(StateId state, uint8_t byte_class) const;
+
+    void RequireAllMatches(const char *operation) const {
+        if (match_kind_ != MatchKind::kAll) {
+            throw std::runtime_error(std::string(operation) + " requires MatchKind::kAll");
+        }
+    }
+
+    // Whether the state terminates a string itself, not through its terminal link.
+    bool Terminates(StateId state) const {
+        return terminated_begin_[state] != terminated_begin_[state + 1];
+    }
+
+    size_t RowStart(StateId state) const {
+        return static_cast<size_t>(state) << row_shift_;
+    }
+
+    // Steps through the text from state and calls on_output(state, offset) after each byte which
+    // leads to a state with matches. Returns the last state.
+    template <class Callback>
+    StateId Run(StateId state, std::string_view text, Callback on_output) const {
+        auto report = [&on_output](StateId output, size_t offset) {
+            on_output(output, offset);
+            return true;
+        };
+        size_t offset = 0;
+        if (prefilter_.has_value()) {
+            return Walk<true>(state, text, &offset, kNoState, report);
         }
+        return Walk<false>(state, text, &offset, kNoState, report);
+    }
 
-        AutomatonNode *current = node_;
-        while (current->terminal_link != nullptr) {
-            current = current->terminal_link;
-            for (auto string_id : current->terminated_string_ids) {
-                on_hit(string_id);
+    // The step loop of every scan. Steps through the text from state and offset, calling
+    // on_output(state, offset) after each byte which leads to a state with matches, until it
+    // returns false or the walk reaches stop_state. Returns the last state, with offset at the
+    // byte which led there, or at the end of the text.
+    //
+    // With the prefilter, bytes are skipped while at the root up to the next position where a
+    // string may start. No occurrence starts in between, so none is missed, and as the root
+    // holds no partial match the state at the candidate is the root again.
+    template <bool kFiltered, class Callback>
+    StateId Walk(StateId state, std::string_view text, size_t *offset, StateId stop_state,
+                 Callback on_output) const {
+        // Local copies, as the compiler cannot keep the members in registers across the calls.
+        const auto *classes = classes_.data();
+        const auto *transitions = transitions_.data();
+        const auto *has_output = has_output_.data();
+        const auto row_shift = row_shift_;
+
+        size_t position = *offset;
+        for (; position < text.size(); ++position) {
+            if constexpr (kFiltered) {
+                if (state == kRoot) {
+                    position = prefilter_->Find(text, position);
+                    if (position == text.size()) {
+                        break;
+                    }
+                }
+            }
+
+            auto byte_class = classes[static_cast<uint8_t>(text[position])];
+            auto target = transitions[(static_cast<size_t>(state) << row_shift) + byte_class];
+            state = target != kNoState ? target : ResolveTransition(state, byte_class);
+            if (has_output[state]) {
+                if (!on_output(state, position)) {
+                    break;
+                }
+            } else if (state == stop_state) {
+                break;
             }
         }
+        *offset = position;
+        return state;
     }
 
-    bool IsTerminal() const {
-        return !node_->terminated_string_ids.empty();
+    // Steps from the root up to the first byte which leads to a state with matches, returning
+    // that state and setting offset to one past the byte, or returning kNoState at the end.
+    template <bool kFiltered>
+    StateId RunToOutput(std::string_view text, size_t *offset) const;
+
+    // Searches the text from position for the leftmost occurrence of the match kind. The
+    // transitions of a leftmost automaton lead to the dead state once the occurrence last seen
+    // can be neither extended nor preceded, so the search stops there.
+    bool FindLeftmost(std::string_view text, size_t position, Match *match) const;
+
+    template <bool kFiltered>
+    bool FindLeftmost(std::string_view text, size_t position, Match *match) const;
+
+    // The string ForEachOutput reports first, for a state with matches.
+    Match FirstOutput(StateId state, size_t end) const {
+        if (terminated_begin_[state] == terminated_begin_[state + 1]) {
+            state = terminal_links_[state];
+        }
+        return {terminated_ids_[terminated_begin_[state]], end};
     }
 
-    explicit operator bool() const {
-        return node_ != nullptr;
+    // Calls report(pattern_id, length) for every string recognized at the state, from the
+    // longest to the shortest.
+    template <class Callback>
+    void ForEachOutput(StateId state, Callback report) const {
+        for (; state != kNoState; state = terminal_links_[state]) {
+            for (auto idx = terminated_begin_[state]; idx < terminated_begin_[state + 1]; ++idx) {
+                report(terminated_ids_[idx], depths_[state]);
+            }
+        }
     }
 
-    bool operator==(NodeReference other) const {
-        return node_ == other.node_;
+    internal::Array<uint8_t> classes_;
+    size_t num_classes_ = 1;
+    // Rows are padded to a power of two entries so that finding one takes a shift rather than a
+    // multiplication, which would lengthen the dependency chain from one step to the next.
+    size_t row_shift_ = 0;
+    internal::Array<StateId> transitions_;
+    internal::Array<StateId> suffix_links_;
+    // Closest state along the suffix links which terminates a string, kNoState if none.
+    internal::Array<StateId> terminal_links_;
+    // Ids of the strings terminated at state s are terminated_ids_[terminated_begin_[s]] up to
+    // terminated_ids_[terminated_begin_[s + 1]].
+    internal::Array<uint32_t> terminated_begin_;
+    internal::Array<uint64_t> terminated_ids_;
+    // Whether a state terminates a string itself or through its terminal link, so that states
+    // without matches cost a single load while scanning.
+    internal::Array<uint8_t> has_output_;
+    // Length of the string spelled by the trie path to each state.
+    internal::Array<uint32_t> depths_;
+    std::optional<PrefixFilter> prefilter_;
+    size_t max_length_ = 0;
+    MatchKind match_kind_ = MatchKind::kAll;
+    // State which ends a leftmost search, kNoState with MatchKind::kAll. Its row leads to itself.
+    StateId dead_state_ = kNoState;
+    // Keeps the image the arrays refer to alive.
+    std::shared_ptr<const void> image_owner_;
+
+    template <class AutomatonType>
+    friend class BasicNodeReference;
+    template <class AutomatonType>
+    friend class BasicStreamMatcher;
+    friend class DynamicSnapshot;
+    friend class AutomatonBuilder;
+};
+
+namespace internal {
+
+// Fills matches, empty when called, with the occurrences whose last byte lies in [begin, end).
+using ScanChunk = std::function<void(size_t begin, size_t end, std::vector<Match> *matches)>;
+
+// Scans a chunk with ScanRange.
+template <class AutomatonType>
+ScanChunk ChunkScanner(const AutomatonType &automaton, std::string_view text) {
+    return [&automaton, text](size_t begin, size_t end, std::vector<Match> *matches) {
+        automaton.ScanRange(text, begin, end, [matches](size_t pattern_id, size_t match_end) {
+            matches->push_back({pattern_id, match_end});
+        });
+    };
+}
+
+// The chunked scans behind Automaton::ScanChunks and FindAllParallel, for any automaton.
+void ScanChunks(std::string_view text, const Automaton::ParallelScanOptions &options,
+                const ScanChunk &scan, const Automaton::OnChunk &on_chunk);
+
+void FindAllParallel(std::string_view text, const Automaton::ParallelScanOptions &options,
+                     const ScanChunk &scan, std::vector<Match> *matches);
+
+}  // namespace internal
+
+// A state of an automaton, for walking it byte by byte. AutomatonType is Automaton or
+// DoubleArrayAutomaton.
+template <class AutomatonType>
+class BasicNodeReference {
+public:
+    using StateId = typename AutomatonType::StateId;
+
+    BasicNodeReference() : automaton_(nullptr), state_(AutomatonType::kNoState) {
     }
 
-private:
-    using IDsRange = itertools::IteratorRange<std::vector<size_t>::const_iterator>;
+    BasicNodeReference(const AutomatonType *automaton, StateId state)
+        : automaton_(automaton), state_(state) {
+    }
 
-    NodeReference TerminalLink() const {
-        return {node_->terminal_link, root_};
+    BasicNodeReference Next(char character) const {
+        return {automaton_, automaton_->Next(state_, character)};
     }
 
-    IDsRange TerminatedStringIds() const {
-        return {node_->terminated_string_ids.cbegin(), node_->terminated_string_ids.cend()};
+    // Calls on_hit(string_id) for every string recognized at the node, from the longest to the
+    // shortest.
+    template <class Callback>
+    void TraverseTerminal(Callback on_hit) const {
+        automaton_->ForEachOutput(state_, [&](size_t string_id, size_t) { on_hit(string_id); });
     }
 
-    AutomatonNode *node_;
-    AutomatonNode *root_;
+    // Whether a string ends at the node itself, rather than only a suffix of it.
+    bool IsTerminal() const {
+        return automaton_->Terminates(state_);
+    }
+
+    explicit operator bool() const {
+        return automaton_ != nullptr && state_ != AutomatonType::kNoState;
+    }
+
+    bool operator==(BasicNodeReference other) const {
+        return automaton_ == other.automaton_ && state_ == other.state_;
+    }
+
+private:
+    const AutomatonType *automaton_;
+    StateId state_;
 };
 
-class AutomatonBuilder;
+inline NodeReference Automaton::Root() const {
+    return {this, kRoot};
+}
 
-class Automaton {
+// Matches a stream which arrives in pieces, e.g. reads from a pipe or a socket. The state and the
+// number of bytes consumed are kept between the pieces, so occurrences which span two pieces are
+// found and all offsets count from the start of the stream. The pieces are scanned where they
+// are, without being copied. AutomatonType is Automaton or DoubleArrayAutomaton.
+template <class AutomatonType>
+class BasicStreamMatcher {
 public:
-    Automaton() = default;
+    using StateId = typename AutomatonType::StateId;
 
-    Automaton(const Automaton &) = delete;
-    Automaton &operator=(const Automaton &) = delete;
+    // Requires MatchKind::kAll.
+    explicit BasicStreamMatcher(const AutomatonType &automaton) : automaton_(&automaton) {
+        automaton.RequireAllMatches("StreamMatcher");
+    }
 
-    NodeReference Root() {
-        return {&root_, &root_};
+    // Calls on_match(pattern_id, start, end) for every occurrence which ends in the piece, start
+    // and end being the offsets of its first byte and one past its last one.
+    template <class Callback>
+    void Feed(std::string_view piece, Callback on_match) {
+        state_ = automaton_->Run(state_, piece, [&](StateId output, size_t offset) {
+            uint64_t end = offset_ + offset + 1;
+            automaton_->ForEachOutput(output, [&](size_t pattern_id, size_t length) {
+                on_match(pattern_id, end - length, end);
+            });
+        });
+        offset_ += piece.size();
+    }
+
+    // Feeds the rest of the stream, read into a buffer of buffer_size bytes at a time.
+    template <class Callback>
+    void Feed(std::istream &stream, Callback on_match, size_t buffer_size = 1 << 16) {
+        std::vector<char> buffer(buffer_size);
+        while (true) {
+            auto size = stream.rdbuf()->sgetn(buffer.data(), buffer.size());
+            if (size <= 0) {
+                break;
+            }
+            Feed(std::string_view(buffer.data(), size), on_match);
+        }
+    }
+
+    // Bytes fed since construction or the last Reset.
+    uint64_t Offset() const {
+        return offset_;
+    }
+
+    void Reset() {
+        state_ = AutomatonType::kRoot;
+        offset_ = 0;
     }
 
 private:
-    AutomatonNode root_;
+    const AutomatonType *automaton_;
+    StateId state_ = AutomatonType::kRoot;
+    uint64_t offset_ = 0;
+};
 
-    friend class AutomatonBuilder;
+using StreamMatcher = BasicStreamMatcher<Automaton>;
+
+struct BuildOptions {
+    // Fills every entry of the transition table during the build, in breadth-first order from
+    // the entries of the suffix links. Without it the build is slightly faster, but each step off
+    // the trie edges walks the suffix links.
+    bool precompute_transitions = true;
+
+    enum class Prefilter {
+        // Used for at most kAutoPrefilterStrings strings, where candidates are rare enough for
+        // the skipped bytes to pay for the calls.
+        kAuto,
+        kAlways,
+        kNever,
+    };
+    static constexpr size_t kAutoPrefilterStrings = 64;
+
+    // Skips the bytes where no string can start with a PrefixFilter in front of the automaton.
+    // Sets containing the empty string never use one.
+    Prefilter prefilter = Prefilter::kAuto;
+
+    // Matches every string in the text with the characters replaced by their foldings as well.
+    // The strings are folded and the byte classes and transitions are made to act on any text
+    // as on its folding, so the text is scanned as is, without a folded copy. ASCII folding
+    // only merges byte classes. UTF-8 folding adds states which hold a lead byte until the
+    // next byte tells the character, and always precomputes the transitions.
+    CaseFolding case_folding = CaseFolding::kNone;
+
+    // With the leftmost kinds, every state which terminates a string gets a dead state as its
+    // suffix link, so the states below it and the transitions leaving them lead there rather
+    // than to occurrences starting further right. Scans thus find the leftmost occurrences
+    // without visiting the others. kLeftmostFirst also leaves out the strings whose trie path
+    // goes through a node terminating another one, as those are never reported. Transitions
+    // are always precomputed.
+    MatchKind match_kind = MatchKind::kAll;
 };
 
 class AutomatonBuilder {
 public:
     void Add(const std::string &string, size_t id);
 
-    std::unique_ptr<Automaton> Build();
+    std::unique_ptr<Automaton> Build(const BuildOptions &options = {});
 
 private:
     static void BuildTrie(const std::vector<std::string> &words, const std::vector<size_t> &ids,
-                          Automaton *automaton);
-
-    static void AddString(AutomatonNode *root, size_t string_id, const std::string &string);
-
-    static void BuildSuffixLinks(Automaton *automaton);
-
-    static void BuildTerminalLinks(Automaton *automaton);
+                          MatchKind match_kind, AutomatonNode *root);
+
+    // Skips the string if stop_at_terminal and its path goes through a node which terminates
+    // another string.
+    static void AddString(AutomatonNode *root, size_t string_id, const std::string &string,
+                          bool stop_at_terminal);
+
+    static void BuildSuffixLinks(AutomatonNode *root);
+
+    static void BuildTerminalLinks(AutomatonNode *root);
+
+    // Numbers the trie nodes and copies them into the flat arrays of the automaton.
+    static void Compile(AutomatonNode *root, const BuildOptions &options, Automaton *automaton);
+
+    static void PrecomputeTransitions(const std::vector<Automaton::StateId> &suffix_links,
+                                      size_t num_classes, size_t row_shift,
+                                      std::vector<Automaton::StateId> *transitions);
+
+    // Replaces the suffix links, terminal links and outputs of the trie states by those of a
+    // leftmost automaton and appends its dead state, returning that. The transitions have to
+    // hold just the trie edges and the loops of the root.
+    static Automaton::StateId AddDeadState(size_t num_classes, size_t row_shift,
+                                           std::vector<Automaton::StateId> *transitions,
+                                           std::vector<Automaton::StateId> *suffix_links,
+                                           std::vector<Automaton::StateId> *terminal_links,
+                                           std::vector<uint32_t> *terminated_begin,
+                                           std::vector<uint8_t> *has_output,
+                                           std::vector<uint32_t> *depths);
+
+    // Appends the states which UTF-8 case folding needs to the complete transition table and
+    // the arrays of the other state properties.
+    static void AddFoldingStates(const std::vector<internal::Utf8Folding> &foldings,
+                                 const std::vector<uint8_t> &classes, size_t row_shift,
+                                 std::vector<Automaton::StateId> *transitions,
+                                 std::vector<Automaton::StateId> *suffix_links,
+                                 std::vector<Automaton::StateId> *terminal_links,
+                                 std::vector<uint32_t> *terminated_begin,
+                                 std::vector<uint8_t> *has_output, std::vector<uint32_t> *depths);
 
     std::vector<std::string> words_;
     std::vector<size_t> ids_;
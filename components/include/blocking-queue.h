@@ -0,0 +1,61 @@
+#pragma once
+
+#include <mutex>
+#include <queue>
+#include <optional>
+#include <condition_variable>
+
+namespace concurrency {
+
+template <class T>
+class BlockingQueue {
+public:
+    explicit BlockingQueue(size_t capacity) : capacity_(capacity) {
+    }
+
+    // Blocks while the queue is full. Returns false if the queue was closed.
+    bool Push(T value) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this] { return closed_ || queue_.size() < capacity_; });
+
+        if (closed_) {
+            return false;
+        }
+
+        queue_.push(std::move(value));
+        not_empty_.notify_one();
+        return true;
+    }
+
+    // Blocks while the queue is empty. Returns nullopt once the queue is closed and drained.
+    std::optional<T> Pop() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this] { return closed_ || !queue_.empty(); });
+
+        if (queue_.empty()) {
+            return std::nullopt;
+        }
+
+        T value = std::move(queue_.front());
+        queue_.pop();
+        not_full_.notify_one();
+        return value;
+    }
+
+    void Close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+
+private:
+    size_t capacity_;
+    bool closed_ = false;
+
+    std::queue<T> queue_;
+    std::mutex mutex_;
+    std::condition_variable not_empty_, not_full_;
+};
+
+}  // namespace concurrency
@@ -1,7 +1,13 @@
 #pragma once
 
+#include <array>
+#include <string>
 #include <istream>
+#include <vector>
+#include <cstdint>
 #include <optional>
+#include <streambuf>
+#include <stdexcept>
 
 namespace byte_streams {
 
@@ -47,16 +53,205 @@ private:
     bool staffing_ = true;
 };
 
-class ByteStream : public Stream<std::uint8_t> {
+// Reads from the buffer of the stream directly, without the sentry and state updates of
+// istream::read. The class is final and the single byte read is defined here, so the calls of
+// the segment parsers are resolved statically and inlined.
+class ByteStream final : public Stream<std::uint8_t> {
 public:
     ByteStream(std::istream& stream);
 
-    std::uint8_t Yield() override;
+    std::uint8_t Yield() override {
+        if (finished_) {
+            throw std::runtime_error("yielding from closed stream");
+        }
+
+        auto read = buffer_->sbumpc();
+        if (read == std::char_traits<char>::eof()) {
+            MarkFinished();
+            return 0;
+        }
+        return static_cast<std::uint8_t>(read);
+    }
+
+    // Reads exactly size bytes. Throws if the stream ends before.
+    void ReadInto(std::uint8_t* data, size_t size);
+
+    void ReadInto(char* data, size_t size) {
+        ReadInto(reinterpret_cast<std::uint8_t*>(data), size);
+    }
+
+    void Skip(size_t num_bytes);
+
+    // Unsigned integer stored most significant byte first.
+    template <class T>
+    T ReadBE() {
+        std::array<std::uint8_t, sizeof(T)> bytes;
+        ReadInto(bytes.data(), bytes.size());
+
+        T value = 0;
+        for (auto byte : bytes) {
+            value = static_cast<T>(value << 8) | byte;
+        }
+        return value;
+    }
+
+private:
+    void MarkFinished();
+
+    std::streambuf* buffer_;
 };
 
-uint16_t ComposeNBitsBE(uint8_t n, BitStream& stream);
+// Read-only view of a caller-owned byte range, so in-memory files can be parsed by the stream
+// based readers without copying them into a std::stringstream.
+class MemoryStreamBuf : public std::streambuf {
+public:
+    MemoryStreamBuf(const char* data, size_t size);
+
+protected:
+    pos_type seekoff(off_type offset, std::ios_base::seekdir dir,
+                     std::ios_base::openmode which) override;
+
+    pos_type seekpos(pos_type position, std::ios_base::openmode which) override;
+};
+
+class MemoryStream : public std::istream {
+public:
+    MemoryStream(const char* data, size_t size);
+
+private:
+    MemoryStreamBuf buffer_;
+};
+
+// Reads bits MSB first from a byte range which is already unstuffed. Unlike BitStream it can
+// seek to an arbitrary bit, which lets several readers work on one buffer independently.
+class BufferBitStream {
+public:
+    BufferBitStream(const std::uint8_t* data, size_t size)
+        : data_(data), size_(size), num_bits_(8 * size) {
+    }
+
+    // Bits past the end of the buffer read as zeros.
+    bool Yield() {
+        if (position_ >= num_bits_) {
+            ++position_;
+            return false;
+        }
+        bool read = (data_[position_ >> 3] >> (7 - (position_ & 7))) & 1;
+        ++position_;
+        return read;
+    }
+
+    // The next num_bits bits, 1 to 24, MSB first, without consuming them.
+    uint32_t Peek(uint8_t num_bits) const {
+        size_t byte = position_ >> 3;
+        uint32_t word = 0;
+        if (byte + 4 <= size_) {
+            word = (uint32_t(data_[byte]) << 24) | (uint32_t(data_[byte + 1]) << 16) |
+                   (uint32_t(data_[byte + 2]) << 8) | data_[byte + 3];
+        } else {
+            for (size_t idx = byte; idx < byte + 4; ++idx) {
+                word = (word << 8) | (idx < size_ ? data_[idx] : 0);
+            }
+        }
+        return (word << (position_ & 7)) >> (32 - num_bits);
+    }
+
+    void Skip(size_t num_bits) {
+        position_ += num_bits;
+    }
+
+    // Reads num_bits bits, at most 24, as an unsigned number MSB first.
+    uint32_t Read(uint8_t num_bits) {
+        if (num_bits == 0) {
+            return 0;
+        }
+        auto read = Peek(num_bits);
+        position_ += num_bits;
+        return read;
+    }
 
-uint16_t ComposeNBitsLE(uint8_t n, BitStream& stream);
+    bool IsFinished() const {
+        return position_ >= num_bits_;
+    }
+
+    size_t Position() const {
+        return position_;
+    }
+
+    void Seek(size_t bit_position) {
+        position_ = bit_position;
+    }
+
+private:
+    const std::uint8_t* data_;
+    size_t size_;
+    size_t num_bits_;
+    size_t position_ = 0;
+};
+
+// Writes bits MSB first, inserting a zero byte after every 0xff the way entropy-coded JPEG
+// data is stuffed.
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<std::uint8_t>* output) : output_(output) {
+    }
+
+    // Writes the num_bits low bits of bits, at most 32 at a time.
+    void Write(uint32_t bits, uint8_t num_bits) {
+        accumulator_ = (accumulator_ << num_bits) | (bits & ((uint64_t(1) << num_bits) - 1));
+        num_accumulated_ += num_bits;
+
+        while (num_accumulated_ >= 8) {
+            num_accumulated_ -= 8;
+            auto byte = static_cast<std::uint8_t>(accumulator_ >> num_accumulated_);
+            output_->push_back(byte);
+            if (byte == 0xff) {
+                output_->push_back(0x00);
+            }
+        }
+    }
+
+    // Pads the last partial byte with ones.
+    void Flush() {
+        if (num_accumulated_ > 0) {
+            Write(0xff, 8 - num_accumulated_);
+        }
+    }
+
+private:
+    std::vector<std::uint8_t>* output_;
+    uint64_t accumulator_ = 0;
+    uint8_t num_accumulated_ = 0;
+};
+
+// Reads an entropy-coded segment up to the next marker, removing the stuffed zero bytes, and
+// leaves the stream positioned at the marker, the same way BitStream does.
+std::vector<std::uint8_t> ReadStuffedSegment(std::istream& stream);
+
+template <class Bits>
+uint16_t ComposeNBitsBE(uint8_t n, Bits& stream) {
+    uint16_t returned = 0;
+
+    for (uint16_t i = 0; i < n; ++i) {
+        auto bit = static_cast<uint8_t>(stream.Yield());
+        returned |= (bit << i);
+    }
+
+    return returned;
+}
+
+template <class Bits>
+uint16_t ComposeNBitsLE(uint8_t n, Bits& stream) {
+    uint16_t returned = 0;
+
+    for (uint8_t i = 0; i < n; ++i) {
+        auto bit = static_cast<uint8_t>(stream.Yield());
+        returned <<= 1;
+        returned += static_cast<uint8_t>(bit);
+    }
+
+    return returned;
+}
 
 std::pair<std::uint8_t, std::uint8_t> SplitByte(uint8_t to_split);
 
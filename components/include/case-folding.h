@@ -0,0 +1,39 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <string_view>
+
+namespace aho_corasick {
+
+enum class CaseFolding {
+    kNone,
+    // A to Z match a to z.
+    kAscii,
+    // ASCII folding plus the simple case folding of Unicode for the two-byte UTF-8 characters of
+    // Latin-1 Supplement, Latin Extended-A, Greek and Cyrillic, e.g. "É" matches "é" and "Σ"
+    // matches "σ" and "ς". Foldings which change the length in bytes, such as that of U+017F to
+    // "s", are left out, so that offsets are the same in the text and in its folding.
+    kUtf8,
+};
+
+// Copy of the text with every character replaced by its folding. Invalid UTF-8 sequences are
+// copied unchanged.
+std::string FoldCase(std::string_view text, CaseFolding folding);
+
+namespace internal {
+
+struct Utf8Folding {
+    // UTF-8 bytes of a character and of its folding.
+    std::array<uint8_t, 2> from;
+    std::array<uint8_t, 2> to;
+};
+
+// Every two-byte character which kUtf8 folds to another one, ordered by the character.
+const std::vector<Utf8Folding> &Utf8Foldings();
+
+}  // namespace internal
+
+}  // namespace aho_corasick
@@ -0,0 +1,206 @@
+#pragma once
+
+#include "aho-corasick.h"
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+namespace aho_corasick {
+
+class DoubleArrayAutomaton;
+class DoubleArrayBuilder;
+
+using DoubleArrayNodeReference = BasicNodeReference<DoubleArrayAutomaton>;
+using DoubleArrayStreamMatcher = BasicStreamMatcher<DoubleArrayAutomaton>;
+
+// The trie stored as a double array, for dictionaries whose dense transition table would not fit
+// into memory. The child of state s by byte c is slot base[s] + c if check of that slot is s,
+// so a state costs four 32-bit words whatever the alphabet: base, check, suffix link and output.
+// Steps which leave the trie walk the suffix links, trading some speed for the table.
+//
+// The matching API is that of Automaton, so either can back a dictionary: Root, Scan, FindAll,
+// Contains, FindFirst, the parallel scans and DoubleArrayStreamMatcher behave the same and report
+// matches in the same order. Only MatchKind::kAll is supported, and the builder takes no
+// BuildOptions, images being left out too: case folding, prefilters and leftmost matching rely
+// on the dense table.
+class DoubleArrayAutomaton {
+public:
+    using StateId = uint32_t;
+    using ParallelScanOptions = Automaton::ParallelScanOptions;
+    using OnChunk = Automaton::OnChunk;
+
+    static constexpr StateId kRoot = 0;
+    static constexpr StateId kNoState = std::numeric_limits<StateId>::max();
+
+    DoubleArrayAutomaton() = default;
+
+    DoubleArrayAutomaton(const DoubleArrayAutomaton &) = delete;
+    DoubleArrayAutomaton &operator=(const DoubleArrayAutomaton &) = delete;
+
+    DoubleArrayNodeReference Root() const;
+
+    size_t NumStates() const {
+        return num_states_;
+    }
+
+    // Slots of the double array, the states and the free slots between them.
+    size_t NumSlots() const {
+        return check_.size();
+    }
+
+    StateId Next(StateId state, char character) const {
+        return Step(base_.data(), check_.data(), suffix_links_.data(), state,
+                    static_cast<uint8_t>(character));
+    }
+
+    // transition_bytes counts the base and check arrays.
+    Automaton::MemoryUsage GetMemoryUsage() const;
+
+    MatchKind GetMatchKind() const {
+        return MatchKind::kAll;
+    }
+
+    size_t MaxLength() const {
+        return max_length_;
+    }
+
+    // Same as Automaton::Scan.
+    template <class Callback>
+    void Scan(std::string_view text, Callback on_match) const {
+        ScanRange(text, 0, text.size(), on_match);
+    }
+
+    // Same as Automaton::ScanRange.
+    template <class Callback>
+    void ScanRange(std::string_view text, size_t begin, size_t end, Callback on_match) const {
+        size_t position = begin - std::min(begin, std::max<size_t>(max_length_, 1) - 1);
+        StateId state = kRoot;
+        for (; position < begin; ++position) {
+            state = Next(state, text[position]);
+        }
+
+        Run(state, text.substr(begin, end - begin), [&](StateId output, size_t offset) {
+            ForEachOutput(output, [&](size_t pattern_id, size_t) {
+                on_match(pattern_id, begin + offset + 1);
+            });
+        });
+    }
+
+    // Same as Automaton::FindAll.
+    void FindAll(std::string_view text, std::vector<Match> *matches) const;
+
+    // Same as Automaton::Contains.
+    bool Contains(std::string_view text) const;
+
+    // Same as Automaton::FindFirst.
+    std::optional<Match> FindFirst(std::string_view text) const;
+
+    // Same as Automaton::ScanChunks.
+    void ScanChunks(std::string_view text, const ParallelScanOptions &options,
+                    const OnChunk &on_chunk) const;
+
+    // Same as Automaton::FindAllParallel.
+    void FindAllParallel(std::string_view text, const ParallelScanOptions &options,
+                         std::vector<Match> *matches) const;
+
+private:
+    static constexpr uint32_t kNoOutput = std::numeric_limits<uint32_t>::max();
+
+    // Every scan reports all matches.
+    void RequireAllMatches(const char *) const {
+    }
+
+    // A state which terminates no string shares the output list of its suffix link.
+    bool Terminates(StateId state) const {
+        return outputs_[state] != kNoOutput &&
+               (state == kRoot || outputs_[state] != outputs_[suffix_links_[state]]);
+    }
+
+    // Steps through the text from state and calls on_output(state, offset) after each byte which
+    // leads to a state with matches. Returns the last state.
+    template <class Callback>
+    StateId Run(StateId state, std::string_view text, Callback on_output) const {
+        // Local copies, for the same reason as in Automaton::Walk.
+        const auto *base = base_.data();
+        const auto *check = check_.data();
+        const auto *suffix_links = suffix_links_.data();
+        const auto *outputs = outputs_.data();
+
+        for (size_t offset = 0; offset < text.size(); ++offset) {
+            state = Step(base, check, suffix_links, state, static_cast<uint8_t>(text[offset]));
+            if (outputs[state] != kNoOutput) {
+                on_output(state, offset);
+            }
+        }
+        return state;
+    }
+
+    // Calls report(pattern_id, length) for every string recognized at the state, from the
+    // longest to the shortest.
+    template <class Callback>
+    void ForEachOutput(StateId state, Callback report) const {
+        for (auto idx = outputs_[state]; idx != kNoOutput; idx = output_links_[idx]) {
+            report(output_ids_[idx], output_lengths_[idx]);
+        }
+    }
+
+    static StateId Step(const StateId *base, const StateId *check, const StateId *suffix_links,
+                        StateId state, uint8_t byte) {
+        while (true) {
+            StateId child = base[state] + byte;
+            if (check[child] == state) {
+                return child;
+            }
+            if (state == kRoot) {
+                return kRoot;
+            }
+            state = suffix_links[state];
+        }
+    }
+
+    // Indexed by slot. Free slots have check kNoState, which no state equals, and the array has
+    // 256 slots beyond the last base so that base + byte never needs a bounds check.
+    std::vector<StateId> base_;
+    std::vector<StateId> check_;
+    std::vector<StateId> suffix_links_;
+    // First entry of the list of strings recognized at the slot, kNoOutput if none.
+    std::vector<uint32_t> outputs_;
+
+    // Entries of the output lists. The strings terminated at a state are consecutive entries,
+    // the last of which links to the list of the suffix link, so every list runs from the
+    // longest string to the shortest.
+    std::vector<uint64_t> output_ids_;
+    std::vector<uint32_t> output_links_;
+    std::vector<uint32_t> output_lengths_;
+
+    size_t num_states_ = 0;
+    size_t max_length_ = 0;
+
+    template <class AutomatonType>
+    friend class BasicNodeReference;
+    template <class AutomatonType>
+    friend class BasicStreamMatcher;
+    friend class DoubleArrayBuilder;
+};
+
+inline DoubleArrayNodeReference DoubleArrayAutomaton::Root() const {
+    return {this, kRoot};
+}
+
+// Builds a DoubleArrayAutomaton from the sorted strings directly, without the trie of per-node
+// maps AutomatonBuilder goes through, which takes far more memory than either automaton.
+class DoubleArrayBuilder {
+public:
+    void Add(const std::string &string, size_t id);
+
+    std::unique_ptr<DoubleArrayAutomaton> Build() const;
+
+private:
+    std::vector<std::string> words_;
+    std::vector<size_t> ids_;
+};
+
+}  // namespace aho_corasick
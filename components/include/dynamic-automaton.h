@@ -0,0 +1,158 @@
+#pragma once
+
+#include "aho-corasick.h"
+
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace aho_corasick {
+
+// Immutable view of a DynamicAutomaton: a base automaton, ids removed from it, and a small delta
+// automaton with the strings added since the base was built.
+class DynamicSnapshot {
+public:
+    DynamicSnapshot(std::shared_ptr<const Automaton> base, std::shared_ptr<const Automaton> delta,
+                    std::shared_ptr<const std::unordered_set<size_t>> removed)
+        : base_(std::move(base)), delta_(std::move(delta)), removed_(std::move(removed)) {
+    }
+
+    // Same as Automaton::Scan over the live strings, except that at the same end the matches of
+    // the base come before those of the delta.
+    template <class Callback>
+    void Scan(std::string_view text, Callback on_match) const {
+        if (delta_->NumStates() == 1 && removed_->empty()) {
+            base_->Scan(text, on_match);
+            return;
+        }
+
+        auto report_base = [&](size_t pattern_id, size_t end) {
+            if (removed_->count(pattern_id) == 0) {
+                on_match(pattern_id, end);
+            }
+        };
+        auto base_state = Automaton::kRoot, delta_state = Automaton::kRoot;
+        for (size_t position = 0; position < text.size(); ++position) {
+            base_state = base_->Next(base_state, text[position]);
+            delta_state = delta_->Next(delta_state, text[position]);
+            if (base_->has_output_[base_state]) {
+                base_->ForEachOutput(base_state, [&](size_t pattern_id, size_t) {
+                    report_base(pattern_id, position + 1);
+                });
+            }
+            if (delta_->has_output_[delta_state]) {
+                delta_->ForEachOutput(delta_state, [&](size_t pattern_id, size_t) {
+                    on_match(pattern_id, position + 1);
+                });
+            }
+        }
+    }
+
+    void FindAll(std::string_view text, std::vector<Match> *matches) const;
+
+private:
+    std::shared_ptr<const Automaton> base_, delta_;
+    std::shared_ptr<const std::unordered_set<size_t>> removed_;
+};
+
+// Automaton whose strings can be added and removed while it is in use. Changes rebuild only the
+// delta automaton, and removals from the base are filtered out when reporting. Once the delta
+// holds merge_threshold strings, a new base with all the live strings is built in the
+// background. Each change publishes a new snapshot, and scans on older snapshots go on
+// undisturbed, so readers are never blocked.
+class DynamicAutomaton {
+public:
+    struct Options {
+        // The match kind has to be MatchKind::kAll.
+        BuildOptions build;
+        size_t merge_threshold = 1024;
+        // Merges on the calling thread when false.
+        bool background_merge = true;
+        // Builds the base from the merged strings, with AutomatonBuilder if empty. Lets tests
+        // make a merge fail.
+        std::function<std::shared_ptr<const Automaton>(
+            const std::vector<std::pair<std::string, size_t>> &strings,
+            const BuildOptions &options)>
+            build_base;
+    };
+
+    DynamicAutomaton();
+    explicit DynamicAutomaton(Options options);
+    ~DynamicAutomaton();
+
+    DynamicAutomaton(const DynamicAutomaton &) = delete;
+    DynamicAutomaton &operator=(const DynamicAutomaton &) = delete;
+
+    void Add(const std::string &string, size_t id);
+
+    // Removes every string added with the id.
+    void Remove(size_t id);
+
+    // Removes the ids, then adds the strings, rebuilding the delta once for the whole batch.
+    void Update(const std::vector<size_t> &removed_ids,
+                const std::vector<std::pair<std::string, size_t>> &added);
+
+    // Folds the delta into the base and waits until it is done. If the build of the base fails,
+    // the strings stay in the delta and the error is thrown, by the next Merge or Update for a
+    // background merge.
+    void Merge();
+
+    // Current snapshot. Never blocks on writers.
+    std::shared_ptr<const DynamicSnapshot> GetSnapshot() const;
+
+    struct Stats {
+        size_t base_strings = 0;
+        size_t delta_strings = 0;
+        size_t removed_ids = 0;
+        size_t merges = 0;
+    };
+
+    Stats GetStats() const;
+
+private:
+    using Strings = std::vector<std::pair<std::string, size_t>>;
+
+    enum class ChangeKind { kAdd, kRemove };
+
+    struct Change {
+        ChangeKind kind;
+        std::string string;
+        size_t id;
+    };
+
+    void Apply(const Change &change);
+    void RebuildDelta();
+    void Publish();
+    bool NeedsMerge() const;
+    void StartMerge(std::unique_lock<std::mutex> *lock);
+    void FinishMerge(Strings strings, std::shared_ptr<const Automaton> base);
+    void AbortMerge(std::exception_ptr error);
+    void RethrowMergeError();
+
+    Options options_;
+
+    mutable std::mutex mutex_;
+    std::shared_ptr<const DynamicSnapshot> snapshot_;
+
+    std::shared_ptr<const Automaton> base_;
+    Strings base_strings_;
+    std::unordered_map<size_t, size_t> base_id_counts_;
+    std::unordered_set<size_t> removed_;
+    Strings delta_strings_;
+    std::shared_ptr<const Automaton> delta_;
+
+    bool merging_ = false;
+    std::condition_variable merged_;
+    // Changes since the running merge took its copy of the strings, replayed onto its result.
+    std::vector<Change> changes_during_merge_;
+    std::thread merge_thread_;
+    // Failure of the last background merge, not reported yet.
+    std::exception_ptr merge_error_;
+    size_t merges_ = 0;
+};
+
+}  // namespace aho_corasick
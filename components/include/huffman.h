@@ -1,8 +1,14 @@
 #pragma once
 
+#include <array>
+#include <limits>
 #include <vector>
 #include <memory>
+#include <numeric>
+#include <algorithm>
 #include <optional>
+#include <cstdint>
+#include <stdexcept>
 
 namespace huffman {
 
@@ -88,4 +94,265 @@ struct HuffmanTree {
     std::shared_ptr<HuffmanNode<ValueType>> root = nullptr;
 };
 
+// Table driven decoder for the canonical codes FromSequence describes. Codes of up to
+// kLookupBits bits are resolved with a single lookup, longer ones by comparing against the
+// largest code of each length.
+template <class ValueType = std::uint8_t>
+class LookupDecoder {
+public:
+    static constexpr uint8_t kLookupBits = 9;
+    static constexpr uint8_t kMaxLength = 16;
+
+    template <class ShapeType>
+    static LookupDecoder FromSequence(const std::vector<ShapeType> &per_level,
+                                      const std::vector<ValueType> &values) {
+        LookupDecoder decoder;
+        decoder.values_ = values;
+        decoder.lookup_.resize(1 << kLookupBits);
+        decoder.max_code_.fill(-1);
+
+        int32_t code = 0;
+        uint16_t index = 0;
+        for (uint8_t length = 1; length <= kMaxLength; ++length) {
+            size_t count = length <= per_level.size() ? per_level[length - 1] : 0;
+            if (index + count > values.size()) {
+                throw std::runtime_error("huffman tree build failed");
+            }
+            // Codes past the last one of the length would fill entries beyond the table.
+            if (code + count > (size_t(1) << length)) {
+                throw std::runtime_error("huffman code assignment failed");
+            }
+
+            decoder.first_code_[length] = code;
+            decoder.first_index_[length] = index;
+            if (count > 0) {
+                decoder.max_code_[length] = code + count - 1;
+            }
+
+            for (size_t inner = 0; inner < count; ++inner, ++code, ++index) {
+                if (length <= kLookupBits) {
+                    uint8_t shift = kLookupBits - length;
+                    for (int32_t entry = code << shift; entry < (code + 1) << shift; ++entry) {
+                        decoder.lookup_[entry] = {values[index], length};
+                    }
+                }
+            }
+            code <<= 1;
+        }
+        return decoder;
+    }
+
+    // Bits has to provide Peek(n), the next n bits MSB first without consuming them, and
+    // Skip(n).
+    template <class Bits>
+    ValueType Decode(Bits &bits) const {
+        const auto &entry = lookup_[bits.Peek(kLookupBits)];
+        if (entry.length != 0) {
+            bits.Skip(entry.length);
+            return entry.value;
+        }
+
+        int32_t code = bits.Peek(kMaxLength);
+        for (uint8_t length = kLookupBits + 1; length <= kMaxLength; ++length) {
+            int32_t prefix = code >> (kMaxLength - length);
+            if (prefix <= max_code_[length]) {
+                bits.Skip(length);
+                return values_[first_index_[length] + prefix - first_code_[length]];
+            }
+        }
+        throw std::runtime_error("error getting huffman code");
+    }
+
+private:
+    struct Entry {
+        ValueType value = 0;
+        // 0 for prefixes of longer codes and for bits which start no code.
+        uint8_t length = 0;
+    };
+
+    std::vector<Entry> lookup_;
+    std::vector<ValueType> values_;
+    std::array<int32_t, kMaxLength + 1> max_code_, first_code_;
+    std::array<uint16_t, kMaxLength + 1> first_index_;
+};
+
+// Code of a single value, right aligned in bits.
+struct Code {
+    uint16_t bits = 0;
+    uint8_t length = 0;
+};
+
+// Assigns the canonical codes (JPEG Annex C) which FromSequence builds its tree from, for
+// encoding. The result is indexed by value, values without a code have length 0.
+template <class ShapeType = std::uint8_t, class ValueType = std::uint8_t>
+std::vector<Code> CanonicalCodes(const std::vector<ShapeType> &per_level,
+                                 const std::vector<ValueType> &values) {
+    std::vector<Code> codes;
+    uint32_t code = 0;
+
+    auto value_it = values.begin();
+    for (size_t level_idx = 0; level_idx < per_level.size(); ++level_idx) {
+        for (ShapeType inner = 0; inner < per_level[level_idx]; ++inner) {
+            if (value_it == values.end() || code >= (1u << (level_idx + 1))) {
+                throw std::runtime_error("huffman code assignment failed");
+            }
+
+            size_t value = *value_it++;
+            if (codes.size() <= value) {
+                codes.resize(value + 1);
+            }
+            codes[value] = {static_cast<uint16_t>(code), static_cast<uint8_t>(level_idx + 1)};
+            ++code;
+        }
+        code <<= 1;
+    }
+
+    return codes;
+}
+
+// Optimal prefix code lengths for the given symbol frequencies with no code longer than
+// max_length bits, computed with the package-merge algorithm in O(n * max_length). Symbols of
+// zero frequency get no code, i.e. length 0. A lone symbol gets a one bit code.
+inline std::vector<uint8_t> LimitedCodeLengths(const std::vector<uint64_t> &frequencies,
+                                               uint8_t max_length) {
+    std::vector<size_t> symbols;
+    for (size_t symbol = 0; symbol < frequencies.size(); ++symbol) {
+        if (frequencies[symbol] > 0) {
+            symbols.push_back(symbol);
+        }
+    }
+    // Among equal frequencies the later symbol sorts first and so gets the longer code.
+    std::sort(symbols.begin(), symbols.end(), [&](size_t lhs, size_t rhs) {
+        if (frequencies[lhs] != frequencies[rhs]) {
+            return frequencies[lhs] < frequencies[rhs];
+        }
+        return lhs > rhs;
+    });
+
+    std::vector<uint8_t> lengths(frequencies.size(), 0);
+    if (symbols.size() == 1) {
+        lengths[symbols[0]] = 1;
+    }
+    if (symbols.size() < 2) {
+        return lengths;
+    }
+
+    if (max_length >= 64 || (uint64_t(1) << max_length) < symbols.size()) {
+        if (max_length < 64) {
+            throw std::runtime_error("too many symbols for the code length limit");
+        }
+        max_length = 63;
+    }
+
+    std::vector<uint64_t> leaf_weights(symbols.size());
+    for (size_t leaf = 0; leaf < symbols.size(); ++leaf) {
+        leaf_weights[leaf] = frequencies[symbols[leaf]];
+    }
+
+    // Each list holds the leaves merged with the packages of the previous list by weight.
+    // Leaves keep their order in every list, so a list is fully described by which of its
+    // items are packages. Likewise the packages among the first k items of a list are made of
+    // a prefix of the previous list.
+    std::vector<std::vector<bool>> is_package(max_length);
+    std::vector<uint64_t> weights, merged_weights;
+
+    for (uint8_t level = 0; level < max_length; ++level) {
+        auto &list = is_package[level];
+        merged_weights.clear();
+        merged_weights.reserve(leaf_weights.size() + weights.size() / 2);
+        list.reserve(leaf_weights.size() + weights.size() / 2);
+
+        size_t leaf = 0, package = 0, num_packages = weights.size() / 2;
+        while (leaf < leaf_weights.size() || package < num_packages) {
+            uint64_t package_weight = 0;
+            if (package < num_packages) {
+                package_weight = weights[2 * package] + weights[2 * package + 1];
+            }
+
+            if (package == num_packages ||
+                (leaf < leaf_weights.size() && leaf_weights[leaf] <= package_weight)) {
+                list.push_back(false);
+                merged_weights.push_back(leaf_weights[leaf++]);
+            } else {
+                list.push_back(true);
+                merged_weights.push_back(package_weight);
+                ++package;
+            }
+        }
+        std::swap(weights, merged_weights);
+    }
+
+    // The 2n - 2 lightest items of the last list make the code. Every appearance of a leaf in
+    // the selection, directly or inside a package, adds a bit to its length. The leaves which
+    // appear in a list's selection are the lightest ones.
+    std::vector<uint8_t> sorted_lengths(symbols.size(), 0);
+    size_t num_selected = 2 * symbols.size() - 2;
+    for (size_t level = max_length; level-- > 0 && num_selected > 0;) {
+        size_t num_packages = 0;
+        for (size_t idx = 0; idx < num_selected; ++idx) {
+            num_packages += is_package[level][idx];
+        }
+        for (size_t leaf = 0; leaf < num_selected - num_packages; ++leaf) {
+            ++sorted_lengths[leaf];
+        }
+        num_selected = 2 * num_packages;
+    }
+
+    for (size_t leaf = 0; leaf < symbols.size(); ++leaf) {
+        lengths[symbols[leaf]] = sorted_lengths[leaf];
+    }
+    return lengths;
+}
+
+// Counts of codes per length and the values in code order: the form FromSequence takes and
+// JPEG stores in a DHT segment.
+template <class ShapeType = std::uint8_t, class ValueType = std::uint8_t>
+struct CanonicalTable {
+    std::vector<ShapeType> per_level;
+    std::vector<ValueType> values;
+};
+
+// Orders the values by code length, ties by value, which is how canonical codes are assigned.
+template <class ShapeType = std::uint8_t, class ValueType = std::uint8_t>
+CanonicalTable<ShapeType, ValueType> TableFromLengths(const std::vector<uint8_t> &lengths,
+                                                      uint8_t max_length) {
+    CanonicalTable<ShapeType, ValueType> table;
+    table.per_level.assign(max_length, 0);
+
+    for (uint8_t length = 1; length <= max_length; ++length) {
+        for (size_t value = 0; value < lengths.size(); ++value) {
+            if (lengths[value] != length) {
+                continue;
+            }
+            if (table.per_level[length - 1] == std::numeric_limits<ShapeType>::max()) {
+                throw std::runtime_error("too many codes of one length");
+            }
+            ++table.per_level[length - 1];
+            table.values.push_back(static_cast<ValueType>(value));
+        }
+    }
+    return table;
+}
+
+// Builds an optimal length-limited canonical table for the frequencies, indexed by value. With
+// reserve_all_ones no value gets the code made of ones only, which JPEG forbids: a dummy value
+// of the lowest weight takes it and is dropped afterwards.
+template <class ShapeType = std::uint8_t, class ValueType = std::uint8_t>
+CanonicalTable<ShapeType, ValueType> BuildCanonicalTable(std::vector<uint64_t> frequencies,
+                                                         uint8_t max_length,
+                                                         bool reserve_all_ones = false) {
+    if (reserve_all_ones) {
+        frequencies.push_back(1);
+    }
+
+    auto lengths = LimitedCodeLengths(frequencies, max_length);
+
+    if (reserve_all_ones) {
+        // Being the last value of the lowest frequency the dummy has one of the longest codes
+        // and, as ties are ordered by value, the last of them, which is all ones.
+        lengths.pop_back();
+    }
+    return TableFromLengths<ShapeType, ValueType>(lengths, max_length);
+}
+
 }  // namespace huffman
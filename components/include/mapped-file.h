@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <string_view>
+
+namespace byte_streams {
+
+// Read-only mapping of a whole file. Pages are loaded by the kernel as they are touched, so a
+// file can be scanned in place, without reading it into a buffer, whatever its size.
+class MappedFile {
+public:
+    // How the pages will be read, passed on to the kernel with madvise.
+    enum class Access {
+        // Front to back once, e.g. text being scanned: reads ahead further and drops the pages
+        // soon after.
+        kSequential,
+        // At random, e.g. lookup tables: no read-ahead beyond the faulting page.
+        kRandom,
+        // At random, but all of the file soon: starts reading it in the background.
+        kWillNeed,
+    };
+
+    explicit MappedFile(const std::string& path, Access access = Access::kSequential);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    std::string_view View() const {
+        return {data_, size_};
+    }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+}  // namespace byte_streams
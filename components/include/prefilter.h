@@ -0,0 +1,53 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <string_view>
+
+namespace aho_corasick {
+
+// Finds the positions where one of a set of strings may start, in the spirit of the Teddy
+// algorithm. The strings are spread over 8 buckets, those sharing a prefix in the same one, and
+// for each of the first Length() bytes a bucket bit is set under the low and under the high
+// nibble of the byte the strings of the bucket have there. A position is a candidate when some
+// bucket bit survives the AND of the nibble masks of the bytes which follow it. With SSSE3 or
+// AVX2 a shuffle looks the masks up for 16 or 32 positions at once.
+//
+// There are no false negatives: every position where a string starts is a candidate, and so is
+// any position too close to the end of the text to be checked completely.
+class PrefixFilter {
+public:
+    static constexpr size_t kMaxLength = 3;
+
+    struct Masks {
+        std::array<uint8_t, 16> low = {};
+        std::array<uint8_t, 16> high = {};
+    };
+
+    // The strings must not be empty.
+    explicit PrefixFilter(const std::vector<std::string>& strings);
+
+    // Filter with the masks of another one, e.g. read back from a saved image.
+    PrefixFilter(size_t length, const std::array<Masks, kMaxLength>& masks);
+
+    // First candidate at or after begin, text.size() if there is none.
+    size_t Find(std::string_view text, size_t begin) const;
+
+    // Number of bytes checked at each position, the length of the shortest string up to
+    // kMaxLength.
+    size_t Length() const {
+        return length_;
+    }
+
+    const std::array<Masks, kMaxLength>& GetMasks() const {
+        return masks_;
+    }
+
+private:
+    size_t length_ = 0;
+    std::array<Masks, kMaxLength> masks_;
+};
+
+}  // namespace aho_corasick
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "rgb-image.h"
+
+#include <cstddef>
+
+namespace resample {
+
+enum class Filter {
+    // Average of the pixels each output pixel covers.
+    kBox,
+    // Triangle filter, linear interpolation when upscaling.
+    kBilinear,
+    // Windowed sinc with three lobes, the sharpest of the three.
+    kLanczos3,
+};
+
+struct ResizeOptions {
+    Filter filter = Filter::kLanczos3;
+    // Threads which share the rows of each pass. 0 and 1 resize on the calling thread.
+    size_t num_threads = 1;
+    // Uses the SSE2 and AVX2 passes where the CPU has them. The scalar passes give identical
+    // results, so turning this off is only meant for testing them.
+    bool use_simd = true;
+};
+
+// Resizes with a separable filter: a horizontal pass over the input rows, then a vertical pass
+// over the result. The filter taps of every output column and row are computed once per call.
+// When downscaling, the filter is widened by the scale factor so that every input pixel
+// contributes.
+Image Resize(const Image& image, size_t width, size_t height, const ResizeOptions& options = {});
+
+// Largest size which fits into max_width x max_height with the aspect ratio of the image.
+// Images which already fit are copied unchanged.
+Image Thumbnail(const Image& image, size_t max_width, size_t max_height,
+                const ResizeOptions& options = {});
+
+}  // namespace resample
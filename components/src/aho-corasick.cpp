@@ -1,5 +1,12 @@
 #include "aho-corasick.h"
 
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <exception>
+#include <stdexcept>
+#include <unordered_map>
+
 namespace aho_corasick {
 
 AutomatonNode *GetTrieTransition(AutomatonNode *node, char character) {
@@ -10,30 +17,6 @@ AutomatonNode *GetTrieTransition(AutomatonNode *node, char character) {
     return nullptr;
 }
 
-AutomatonNode *GetAutomatonTransition(AutomatonNode *node, const AutomatonNode *root,
-                                      char character) {
-    auto found = node->automaton_transitions_cache.find(character);
-    if (found != node->automaton_transitions_cache.end()) {
-        return found->second;
-    }
-    AutomatonNode *trie_trans = GetTrieTransition(node, character);
-    if (trie_trans != nullptr) {
-        node->automaton_transitions_cache[character] = trie_trans;
-        return trie_trans;
-    }
-    auto *current = node;
-    while (current != root) {
-        current = current->suffix_link;
-        auto *child = GetTrieTransition(current, character);
-        if (child != nullptr) {
-            node->automaton_transitions_cache[character] = child;
-            return child;
-        }
-    }
-    node->automaton_transitions_cache[character] = nullptr;
-    return nullptr;
-}
-
 namespace internal {
 
 class AutomatonGraph {
@@ -119,14 +102,276 @@ private:
     AutomatonNode *root_;
 };
 
+// Records the nodes in breadth-first order, which becomes the order of the state ids.
+class NodeOrderRecorder : public traverses::BfsVisitor<AutomatonNode *, AutomatonGraph::Edge> {
+public:
+    explicit NodeOrderRecorder(std::vector<AutomatonNode *> *order) : order_(order) {
+    }
+
+    void DiscoverVertex(AutomatonNode *node) override {
+        order_->push_back(node);
+    }
+
+private:
+    std::vector<AutomatonNode *> *order_;
+};
+
+}  // namespace internal
+
+namespace {
+
+// Calls function(thread_idx, task) for every task, spreading them over the threads, the calling
+// one included. The first exception stops the remaining tasks and is rethrown once the threads
+// have finished.
+template <class Function>
+void RunParallel(size_t num_threads, size_t num_tasks, Function function) {
+    std::atomic<size_t> next_task = 0;
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    auto work = [&](size_t thread_idx) {
+        for (size_t task = next_task++; task < num_tasks; task = next_task++) {
+            try {
+                function(thread_idx, task);
+            } catch (...) {
+                std::lock_guard lock(error_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                next_task = num_tasks;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t thread_idx = 1; thread_idx < num_threads; ++thread_idx) {
+        threads.emplace_back(work, thread_idx);
+    }
+    work(0);
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+size_t NumChunks(std::string_view text, const Automaton::ParallelScanOptions &options) {
+    if (options.chunk_size == 0) {
+        throw std::runtime_error("chunk size must be positive");
+    }
+    return (text.size() + options.chunk_size - 1) / options.chunk_size;
+}
+
+size_t NumThreads(const Automaton::ParallelScanOptions &options, size_t num_chunks) {
+    size_t num_threads = options.num_threads;
+    if (num_threads == 0) {
+        num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    return std::max<size_t>(std::min(num_threads, num_chunks), 1);
+}
+
+// The folded strings cut to the bytes a PrefixFilter reads, with those bytes in every
+// combination of case, as the filter sees the text unfolded.
+std::vector<std::string> PrefilterStrings(const std::vector<std::string> &words,
+                                          CaseFolding folding) {
+    if (folding == CaseFolding::kNone) {
+        return words;
+    }
+
+    std::map<std::array<uint8_t, 2>, std::vector<std::array<uint8_t, 2>>> variants;
+    if (folding == CaseFolding::kUtf8) {
+        for (const auto &utf8_folding : internal::Utf8Foldings()) {
+            variants[utf8_folding.to].push_back(utf8_folding.from);
+        }
+    }
+
+    std::vector<std::string> strings;
+    for (const auto &word : words) {
+        // A two-byte character may start at the last byte the filter reads.
+        std::vector<std::string> prefixes = {word.substr(0, PrefixFilter::kMaxLength + 1)};
+        for (size_t idx = 0; idx < PrefixFilter::kMaxLength && idx < word.size(); ++idx) {
+            auto byte = static_cast<uint8_t>(word[idx]);
+            auto size = prefixes.size();
+            if (byte >= 'a' && byte <= 'z') {
+                for (size_t prefix = 0; prefix < size; ++prefix) {
+                    prefixes.push_back(prefixes[prefix]);
+                    prefixes.back()[idx] = static_cast<char>(byte - ('a' - 'A'));
+                }
+                continue;
+            }
+
+            auto found = idx + 1 < word.size()
+                             ? variants.find({byte, static_cast<uint8_t>(word[idx + 1])})
+                             : variants.end();
+            if (found == variants.end()) {
+                continue;
+            }
+            for (const auto &variant : found->second) {
+                for (size_t prefix = 0; prefix < size; ++prefix) {
+                    prefixes.push_back(prefixes[prefix]);
+                    prefixes.back()[idx] = static_cast<char>(variant[0]);
+                    prefixes.back()[idx + 1] = static_cast<char>(variant[1]);
+                }
+            }
+            ++idx;
+        }
+        strings.insert(strings.end(), prefixes.begin(), prefixes.end());
+    }
+
+    std::sort(strings.begin(), strings.end());
+    strings.erase(std::unique(strings.begin(), strings.end()), strings.end());
+    return strings;
+}
+
+}  // namespace
+
+namespace internal {
+
+void ScanChunks(std::string_view text, const Automaton::ParallelScanOptions &options,
+                const ScanChunk &scan, const Automaton::OnChunk &on_chunk) {
+    const size_t num_chunks = NumChunks(text, options);
+    const size_t num_threads = NumThreads(options, num_chunks);
+
+    std::vector<std::vector<Match>> matches(num_threads);
+    RunParallel(num_threads, num_chunks, [&](size_t thread_idx, size_t chunk_idx) {
+        auto &found = matches[thread_idx];
+        found.clear();
+
+        size_t begin = chunk_idx * options.chunk_size;
+        scan(begin, std::min(begin + options.chunk_size, text.size()), &found);
+        on_chunk(chunk_idx, found);
+    });
+}
+
+void FindAllParallel(std::string_view text, const Automaton::ParallelScanOptions &options,
+                     const ScanChunk &scan, std::vector<Match> *matches) {
+    const size_t num_chunks = NumChunks(text, options);
+
+    std::vector<std::vector<Match>> chunks(num_chunks);
+    RunParallel(NumThreads(options, num_chunks), num_chunks, [&](size_t, size_t chunk_idx) {
+        size_t begin = chunk_idx * options.chunk_size;
+        scan(begin, std::min(begin + options.chunk_size, text.size()), &chunks[chunk_idx]);
+    });
+
+    matches->clear();
+    for (const auto &chunk : chunks) {
+        matches->insert(matches->end(), chunk.begin(), chunk.end());
+    }
+}
+
 }  // namespace internal
 
-NodeReference NodeReference::Next(char character) const {
-    AutomatonNode *transition = GetAutomatonTransition(node_, root_, character);
-    if (transition == nullptr) {
-        return {root_, root_};
+Automaton::StateId Automaton::ResolveTransition(StateId state, uint8_t byte_class) const {
+    // The entry equals the one of the suffix link unless that is unknown too. The row of the
+    // root is complete, so the walk ends there at the latest.
+    auto current = suffix_links_[state];
+    while (transitions_[RowStart(current) + byte_class] == kNoState) {
+        current = suffix_links_[current];
+    }
+    return transitions_[RowStart(current) + byte_class];
+}
+
+Automaton::MemoryUsage Automaton::GetMemoryUsage() const {
+    MemoryUsage usage;
+    usage.transition_bytes = transitions_.size() * sizeof(StateId);
+    usage.other_bytes = classes_.size() + suffix_links_.size() * sizeof(StateId) +
+                        terminal_links_.size() * sizeof(StateId) +
+                        terminated_begin_.size() * sizeof(uint32_t) +
+                        terminated_ids_.size() * sizeof(uint64_t) + has_output_.size() +
+                        depths_.size() * sizeof(uint32_t);
+    return usage;
+}
+
+void Automaton::FindAll(std::string_view text, std::vector<Match> *matches) const {
+    matches->clear();
+    Scan(text, [matches](size_t pattern_id, size_t end) {
+        matches->push_back({pattern_id, end});
+    });
+}
+
+template <bool kFiltered>
+Automaton::StateId Automaton::RunToOutput(std::string_view text, size_t *offset) const {
+    bool found = false;
+    size_t position = 0;
+    auto state = Walk<kFiltered>(kRoot, text, &position, kNoState, [&found](StateId, size_t) {
+        found = true;
+        return false;
+    });
+    if (!found) {
+        return kNoState;
+    }
+    *offset = position + 1;
+    return state;
+}
+
+bool Automaton::Contains(std::string_view text) const {
+    // Leftmost scans report the empty string at the start of any text, the others after each
+    // byte.
+    if (has_output_[kRoot]) {
+        return match_kind_ != MatchKind::kAll || !text.empty();
+    }
+    size_t end;
+    if (prefilter_.has_value()) {
+        return RunToOutput<true>(text, &end) != kNoState;
+    }
+    return RunToOutput<false>(text, &end) != kNoState;
+}
+
+std::optional<Match> Automaton::FindFirst(std::string_view text) const {
+    if (match_kind_ != MatchKind::kAll) {
+        Match match;
+        if (!FindLeftmost(text, 0, &match)) {
+            return std::nullopt;
+        }
+        return match;
+    }
+
+    size_t end;
+    auto state = prefilter_.has_value() ? RunToOutput<true>(text, &end)
+                                        : RunToOutput<false>(text, &end);
+    if (state == kNoState) {
+        return std::nullopt;
     }
-    return {transition, root_};
+    return FirstOutput(state, end);
+}
+
+bool Automaton::FindLeftmost(std::string_view text, size_t position, Match *match) const {
+    if (prefilter_.has_value()) {
+        return FindLeftmost<true>(text, position, match);
+    }
+    return FindLeftmost<false>(text, position, match);
+}
+
+template <bool kFiltered>
+bool Automaton::FindLeftmost(std::string_view text, size_t position, Match *match) const {
+    // Every state holds the occurrence last seen, so the search ends with it. The transitions
+    // are complete, as leftmost automata always precompute them. With the prefilter, the root is
+    // left for good once something is found, and it has no matches of its own, the prefilter
+    // being left out for the empty string.
+    bool found = has_output_[kRoot];
+    if (found) {
+        *match = FirstOutput(kRoot, position);
+    }
+    Walk<kFiltered>(kRoot, text, &position, dead_state_, [&](StateId state, size_t offset) {
+        found = true;
+        *match = FirstOutput(state, offset + 1);
+        return true;
+    });
+    return found;
+}
+
+void Automaton::ScanChunks(std::string_view text, const ParallelScanOptions &options,
+                           const OnChunk &on_chunk) const {
+    RequireAllMatches("ScanChunks");
+    internal::ScanChunks(text, options, internal::ChunkScanner(*this, text), on_chunk);
+}
+
+void Automaton::FindAllParallel(std::string_view text, const ParallelScanOptions &options,
+                                std::vector<Match> *matches) const {
+    RequireAllMatches("FindAllParallel");
+    internal::FindAllParallel(text, options, internal::ChunkScanner(*this, text), matches);
 }
 
 void AutomatonBuilder::Add(const std::string &string, size_t id) {
@@ -134,24 +379,54 @@ void AutomatonBuilder::Add(const std::string &string, size_t id) {
     ids_.push_back(id);
 }
 
-std::unique_ptr<Automaton> AutomatonBuilder::Build() {
+std::unique_ptr<Automaton> AutomatonBuilder::Build(const BuildOptions &options) {
+    std::vector<std::string> folded;
+    if (options.case_folding != CaseFolding::kNone) {
+        folded.reserve(words_.size());
+        for (const auto &word : words_) {
+            folded.push_back(FoldCase(word, options.case_folding));
+        }
+    }
+    const auto &words = options.case_folding != CaseFolding::kNone ? folded : words_;
+
+    AutomatonNode root;
+    BuildTrie(words, ids_, options.match_kind, &root);
+    BuildSuffixLinks(&root);
+    BuildTerminalLinks(&root);
+
     auto automaton = std::make_unique<Automaton>();
-    BuildTrie(words_, ids_, automaton.get());
-    BuildSuffixLinks(automaton.get());
-    BuildTerminalLinks(automaton.get());
+    Compile(&root, options, automaton.get());
+    bool has_empty = false;
+    for (const auto &word : words) {
+        automaton->max_length_ = std::max(automaton->max_length_, word.size());
+        has_empty |= word.empty();
+    }
+
+    bool prefilter = options.prefilter == BuildOptions::Prefilter::kAlways ||
+                     (options.prefilter == BuildOptions::Prefilter::kAuto &&
+                      words.size() <= BuildOptions::kAutoPrefilterStrings);
+    if (prefilter && !has_empty) {
+        automaton->prefilter_.emplace(PrefilterStrings(words, options.case_folding));
+    }
     return automaton;
 }
 
 void AutomatonBuilder::BuildTrie(const std::vector<std::string> &words,
-                                 const std::vector<size_t> &ids, Automaton *automaton) {
+                                 const std::vector<size_t> &ids, MatchKind match_kind,
+                                 AutomatonNode *root) {
     for (size_t i = 0; i < words.size(); ++i) {
-        AddString(&automaton->root_, ids[i], words[i]);
+        AddString(root, ids[i], words[i], match_kind == MatchKind::kLeftmostFirst);
     }
 }
 
-void AutomatonBuilder::AddString(AutomatonNode *root, size_t string_id, const std::string &string) {
+void AutomatonBuilder::AddString(AutomatonNode *root, size_t string_id, const std::string &string,
+                                 bool stop_at_terminal) {
     auto *current_node = root;
     for (const auto character : string) {
+        // Nodes created for the string come after any terminating one, so none is left behind.
+        if (stop_at_terminal && !current_node->terminated_string_ids.empty()) {
+            return;
+        }
         auto *child = GetTrieTransition(current_node, character);
         if (child == nullptr) {
             current_node->trie_transitions[character] = AutomatonNode();
@@ -163,20 +438,332 @@ void AutomatonBuilder::AddString(AutomatonNode *root, size_t string_id, const st
     current_node->terminated_string_ids.push_back(string_id);
 }
 
-void AutomatonBuilder::BuildSuffixLinks(Automaton *automaton) {
+void AutomatonBuilder::BuildSuffixLinks(AutomatonNode *root) {
+    internal::AutomatonGraph graph;
+
+    traverses::BreadthFirstSearch(root, graph,
+                                  aho_corasick::internal::SuffixLinkCalculator(root));
+}
+
+void AutomatonBuilder::BuildTerminalLinks(AutomatonNode *root) {
     internal::AutomatonGraph graph;
 
-    traverses::BreadthFirstSearch(
-        &automaton->root_, graph,
-        aho_corasick::internal::SuffixLinkCalculator(&automaton->root_));
+    traverses::BreadthFirstSearch(root, graph,
+                                  aho_corasick::internal::TerminalLinkCalculator(root));
 }
 
-void AutomatonBuilder::BuildTerminalLinks(Automaton *automaton) {
+void AutomatonBuilder::Compile(AutomatonNode *root, const BuildOptions &options,
+                               Automaton *automaton) {
+    using StateId = Automaton::StateId;
+
+    std::vector<AutomatonNode *> order;
     internal::AutomatonGraph graph;
+    traverses::BreadthFirstSearch(root, graph, internal::NodeOrderRecorder(&order));
+
+    if (order.size() >= Automaton::kNoState) {
+        throw std::runtime_error("too many automaton states");
+    }
+
+    std::unordered_map<const AutomatonNode *, StateId> ids;
+    for (size_t state = 0; state < order.size(); ++state) {
+        ids[order[state]] = state;
+    }
+
+    // Bytes on the trie edges get classes 1 and up in byte order, the rest share class 0. When
+    // all 256 bytes occur, the classes are the bytes themselves.
+    std::array<bool, Automaton::kAlphabetSize> used = {};
+    for (const auto *node : order) {
+        for (const auto &[character, child] : node->trie_transitions) {
+            used[static_cast<uint8_t>(character)] = true;
+        }
+    }
+
+    // UTF-8 folding needs the bytes of the characters which fold to something on the trie edges
+    // to have classes of their own, and so the bytes of any other character with a byte there.
+    std::vector<internal::Utf8Folding> foldings;
+    if (options.case_folding == CaseFolding::kUtf8) {
+        auto on_edges = used;
+        for (const auto &folding : internal::Utf8Foldings()) {
+            if (on_edges[folding.to[1]] || on_edges[folding.from[1]]) {
+                foldings.push_back(folding);
+                used[folding.from[0]] = used[folding.from[1]] = true;
+            }
+        }
+    }
+
+    std::vector<uint8_t> classes(Automaton::kAlphabetSize);
+    size_t num_classes = std::find(used.begin(), used.end(), false) != used.end() ? 1 : 0;
+    for (size_t byte = 0; byte < Automaton::kAlphabetSize; ++byte) {
+        classes[byte] = used[byte] ? num_classes++ : 0;
+    }
+    // The strings are folded, so upper case letters are not on the edges and get the classes of
+    // the lower case ones.
+    if (options.case_folding != CaseFolding::kNone) {
+        for (size_t byte = 'A'; byte <= 'Z'; ++byte) {
+            classes[byte] = classes[byte + ('a' - 'A')];
+        }
+    }
+    size_t row_shift = 0;
+    while ((size_t(1) << row_shift) < num_classes) {
+        ++row_shift;
+    }
+
+    const size_t num_states = order.size();
+    std::vector<StateId> transitions(num_states << row_shift, Automaton::kNoState);
+    std::vector<StateId> suffix_links(num_states), terminal_links(num_states);
+    std::vector<uint32_t> terminated_begin(num_states + 1), depths(num_states);
+    std::vector<uint64_t> terminated_ids;
+    std::vector<uint8_t> has_output(num_states);
+
+    for (size_t state = 0; state < num_states; ++state) {
+        const auto *node = order[state];
+        for (const auto &[character, child] : node->trie_transitions) {
+            auto child_id = ids.at(&child);
+            transitions[(state << row_shift) + classes[static_cast<uint8_t>(character)]] = child_id;
+            depths[child_id] = depths[state] + 1;
+        }
+
+        suffix_links[state] = ids.at(node->suffix_link);
+        terminal_links[state] =
+            node->terminal_link != nullptr ? ids.at(node->terminal_link) : Automaton::kNoState;
+
+        terminated_begin[state] = terminated_ids.size();
+        terminated_ids.insert(terminated_ids.end(), node->terminated_string_ids.begin(),
+                              node->terminated_string_ids.end());
+        has_output[state] = !node->terminated_string_ids.empty() || node->terminal_link != nullptr;
+    }
+    terminated_begin[num_states] = terminated_ids.size();
+
+    // Bytes which do not continue any string lead from the root back to itself.
+    for (size_t byte_class = 0; byte_class < num_classes; ++byte_class) {
+        auto &target = transitions[(Automaton::kRoot << row_shift) + byte_class];
+        if (target == Automaton::kNoState) {
+            target = Automaton::kRoot;
+        }
+    }
+
+    const bool leftmost = options.match_kind != MatchKind::kAll;
+    auto dead_state = Automaton::kNoState;
+    if (leftmost) {
+        dead_state = AddDeadState(num_classes, row_shift, &transitions, &suffix_links,
+                                  &terminal_links, &terminated_begin, &has_output, &depths);
+    }
+
+    if (options.precompute_transitions || options.case_folding == CaseFolding::kUtf8 || leftmost) {
+        PrecomputeTransitions(suffix_links, num_classes, row_shift, &transitions);
+    }
+    if (!foldings.empty()) {
+        AddFoldingStates(foldings, classes, row_shift, &transitions, &suffix_links,
+                         &terminal_links, &terminated_begin, &has_output, &depths);
+    }
+
+    automaton->classes_.Assign(std::move(classes));
+    automaton->num_classes_ = num_classes;
+    automaton->row_shift_ = row_shift;
+    automaton->transitions_.Assign(std::move(transitions));
+    automaton->suffix_links_.Assign(std::move(suffix_links));
+    automaton->terminal_links_.Assign(std::move(terminal_links));
+    automaton->terminated_begin_.Assign(std::move(terminated_begin));
+    automaton->terminated_ids_.Assign(std::move(terminated_ids));
+    automaton->has_output_.Assign(std::move(has_output));
+    automaton->depths_.Assign(std::move(depths));
+    automaton->match_kind_ = options.match_kind;
+    automaton->dead_state_ = dead_state;
+}
+
+void AutomatonBuilder::PrecomputeTransitions(const std::vector<Automaton::StateId> &suffix_links,
+                                             size_t num_classes, size_t row_shift,
+                                             std::vector<Automaton::StateId> *transitions) {
+    // The suffix link of a state is shallower, so its row precedes the row of the state in
+    // breadth-first order and is already complete when copied from.
+    for (size_t state = 1; state < suffix_links.size(); ++state) {
+        const auto *link_row = transitions->data() + (size_t(suffix_links[state]) << row_shift);
+        auto *row = transitions->data() + (state << row_shift);
+        for (size_t byte_class = 0; byte_class < num_classes; ++byte_class) {
+            if (row[byte_class] == Automaton::kNoState) {
+                row[byte_class] = link_row[byte_class];
+            }
+        }
+    }
+}
+
+Automaton::StateId AutomatonBuilder::AddDeadState(size_t num_classes, size_t row_shift,
+                                                 std::vector<Automaton::StateId> *transitions,
+                                                 std::vector<Automaton::StateId> *suffix_links,
+                                                 std::vector<Automaton::StateId> *terminal_links,
+                                                 std::vector<uint32_t> *terminated_begin,
+                                                 std::vector<uint8_t> *has_output,
+                                                 std::vector<uint32_t> *depths) {
+    using StateId = Automaton::StateId;
+    constexpr auto kRoot = Automaton::kRoot;
+    constexpr auto kNoState = Automaton::kNoState;
+
+    const size_t num_states = suffix_links->size();
+    if (num_states + 1 >= kNoState) {
+        throw std::runtime_error("too many automaton states");
+    }
+    const auto dead_state = static_cast<StateId>(num_states);
+
+    auto entry = [&](StateId state, size_t byte_class) -> StateId & {
+        return (*transitions)[(static_cast<size_t>(state) << row_shift) + byte_class];
+    };
+    auto trie_child = [&](StateId state, size_t byte_class) {
+        auto child = entry(state, byte_class);
+        return child == kRoot ? kNoState : child;
+    };
+    auto terminates = [&](StateId state) {
+        return (*terminated_begin)[state] != (*terminated_begin)[state + 1];
+    };
+
+    std::vector<StateId> parents(num_states, kNoState);
+    std::vector<uint32_t> parent_classes(num_states);
+    for (size_t state = 0; state < num_states; ++state) {
+        for (size_t byte_class = 0; byte_class < num_classes; ++byte_class) {
+            auto child = trie_child(state, byte_class);
+            if (child != kNoState) {
+                parents[child] = state;
+                parent_classes[child] = byte_class;
+            }
+        }
+    }
+
+    transitions->resize((num_states + 1) << row_shift, dead_state);
+    suffix_links->push_back(dead_state);
+    terminal_links->push_back(kNoState);
+    terminated_begin->push_back(terminated_begin->back());
+    has_output->push_back(false);
+    depths->push_back(0);
+
+    // The usual construction in breadth-first order, except that states terminating a string
+    // link to the dead state, which leads to itself on every byte. The links of the states
+    // below them are found through those of their parents, so they lead there as well. The
+    // empty string occurs wherever a search starts, so with it every state links there.
+    const bool has_empty = terminates(kRoot);
+    for (size_t state = 1; state < num_states; ++state) {
+        auto parent = parents[state];
+        auto link = kRoot;
+        if (terminates(state) || has_empty) {
+            link = dead_state;
+        } else if (parent != kRoot) {
+            link = (*suffix_links)[parent];
+            while (link != dead_state) {
+                auto child = trie_child(link, parent_classes[state]);
+                if (child != kNoState) {
+                    link = child;
+                    break;
+                }
+                if (link == kRoot) {
+                    break;
+                }
+                link = (*suffix_links)[link];
+            }
+        }
+
+        (*suffix_links)[state] = link;
+        if (link == dead_state) {
+            (*terminal_links)[state] = kNoState;
+        } else {
+            (*terminal_links)[state] = terminates(link) ? link : (*terminal_links)[link];
+        }
+        (*has_output)[state] = terminates(state) || (*terminal_links)[state] != kNoState;
+    }
+
+    if (has_empty) {
+        for (size_t byte_class = 0; byte_class < num_classes; ++byte_class) {
+            if (entry(kRoot, byte_class) == kRoot) {
+                entry(kRoot, byte_class) = dead_state;
+            }
+        }
+    }
+    return dead_state;
+}
+
+void AutomatonBuilder::AddFoldingStates(const std::vector<internal::Utf8Folding> &foldings,
+                                        const std::vector<uint8_t> &classes, size_t row_shift,
+                                        std::vector<Automaton::StateId> *transitions,
+                                        std::vector<Automaton::StateId> *suffix_links,
+                                        std::vector<Automaton::StateId> *terminal_links,
+                                        std::vector<uint32_t> *terminated_begin,
+                                        std::vector<uint8_t> *has_output,
+                                        std::vector<uint32_t> *depths) {
+    using StateId = Automaton::StateId;
+
+    auto next = [&](StateId state, uint8_t byte) {
+        return (*transitions)[(static_cast<size_t>(state) << row_shift) + classes[byte]];
+    };
+
+    std::map<uint8_t, std::vector<internal::Utf8Folding>> by_lead;
+    for (const auto &folding : foldings) {
+        by_lead[folding.from[0]].push_back(folding);
+    }
 
-    traverses::BreadthFirstSearch(
-        &automaton->root_, graph,
-        aho_corasick::internal::TerminalLinkCalculator(&automaton->root_));
+    // Reading lead byte L in state s leads to held = next(s, L), which is right unless the next
+    // byte completes a character folding to another one. For those the state has to lead to
+    // next(next(s, to[0]), to[1]) instead. A state holding L is added wherever that differs,
+    // one per distinct lead, held and targets. Its row is that of held but for the targets.
+    struct Redirect {
+        StateId state;
+        uint8_t lead;
+        StateId target;
+    };
+    std::vector<Redirect> redirects;
+    // Keys are the lead, held and the targets of the characters with that lead.
+    std::map<std::vector<StateId>, StateId> added;
+    const size_t num_states = suffix_links->size();
+
+    std::vector<StateId> key;
+    for (size_t state = 0; state < num_states; ++state) {
+        for (const auto &[lead, lead_foldings] : by_lead) {
+            auto held = next(state, lead);
+            key = {lead, held};
+            bool differs = false;
+            for (const auto &folding : lead_foldings) {
+                auto target = next(next(state, folding.to[0]), folding.to[1]);
+                key.push_back(target);
+                differs |= next(held, folding.from[1]) != target;
+            }
+            if (differs) {
+                auto id = added.try_emplace(key, num_states + added.size()).first->second;
+                redirects.push_back({static_cast<StateId>(state), lead, id});
+            }
+        }
+    }
+    if (num_states + added.size() >= Automaton::kNoState) {
+        throw std::runtime_error("too many automaton states");
+    }
+
+    // The rows of the added states are copied after the redirects, so that a lead byte which
+    // follows another one is held as well.
+    for (const auto &redirect : redirects) {
+        (*transitions)[(static_cast<size_t>(redirect.state) << row_shift) +
+                       classes[redirect.lead]] = redirect.target;
+    }
+
+    const size_t total = num_states + added.size();
+    transitions->resize(total << row_shift);
+    suffix_links->resize(total);
+    terminal_links->resize(total);
+    terminated_begin->resize(total + 1, terminated_begin->back());
+    has_output->resize(total);
+    depths->resize(total);
+
+    for (const auto &[key, state] : added) {
+        auto held = key[1];
+        auto *row = transitions->data() + (static_cast<size_t>(state) << row_shift);
+        std::copy_n(transitions->data() + (static_cast<size_t>(held) << row_shift),
+                    size_t(1) << row_shift, row);
+        const auto &lead_foldings = by_lead.at(static_cast<uint8_t>(key[0]));
+        for (size_t idx = 0; idx < lead_foldings.size(); ++idx) {
+            row[classes[lead_foldings[idx].from[1]]] = key[2 + idx];
+        }
+
+        // Outputs are those of held, which has none of its own with valid UTF-8 strings.
+        bool terminates = (*terminated_begin)[held] != (*terminated_begin)[held + 1];
+        (*suffix_links)[state] = held;
+        (*terminal_links)[state] = terminates ? held : (*terminal_links)[held];
+        (*has_output)[state] = (*has_output)[held];
+        (*depths)[state] = (*depths)[held];
+    }
 }
 
 }  // namespace aho_corasick
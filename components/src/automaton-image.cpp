@@ -0,0 +1,257 @@
+#include "aho-corasick.h"
+#include "mapped-file.h"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace aho_corasick {
+
+namespace {
+
+constexpr char kMagic[8] = {'A', 'C', 'A', 'U', 'T', 'O', 'M', '\0'};
+constexpr uint32_t kVersion = 2;
+// Reads differently on a host of the other byte order.
+constexpr uint32_t kByteOrderMark = 0x01020304;
+constexpr size_t kAlignment = 64;
+
+enum Section : size_t {
+    kClasses,
+    kTransitions,
+    kSuffixLinks,
+    kTerminalLinks,
+    kTerminatedBegin,
+    kTerminatedIds,
+    kHasOutput,
+    kDepths,
+    kNumSections,
+};
+
+struct SectionEntry {
+    uint64_t offset;
+    uint64_t count;
+};
+
+struct ImageHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t size;
+    // Of the whole image, with this field set to 0.
+    uint64_t checksum;
+    uint64_t num_states;
+    uint64_t num_classes;
+    uint64_t row_shift;
+    uint64_t max_length;
+    uint64_t match_kind;
+    uint64_t dead_state;
+    // 0 without a prefilter.
+    uint64_t prefilter_length;
+    std::array<PrefixFilter::Masks, PrefixFilter::kMaxLength> prefilter_masks;
+    SectionEntry sections[kNumSections];
+};
+
+uint64_t RotateLeft(uint64_t value, int shift) {
+    return (value << shift) | (value >> (64 - shift));
+}
+
+// Multiply-rotate hash over four independent lanes of 64-bit words, so that verifying a large
+// image runs at memory speed.
+uint64_t Checksum(const uint8_t *data, size_t size) {
+    constexpr uint64_t kPrime1 = 0x9e3779b185ebca87;
+    constexpr uint64_t kPrime2 = 0xc2b2ae3d27d4eb4f;
+
+    uint64_t lanes[4] = {kPrime1, kPrime2, ~kPrime1, ~kPrime2};
+    size_t position = 0;
+    for (; position + 32 <= size; position += 32) {
+        for (size_t lane = 0; lane < 4; ++lane) {
+            uint64_t word;
+            std::memcpy(&word, data + position + 8 * lane, sizeof(word));
+            lanes[lane] = RotateLeft(lanes[lane] + word * kPrime2, 31) * kPrime1;
+        }
+    }
+
+    uint64_t hash = size * kPrime1;
+    for (auto lane : lanes) {
+        hash = RotateLeft(hash ^ (lane * kPrime2), 27) * kPrime1;
+    }
+    for (; position < size; ++position) {
+        hash = RotateLeft(hash ^ (data[position] * kPrime1), 11) * kPrime2;
+    }
+
+    hash ^= hash >> 33;
+    hash *= kPrime2;
+    hash ^= hash >> 29;
+    return hash;
+}
+
+uint64_t ImageChecksum(const ImageHeader &header, std::string_view image) {
+    auto unsummed = header;
+    unsummed.checksum = 0;
+    auto header_sum = Checksum(reinterpret_cast<const uint8_t *>(&unsummed), sizeof(unsummed));
+    auto body_sum = Checksum(reinterpret_cast<const uint8_t *>(image.data()) + sizeof(header),
+                             image.size() - sizeof(header));
+    return RotateLeft(header_sum, 32) ^ body_sum;
+}
+
+size_t AlignUp(size_t offset) {
+    return (offset + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+template <class T>
+void Place(const internal::Array<T> &array, Section section, ImageHeader *header,
+           size_t *offset) {
+    header->sections[section] = {*offset, array.size()};
+    *offset = AlignUp(*offset + array.size() * sizeof(T));
+}
+
+template <class T>
+void Copy(const internal::Array<T> &array, Section section, const ImageHeader &header,
+          std::string *image) {
+    if (array.size() > 0) {
+        std::memcpy(image->data() + header.sections[section].offset, array.data(),
+                    array.size() * sizeof(T));
+    }
+}
+
+template <class T>
+void Refer(std::string_view image, const ImageHeader &header, Section section, uint64_t count,
+           internal::Array<T> *array) {
+    const auto &entry = header.sections[section];
+    if (entry.count != count || entry.offset % alignof(T) != 0 || entry.offset > image.size() ||
+        entry.count > (image.size() - entry.offset) / sizeof(T)) {
+        throw std::runtime_error("automaton image: invalid section");
+    }
+    array->Refer(reinterpret_cast<const T *>(image.data() + entry.offset), entry.count);
+}
+
+}  // namespace
+
+void Automaton::Save(std::ostream &stream) const {
+    ImageHeader header = {};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.byte_order = kByteOrderMark;
+    header.num_states = NumStates();
+    header.num_classes = num_classes_;
+    header.row_shift = row_shift_;
+    header.max_length = max_length_;
+    header.match_kind = static_cast<uint64_t>(match_kind_);
+    header.dead_state = dead_state_;
+    if (prefilter_.has_value()) {
+        header.prefilter_length = prefilter_->Length();
+        header.prefilter_masks = prefilter_->GetMasks();
+    }
+
+    size_t offset = AlignUp(sizeof(ImageHeader));
+    Place(classes_, kClasses, &header, &offset);
+    Place(transitions_, kTransitions, &header, &offset);
+    Place(suffix_links_, kSuffixLinks, &header, &offset);
+    Place(terminal_links_, kTerminalLinks, &header, &offset);
+    Place(terminated_begin_, kTerminatedBegin, &header, &offset);
+    Place(terminated_ids_, kTerminatedIds, &header, &offset);
+    Place(has_output_, kHasOutput, &header, &offset);
+    Place(depths_, kDepths, &header, &offset);
+    header.size = offset;
+
+    std::string image(offset, '\0');
+    Copy(classes_, kClasses, header, &image);
+    Copy(transitions_, kTransitions, header, &image);
+    Copy(suffix_links_, kSuffixLinks, header, &image);
+    Copy(terminal_links_, kTerminalLinks, header, &image);
+    Copy(terminated_begin_, kTerminatedBegin, header, &image);
+    Copy(terminated_ids_, kTerminatedIds, header, &image);
+    Copy(has_output_, kHasOutput, header, &image);
+    Copy(depths_, kDepths, header, &image);
+
+    header.checksum = ImageChecksum(header, image);
+    std::memcpy(image.data(), &header, sizeof(header));
+
+    if (!stream.write(image.data(), image.size())) {
+        throw std::runtime_error("automaton image: write failed");
+    }
+}
+
+std::unique_ptr<Automaton> Automaton::FromImage(std::string_view image,
+                                                std::shared_ptr<const void> owner,
+                                                bool verify_checksum) {
+    if (image.size() < sizeof(ImageHeader)) {
+        throw std::runtime_error("automaton image: truncated");
+    }
+    if (reinterpret_cast<uintptr_t>(image.data()) % alignof(uint64_t) != 0) {
+        throw std::runtime_error("automaton image: misaligned");
+    }
+
+    ImageHeader header;
+    std::memcpy(&header, image.data(), sizeof(header));
+    if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+        throw std::runtime_error("automaton image: bad magic");
+    }
+    if (header.version != kVersion) {
+        throw std::runtime_error("automaton image: unsupported version " +
+                                 std::to_string(header.version));
+    }
+    if (header.byte_order != kByteOrderMark) {
+        throw std::runtime_error("automaton image: written with another byte order");
+    }
+    if (header.size != image.size()) {
+        throw std::runtime_error("automaton image: size mismatch");
+    }
+    if (verify_checksum && ImageChecksum(header, image) != header.checksum) {
+        throw std::runtime_error("automaton image: checksum mismatch");
+    }
+
+    if (header.num_states == 0 || header.num_states >= kNoState || header.num_classes == 0 ||
+        header.num_classes > kAlphabetSize || header.row_shift > 8 ||
+        (size_t(1) << header.row_shift) < header.num_classes ||
+        header.match_kind > static_cast<uint64_t>(MatchKind::kLeftmostLongest) ||
+        (header.match_kind == static_cast<uint64_t>(MatchKind::kAll)
+             ? header.dead_state != kNoState
+             : header.dead_state >= header.num_states)) {
+        throw std::runtime_error("automaton image: invalid header");
+    }
+
+    auto automaton = std::make_unique<Automaton>();
+    automaton->num_classes_ = header.num_classes;
+    automaton->row_shift_ = header.row_shift;
+    automaton->max_length_ = header.max_length;
+    automaton->match_kind_ = static_cast<MatchKind>(header.match_kind);
+    automaton->dead_state_ = header.dead_state;
+    if (header.prefilter_length != 0) {
+        automaton->prefilter_.emplace(header.prefilter_length, header.prefilter_masks);
+    }
+
+    const uint64_t num_states = header.num_states;
+    Refer(image, header, kClasses, kAlphabetSize, &automaton->classes_);
+    Refer(image, header, kTransitions, num_states << header.row_shift, &automaton->transitions_);
+    Refer(image, header, kSuffixLinks, num_states, &automaton->suffix_links_);
+    Refer(image, header, kTerminalLinks, num_states, &automaton->terminal_links_);
+    Refer(image, header, kTerminatedBegin, num_states + 1, &automaton->terminated_begin_);
+    Refer(image, header, kTerminatedIds, header.sections[kTerminatedIds].count,
+          &automaton->terminated_ids_);
+    Refer(image, header, kHasOutput, num_states, &automaton->has_output_);
+    Refer(image, header, kDepths, num_states, &automaton->depths_);
+
+    for (auto byte_class : automaton->classes_) {
+        if (byte_class >= header.num_classes) {
+            throw std::runtime_error("automaton image: invalid byte class");
+        }
+    }
+    if (automaton->terminated_begin_[num_states] != automaton->terminated_ids_.size()) {
+        throw std::runtime_error("automaton image: invalid output lists");
+    }
+
+    automaton->image_owner_ = std::move(owner);
+    return automaton;
+}
+
+std::unique_ptr<Automaton> Automaton::Load(const std::string &path, bool verify_checksum) {
+    // Scans read the table at random. Verifying the checksum reads all of it right away, so
+    // the pages are then requested up front.
+    using Access = byte_streams::MappedFile::Access;
+    auto file = std::make_shared<const byte_streams::MappedFile>(
+        path, verify_checksum ? Access::kWillNeed : Access::kRandom);
+    auto image = file->View();
+    return FromImage(image, std::move(file), verify_checksum);
+}
+
+}  // namespace aho_corasick
@@ -1,34 +1,13 @@
 #include "byte-streams.h"
 
+#include <algorithm>
+
 namespace byte_streams {
 
 std::pair<std::uint8_t, std::uint8_t> SplitByte(uint8_t to_split) {
     return {(to_split & 0xf0) >> 4, (to_split & 0x0f)};
 }
 
-uint16_t ComposeNBitsBE(uint8_t n, BitStream& stream) {
-    uint16_t returned = 0;
-
-    for (uint16_t i = 0; i < n; ++i) {
-        auto bit = static_cast<uint8_t>(stream.Yield());
-        returned |= (bit << i);
-    }
-
-    return returned;
-}
-
-uint16_t ComposeNBitsLE(uint8_t n, BitStream& stream) {
-    uint16_t returned = 0;
-
-    for (uint8_t i = 0; i < n; ++i) {
-        auto bit = static_cast<uint8_t>(stream.Yield());
-        returned <<= 1;
-        returned += static_cast<uint8_t>(bit);
-    }
-
-    return returned;
-}
-
 BitStream::BitStream(std::istream& stream, bool staffing) : Stream(stream), staffing_(staffing) {
 }
 
@@ -80,19 +59,92 @@ void BitStream::UpdateWord() {
     }
 }
 
-ByteStream::ByteStream(std::istream& stream) : Stream(stream) {
+std::vector<std::uint8_t> ReadStuffedSegment(std::istream& stream) {
+    std::vector<std::uint8_t> unstuffed;
+
+    while (true) {
+        std::uint8_t read;
+        if (!stream.read(reinterpret_cast<char*>(&read), 1)) {
+            break;
+        }
+
+        if (read == 0xff) {
+            std::uint8_t staffed;
+            if (!stream.read(reinterpret_cast<char*>(&staffed), 1)) {
+                break;
+            }
+
+            if (staffed != 0x00 && staffed != 0xff) {
+                stream.seekg(-2, std::ios_base::cur);
+                break;
+            }
+        }
+        unstuffed.push_back(read);
+    }
+
+    return unstuffed;
+}
+
+ByteStream::ByteStream(std::istream& stream) : Stream(stream), buffer_(stream.rdbuf()) {
 }
 
-std::uint8_t ByteStream::Yield() {
+void ByteStream::ReadInto(std::uint8_t* data, size_t size) {
     if (finished_) {
         throw std::runtime_error("yielding from closed stream");
     }
 
-    uint8_t read;
-    stream_.read(reinterpret_cast<char*>(&read), 1);
+    auto read = buffer_->sgetn(reinterpret_cast<char*>(data), size);
+    if (read < static_cast<std::streamsize>(size)) {
+        MarkFinished();
+        throw std::runtime_error("unexpected end of stream");
+    }
+}
 
-    finished_ = stream_.eof();
-    return read;
+void ByteStream::Skip(size_t num_bytes) {
+    // Reading works on every stream buffer, while seeking may not and does not report running
+    // past the end of a file.
+    std::array<std::uint8_t, 512> discarded;
+    while (num_bytes > 0) {
+        size_t chunk = std::min(num_bytes, discarded.size());
+        ReadInto(discarded.data(), chunk);
+        num_bytes -= chunk;
+    }
+}
+
+// Leaves the stream in the state a failed istream::read would.
+void ByteStream::MarkFinished() {
+    finished_ = true;
+    stream_.setstate(std::ios_base::eofbit | std::ios_base::failbit);
+}
+
+MemoryStreamBuf::MemoryStreamBuf(const char* data, size_t size) {
+    auto* begin = const_cast<char*>(data);
+    setg(begin, begin, begin + size);
+}
+
+MemoryStreamBuf::pos_type MemoryStreamBuf::seekoff(off_type offset, std::ios_base::seekdir dir,
+                                                   std::ios_base::openmode which) {
+    if (dir == std::ios_base::cur) {
+        offset += gptr() - eback();
+    } else if (dir == std::ios_base::end) {
+        offset += egptr() - eback();
+    }
+    return seekpos(offset, which);
+}
+
+MemoryStreamBuf::pos_type MemoryStreamBuf::seekpos(pos_type position,
+                                                   std::ios_base::openmode which) {
+    off_type offset = position;
+    if (!(which & std::ios_base::in) || offset < 0 || offset > egptr() - eback()) {
+        return pos_type(off_type(-1));
+    }
+    setg(eback(), eback() + offset, egptr());
+    return position;
+}
+
+MemoryStream::MemoryStream(const char* data, size_t size)
+    : std::istream(nullptr), buffer_(data, size) {
+    rdbuf(&buffer_);
 }
 
-}  // namespace byte_streams
\ No newline at end of file
+}  // namespace byte_streams
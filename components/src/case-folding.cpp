@@ -0,0 +1,98 @@
+#include "case-folding.h"
+
+namespace aho_corasick {
+
+namespace {
+
+// Characters first, first + step, ... up to last fold to themselves plus delta. Generated from
+// the C and S entries of CaseFolding.txt, Unicode 14, for the blocks kUtf8 covers.
+struct FoldRange {
+    char32_t first;
+    char32_t last;
+    char32_t step;
+    int32_t delta;
+};
+
+constexpr FoldRange kFoldRanges[] = {
+    {0x00B5, 0x00B5, 1, 775},  {0x00C0, 0x00D6, 1, 32},   {0x00D8, 0x00DE, 1, 32},
+    {0x0100, 0x012E, 2, 1},    {0x0132, 0x0136, 2, 1},    {0x0139, 0x0147, 2, 1},
+    {0x014A, 0x0176, 2, 1},    {0x0178, 0x0178, 1, -121}, {0x0179, 0x017D, 2, 1},
+    {0x0370, 0x0372, 2, 1},    {0x0376, 0x0376, 1, 1},    {0x037F, 0x037F, 1, 116},
+    {0x0386, 0x0386, 1, 38},   {0x0388, 0x038A, 1, 37},   {0x038C, 0x038C, 1, 64},
+    {0x038E, 0x038F, 1, 63},   {0x0391, 0x03A1, 1, 32},   {0x03A3, 0x03AB, 1, 32},
+    {0x03C2, 0x03C2, 1, 1},    {0x03CF, 0x03CF, 1, 8},    {0x03D0, 0x03D0, 1, -30},
+    {0x03D1, 0x03D1, 1, -25},  {0x03D5, 0x03D5, 1, -15},  {0x03D6, 0x03D6, 1, -22},
+    {0x03D8, 0x03EE, 2, 1},    {0x03F0, 0x03F0, 1, -54},  {0x03F1, 0x03F1, 1, -48},
+    {0x03F4, 0x03F4, 1, -60},  {0x03F5, 0x03F5, 1, -64},  {0x03F7, 0x03F7, 1, 1},
+    {0x03F9, 0x03F9, 1, -7},   {0x03FA, 0x03FA, 1, 1},    {0x03FD, 0x03FF, 1, -130},
+    {0x0400, 0x040F, 1, 80},   {0x0410, 0x042F, 1, 32},   {0x0460, 0x0480, 2, 1},
+    {0x048A, 0x04BE, 2, 1},    {0x04C0, 0x04C0, 1, 15},   {0x04C1, 0x04CD, 2, 1},
+    {0x04D0, 0x052E, 2, 1},
+};
+
+char32_t FoldTwoByte(char32_t character) {
+    for (const auto &range : kFoldRanges) {
+        if (character >= range.first && character <= range.last &&
+            (character - range.first) % range.step == 0) {
+            return character + range.delta;
+        }
+    }
+    return character;
+}
+
+bool IsContinuation(uint8_t byte) {
+    return (byte & 0xc0) == 0x80;
+}
+
+}  // namespace
+
+std::string FoldCase(std::string_view text, CaseFolding folding) {
+    std::string folded(text);
+    if (folding == CaseFolding::kNone) {
+        return folded;
+    }
+
+    for (size_t idx = 0; idx < folded.size(); ++idx) {
+        auto byte = static_cast<uint8_t>(folded[idx]);
+        if (byte >= 'A' && byte <= 'Z') {
+            folded[idx] = static_cast<char>(byte + ('a' - 'A'));
+            continue;
+        }
+        if (folding != CaseFolding::kUtf8 || (byte & 0xe0) != 0xc0 || idx + 1 == folded.size() ||
+            !IsContinuation(folded[idx + 1])) {
+            continue;
+        }
+
+        char32_t character = (char32_t(byte & 0x1f) << 6) | (folded[idx + 1] & 0x3f);
+        if (character >= 0x80) {
+            auto target = FoldTwoByte(character);
+            folded[idx] = static_cast<char>(0xc0 | (target >> 6));
+            folded[idx + 1] = static_cast<char>(0x80 | (target & 0x3f));
+        }
+        ++idx;
+    }
+    return folded;
+}
+
+namespace internal {
+
+const std::vector<Utf8Folding> &Utf8Foldings() {
+    static const std::vector<Utf8Folding> foldings = [] {
+        std::vector<Utf8Folding> result;
+        for (char32_t character = 0x80; character < 0x800; ++character) {
+            auto target = FoldTwoByte(character);
+            if (target != character) {
+                result.push_back({{static_cast<uint8_t>(0xc0 | (character >> 6)),
+                                   static_cast<uint8_t>(0x80 | (character & 0x3f))},
+                                  {static_cast<uint8_t>(0xc0 | (target >> 6)),
+                                   static_cast<uint8_t>(0x80 | (target & 0x3f))}});
+            }
+        }
+        return result;
+    }();
+    return foldings;
+}
+
+}  // namespace internal
+
+}  // namespace aho_corasick
@@ -0,0 +1,290 @@
+#include "double-array-automaton.h"
+
+#include <deque>
+#include <limits>
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+namespace aho_corasick {
+
+namespace {
+
+using StateId = DoubleArrayAutomaton::StateId;
+
+constexpr size_t kAlphabetSize = 256;
+
+// Candidate bases tried for a state before its children go past the last used slot, where any
+// base fits. Without the limit, states with many children would try every gap left so far.
+constexpr size_t kMaxTrials = 256;
+
+// Assigns slots to the children of one state at a time. The free slots form a linked list in
+// increasing order, so that the search for a base skips the used ones.
+class SlotAllocator {
+public:
+    SlotAllocator(std::vector<StateId> *base, std::vector<StateId> *check,
+                  std::vector<uint32_t> *outputs, uint32_t no_output)
+        : base_(base), check_(check), outputs_(outputs), no_output_(no_output) {
+        // The root takes slot 0, which is never free.
+        Reserve(1);
+    }
+
+    // Places the children of parent, the bytes of which are given in increasing order, and
+    // returns their base.
+    StateId Allocate(StateId parent, const std::vector<uint8_t> &bytes) {
+        auto base = FindBase(bytes);
+        for (auto byte : bytes) {
+            auto slot = base + byte;
+            (*check_)[slot] = parent;
+            Unlink(slot);
+            used_end_ = std::max<size_t>(used_end_, slot + 1);
+        }
+        return base;
+    }
+
+private:
+    static constexpr size_t kNoSlot = std::numeric_limits<size_t>::max();
+
+    StateId FindBase(const std::vector<uint8_t> &bytes) {
+        size_t trials = 0;
+        for (auto slot = head_; slot != kNoSlot && trials < kMaxTrials; slot = next_[slot]) {
+            if (slot < bytes.front()) {
+                continue;
+            }
+            ++trials;
+
+            size_t base = slot - bytes.front();
+            Reserve(base + kAlphabetSize);
+            bool fits = std::all_of(bytes.begin() + 1, bytes.end(), [&](uint8_t byte) {
+                return (*check_)[base + byte] == DoubleArrayAutomaton::kNoState;
+            });
+            if (fits) {
+                return base;
+            }
+        }
+
+        size_t base = std::max<size_t>(used_end_, bytes.front()) - bytes.front();
+        Reserve(base + kAlphabetSize);
+        return base;
+    }
+
+    void Reserve(size_t size) {
+        if (size >= DoubleArrayAutomaton::kNoState) {
+            throw std::runtime_error("too many automaton states");
+        }
+        auto old_size = check_->size();
+        if (size <= old_size) {
+            return;
+        }
+
+        size = std::max(size, 2 * old_size);
+        base_->resize(size, 0);
+        check_->resize(size, DoubleArrayAutomaton::kNoState);
+        outputs_->resize(size, no_output_);
+        next_.resize(size);
+        prev_.resize(size);
+        for (auto slot = std::max<size_t>(old_size, 1); slot < size; ++slot) {
+            Link(slot);
+        }
+    }
+
+    void Link(size_t slot) {
+        prev_[slot] = tail_;
+        next_[slot] = kNoSlot;
+        (tail_ == kNoSlot ? head_ : next_[tail_]) = slot;
+        tail_ = slot;
+    }
+
+    void Unlink(size_t slot) {
+        auto prev = prev_[slot], next = next_[slot];
+        (prev == kNoSlot ? head_ : next_[prev]) = next;
+        (next == kNoSlot ? tail_ : prev_[next]) = prev;
+    }
+
+    std::vector<StateId> *base_;
+    std::vector<StateId> *check_;
+    std::vector<uint32_t> *outputs_;
+    uint32_t no_output_;
+
+    std::vector<size_t> next_;
+    std::vector<size_t> prev_;
+    size_t head_ = kNoSlot;
+    size_t tail_ = kNoSlot;
+    // One past the last used slot.
+    size_t used_end_ = 1;
+};
+
+}  // namespace
+
+Automaton::MemoryUsage DoubleArrayAutomaton::GetMemoryUsage() const {
+    Automaton::MemoryUsage usage;
+    usage.transition_bytes = (base_.size() + check_.size()) * sizeof(StateId);
+    usage.other_bytes = suffix_links_.size() * sizeof(StateId) +
+                        outputs_.size() * sizeof(uint32_t) +
+                        output_ids_.size() * sizeof(uint64_t) +
+                        output_links_.size() * sizeof(uint32_t) +
+                        output_lengths_.size() * sizeof(uint32_t);
+    return usage;
+}
+
+void DoubleArrayAutomaton::FindAll(std::string_view text, std::vector<Match> *matches) const {
+    matches->clear();
+    Scan(text, [matches](size_t pattern_id, size_t end) {
+        matches->push_back({pattern_id, end});
+    });
+}
+
+bool DoubleArrayAutomaton::Contains(std::string_view text) const {
+    return FindFirst(text).has_value();
+}
+
+std::optional<Match> DoubleArrayAutomaton::FindFirst(std::string_view text) const {
+    StateId state = kRoot;
+    for (size_t position = 0; position < text.size(); ++position) {
+        state = Step(base_.data(), check_.data(), suffix_links_.data(), state,
+                     static_cast<uint8_t>(text[position]));
+        if (outputs_[state] != kNoOutput) {
+            return Match{output_ids_[outputs_[state]], position + 1};
+        }
+    }
+    return std::nullopt;
+}
+
+void DoubleArrayAutomaton::ScanChunks(std::string_view text, const ParallelScanOptions &options,
+                                      const OnChunk &on_chunk) const {
+    internal::ScanChunks(text, options, internal::ChunkScanner(*this, text), on_chunk);
+}
+
+void DoubleArrayAutomaton::FindAllParallel(std::string_view text,
+                                           const ParallelScanOptions &options,
+                                           std::vector<Match> *matches) const {
+    internal::FindAllParallel(text, options, internal::ChunkScanner(*this, text), matches);
+}
+
+void DoubleArrayBuilder::Add(const std::string &string, size_t id) {
+    words_.push_back(string);
+    ids_.push_back(id);
+}
+
+std::unique_ptr<DoubleArrayAutomaton> DoubleArrayBuilder::Build() const {
+    constexpr auto kRoot = DoubleArrayAutomaton::kRoot;
+    constexpr auto kNoOutput = DoubleArrayAutomaton::kNoOutput;
+
+    // In byte order, the strings below a trie node form a range in which those terminated at
+    // the node come first. Equal strings keep the order they were added in.
+    std::vector<size_t> sorted(words_.size());
+    std::iota(sorted.begin(), sorted.end(), 0);
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [this](size_t lhs, size_t rhs) { return words_[lhs] < words_[rhs]; });
+
+    auto automaton = std::make_unique<DoubleArrayAutomaton>();
+    auto &base = automaton->base_;
+    auto &check = automaton->check_;
+    auto &outputs = automaton->outputs_;
+    auto &output_ids = automaton->output_ids_;
+    auto &output_links = automaton->output_links_;
+    auto &output_lengths = automaton->output_lengths_;
+    SlotAllocator allocator(&base, &check, &outputs, kNoOutput);
+
+    struct Node {
+        StateId state;
+        size_t depth;
+        // Range of sorted.
+        size_t begin;
+        size_t end;
+    };
+    std::deque<Node> queue = {{kRoot, 0, 0, sorted.size()}};
+    // States in breadth-first order.
+    std::vector<StateId> order = {kRoot};
+    std::vector<uint8_t> bytes;
+    std::vector<size_t> child_begins;
+
+    // Places the trie level by level.
+    while (!queue.empty()) {
+        auto node = queue.front();
+        queue.pop_front();
+
+        auto idx = node.begin;
+        for (; idx < node.end && words_[sorted[idx]].size() == node.depth; ++idx) {
+            if (output_ids.size() >= kNoOutput - 1) {
+                throw std::runtime_error("too many strings");
+            }
+            if (idx == node.begin) {
+                outputs[node.state] = output_ids.size();
+            }
+            output_ids.push_back(ids_[sorted[idx]]);
+            output_links.push_back(output_ids.size());
+            output_lengths.push_back(node.depth);
+        }
+        if (idx != node.begin) {
+            output_links.back() = kNoOutput;
+        }
+        if (idx == node.end) {
+            continue;
+        }
+
+        bytes.clear();
+        child_begins.clear();
+        for (; idx < node.end; ++idx) {
+            auto byte = static_cast<uint8_t>(words_[sorted[idx]][node.depth]);
+            if (bytes.empty() || bytes.back() != byte) {
+                bytes.push_back(byte);
+                child_begins.push_back(idx);
+            }
+        }
+        child_begins.push_back(node.end);
+
+        auto child_base = allocator.Allocate(node.state, bytes);
+        base[node.state] = child_base;
+        for (size_t child = 0; child < bytes.size(); ++child) {
+            StateId state = child_base + bytes[child];
+            order.push_back(state);
+            queue.push_back({state, node.depth + 1, child_begins[child], child_begins[child + 1]});
+        }
+    }
+
+    // Trims the free slots at the end, keeping room for base + byte of every state.
+    size_t num_slots = 0;
+    for (auto state : order) {
+        num_slots = std::max<size_t>({num_slots, state + size_t(1),
+                                      base[state] + kAlphabetSize});
+    }
+    base.resize(num_slots, 0);
+    check.resize(num_slots, DoubleArrayAutomaton::kNoState);
+    outputs.resize(num_slots, kNoOutput);
+    base.shrink_to_fit();
+    check.shrink_to_fit();
+    outputs.shrink_to_fit();
+
+    // Links the states in breadth-first order, so that those of shallower states are complete.
+    auto &suffix_links = automaton->suffix_links_;
+    suffix_links.assign(num_slots, kRoot);
+    for (size_t idx = 1; idx < order.size(); ++idx) {
+        auto state = order[idx];
+        auto parent = check[state];
+        if (parent != kRoot) {
+            auto byte = static_cast<uint8_t>(state - base[parent]);
+            suffix_links[state] = DoubleArrayAutomaton::Step(
+                base.data(), check.data(), suffix_links.data(), suffix_links[parent], byte);
+        }
+
+        auto linked = outputs[suffix_links[state]];
+        if (outputs[state] == kNoOutput) {
+            outputs[state] = linked;
+        } else {
+            auto last = outputs[state];
+            while (output_links[last] != kNoOutput) {
+                ++last;
+            }
+            output_links[last] = linked;
+        }
+    }
+
+    automaton->num_states_ = order.size();
+    for (const auto &word : words_) {
+        automaton->max_length_ = std::max(automaton->max_length_, word.size());
+    }
+    return automaton;
+}
+
+}  // namespace aho_corasick
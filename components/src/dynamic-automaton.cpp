@@ -0,0 +1,210 @@
+#include "dynamic-automaton.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+namespace aho_corasick {
+
+namespace {
+
+std::shared_ptr<const Automaton> BuildFrom(
+    const std::vector<std::pair<std::string, size_t>> &strings, const BuildOptions &options) {
+    AutomatonBuilder builder;
+    for (const auto &[string, id] : strings) {
+        builder.Add(string, id);
+    }
+    return builder.Build(options);
+}
+
+}  // namespace
+
+void DynamicSnapshot::FindAll(std::string_view text, std::vector<Match> *matches) const {
+    matches->clear();
+    Scan(text, [matches](size_t pattern_id, size_t end) {
+        matches->push_back({pattern_id, end});
+    });
+}
+
+DynamicAutomaton::DynamicAutomaton() : DynamicAutomaton(Options{}) {
+}
+
+DynamicAutomaton::DynamicAutomaton(Options options) : options_(std::move(options)) {
+    if (options_.build.match_kind != MatchKind::kAll) {
+        throw std::runtime_error("DynamicAutomaton requires MatchKind::kAll");
+    }
+    base_ = BuildFrom({}, options_.build);
+    delta_ = base_;
+    Publish();
+}
+
+DynamicAutomaton::~DynamicAutomaton() {
+    if (merge_thread_.joinable()) {
+        merge_thread_.join();
+    }
+}
+
+void DynamicAutomaton::Add(const std::string &string, size_t id) {
+    Update({}, {{string, id}});
+}
+
+void DynamicAutomaton::Remove(size_t id) {
+    Update({id}, {});
+}
+
+void DynamicAutomaton::Update(const std::vector<size_t> &removed_ids,
+                              const std::vector<std::pair<std::string, size_t>> &added) {
+    std::vector<Change> changes;
+    for (auto id : removed_ids) {
+        changes.push_back({ChangeKind::kRemove, {}, id});
+    }
+    for (const auto &[string, id] : added) {
+        changes.push_back({ChangeKind::kAdd, string, id});
+    }
+
+    std::unique_lock lock(mutex_);
+    RethrowMergeError();
+    for (const auto &change : changes) {
+        Apply(change);
+    }
+    if (merging_) {
+        changes_during_merge_.insert(changes_during_merge_.end(), changes.begin(), changes.end());
+    }
+    RebuildDelta();
+    Publish();
+
+    if (NeedsMerge()) {
+        StartMerge(&lock);
+    }
+}
+
+void DynamicAutomaton::Merge() {
+    std::unique_lock lock(mutex_);
+    merged_.wait(lock, [this] { return !merging_; });
+    RethrowMergeError();
+    StartMerge(&lock);
+    merged_.wait(lock, [this] { return !merging_; });
+    RethrowMergeError();
+}
+
+std::shared_ptr<const DynamicSnapshot> DynamicAutomaton::GetSnapshot() const {
+    return std::atomic_load(&snapshot_);
+}
+
+DynamicAutomaton::Stats DynamicAutomaton::GetStats() const {
+    std::lock_guard lock(mutex_);
+    return {base_strings_.size(), delta_strings_.size(), removed_.size(), merges_};
+}
+
+void DynamicAutomaton::Apply(const Change &change) {
+    if (change.kind == ChangeKind::kAdd) {
+        delta_strings_.emplace_back(change.string, change.id);
+        return;
+    }
+
+    auto matches_id = [&change](const auto &entry) { return entry.second == change.id; };
+    delta_strings_.erase(std::remove_if(delta_strings_.begin(), delta_strings_.end(), matches_id),
+                         delta_strings_.end());
+    if (base_id_counts_.count(change.id) != 0) {
+        removed_.insert(change.id);
+    }
+}
+
+void DynamicAutomaton::RebuildDelta() {
+    delta_ = BuildFrom(delta_strings_, options_.build);
+}
+
+void DynamicAutomaton::Publish() {
+    auto removed = std::make_shared<const std::unordered_set<size_t>>(removed_);
+    std::atomic_store(&snapshot_,
+                      std::shared_ptr<const DynamicSnapshot>(
+                          std::make_shared<DynamicSnapshot>(base_, delta_, std::move(removed))));
+}
+
+bool DynamicAutomaton::NeedsMerge() const {
+    return !merging_ && delta_strings_.size() + removed_.size() >= options_.merge_threshold;
+}
+
+void DynamicAutomaton::StartMerge(std::unique_lock<std::mutex> *lock) {
+    // The thread of the previous merge has already published its result.
+    if (merge_thread_.joinable()) {
+        merge_thread_.join();
+    }
+
+    Strings strings;
+    for (const auto &entry : base_strings_) {
+        if (removed_.count(entry.second) == 0) {
+            strings.push_back(entry);
+        }
+    }
+    strings.insert(strings.end(), delta_strings_.begin(), delta_strings_.end());
+
+    merging_ = true;
+    changes_during_merge_.clear();
+
+    auto merge = [this](Strings strings) {
+        std::shared_ptr<const Automaton> base;
+        try {
+            base = options_.build_base ? options_.build_base(strings, options_.build)
+                                       : BuildFrom(strings, options_.build);
+        } catch (...) {
+            AbortMerge(std::current_exception());
+            if (!options_.background_merge) {
+                throw;
+            }
+            return;
+        }
+        FinishMerge(std::move(strings), std::move(base));
+    };
+    if (options_.background_merge) {
+        merge_thread_ = std::thread(merge, std::move(strings));
+    } else {
+        lock->unlock();
+        merge(std::move(strings));
+        lock->lock();
+    }
+}
+
+void DynamicAutomaton::FinishMerge(Strings strings, std::shared_ptr<const Automaton> base) {
+    std::lock_guard lock(mutex_);
+    base_ = std::move(base);
+    base_strings_ = std::move(strings);
+    base_id_counts_.clear();
+    for (const auto &entry : base_strings_) {
+        ++base_id_counts_[entry.second];
+    }
+
+    // Replays what changed while the base was being built onto it.
+    removed_.clear();
+    delta_strings_.clear();
+    for (const auto &change : changes_during_merge_) {
+        Apply(change);
+    }
+    changes_during_merge_.clear();
+    merging_ = false;
+    ++merges_;
+
+    RebuildDelta();
+    Publish();
+    merged_.notify_all();
+}
+
+void DynamicAutomaton::AbortMerge(std::exception_ptr error) {
+    std::lock_guard lock(mutex_);
+    // The changes made during the merge have been applied to the delta and the removed ids as
+    // well, which thus hold every change since the current base, ready for the next merge.
+    changes_during_merge_.clear();
+    merging_ = false;
+    if (options_.background_merge) {
+        merge_error_ = std::move(error);
+    }
+    merged_.notify_all();
+}
+
+void DynamicAutomaton::RethrowMergeError() {
+    if (merge_error_) {
+        std::rethrow_exception(std::exchange(merge_error_, nullptr));
+    }
+}
+
+}  // namespace aho_corasick
@@ -0,0 +1,61 @@
+#include "mapped-file.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace byte_streams {
+
+namespace {
+
+int Advice(MappedFile::Access access) {
+    switch (access) {
+        case MappedFile::Access::kSequential:
+            return MADV_SEQUENTIAL;
+        case MappedFile::Access::kRandom:
+            return MADV_RANDOM;
+        case MappedFile::Access::kWillNeed:
+            return MADV_WILLNEED;
+    }
+    return MADV_NORMAL;
+}
+
+}  // namespace
+
+MappedFile::MappedFile(const std::string& path, Access access) {
+    int descriptor = open(path.c_str(), O_RDONLY);
+    if (descriptor < 0) {
+        throw std::runtime_error("cannot open " + path + ": " + std::strerror(errno));
+    }
+
+    struct stat status;
+    if (fstat(descriptor, &status) != 0) {
+        close(descriptor);
+        throw std::runtime_error("cannot stat " + path + ": " + std::strerror(errno));
+    }
+    size_ = status.st_size;
+
+    // An empty file cannot be mapped and is left as an empty view.
+    if (size_ > 0) {
+        void* address = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (address == MAP_FAILED) {
+            close(descriptor);
+            throw std::runtime_error("cannot map " + path + ": " + std::strerror(errno));
+        }
+        madvise(address, size_, Advice(access));
+        data_ = static_cast<const char*>(address);
+    }
+    close(descriptor);
+}
+
+MappedFile::~MappedFile() {
+    if (data_ != nullptr) {
+        munmap(const_cast<char*>(data_), size_);
+    }
+}
+
+}  // namespace byte_streams
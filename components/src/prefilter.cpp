@@ -0,0 +1,156 @@
+#include "prefilter.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PREFILTER_X86
+#include <immintrin.h>
+#endif
+
+namespace aho_corasick {
+
+namespace {
+
+constexpr uint8_t kAllBuckets = 0xff;
+
+using FindFunction = size_t (*)(const PrefixFilter::Masks* masks, size_t length,
+                                const uint8_t* data, size_t begin, size_t size);
+
+size_t FindScalar(const PrefixFilter::Masks* masks, size_t length, const uint8_t* data,
+                  size_t begin, size_t size) {
+    for (size_t position = begin; position < size; ++position) {
+        uint8_t buckets = kAllBuckets;
+        for (size_t idx = 0; idx < length && position + idx < size; ++idx) {
+            auto byte = data[position + idx];
+            buckets &= masks[idx].low[byte & 0x0f] & masks[idx].high[byte >> 4];
+        }
+        if (buckets != 0) {
+            return position;
+        }
+    }
+    return size;
+}
+
+#ifdef PREFILTER_X86
+
+__attribute__((target("ssse3"))) size_t FindSSSE3(const PrefixFilter::Masks* masks,
+                                                  size_t length, const uint8_t* data,
+                                                  size_t begin, size_t size) {
+    __m128i low[PrefixFilter::kMaxLength], high[PrefixFilter::kMaxLength];
+    for (size_t idx = 0; idx < length; ++idx) {
+        low[idx] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(masks[idx].low.data()));
+        high[idx] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(masks[idx].high.data()));
+    }
+    const auto nibble = _mm_set1_epi8(0x0f);
+
+    size_t position = begin;
+    for (; position + 16 + length - 1 <= size; position += 16) {
+        auto buckets = _mm_set1_epi8(static_cast<char>(kAllBuckets));
+        for (size_t idx = 0; idx < length; ++idx) {
+            auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + position + idx));
+            auto low_nibbles = _mm_and_si128(bytes, nibble);
+            auto high_nibbles = _mm_and_si128(_mm_srli_epi16(bytes, 4), nibble);
+            buckets = _mm_and_si128(buckets, _mm_shuffle_epi8(low[idx], low_nibbles));
+            buckets = _mm_and_si128(buckets, _mm_shuffle_epi8(high[idx], high_nibbles));
+        }
+        auto empty = _mm_movemask_epi8(_mm_cmpeq_epi8(buckets, _mm_setzero_si128()));
+        if (empty != 0xffff) {
+            return position + __builtin_ctz(~empty);
+        }
+    }
+    return FindScalar(masks, length, data, position, size);
+}
+
+__attribute__((target("avx2"))) size_t FindAVX2(const PrefixFilter::Masks* masks, size_t length,
+                                                const uint8_t* data, size_t begin, size_t size) {
+    // The shuffle works within 128-bit lanes, so both lanes get the whole table.
+    __m256i low[PrefixFilter::kMaxLength], high[PrefixFilter::kMaxLength];
+    for (size_t idx = 0; idx < length; ++idx) {
+        low[idx] = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(masks[idx].low.data())));
+        high[idx] = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(masks[idx].high.data())));
+    }
+    const auto nibble = _mm256_set1_epi8(0x0f);
+
+    size_t position = begin;
+    for (; position + 32 + length - 1 <= size; position += 32) {
+        auto buckets = _mm256_set1_epi8(static_cast<char>(kAllBuckets));
+        for (size_t idx = 0; idx < length; ++idx) {
+            auto bytes =
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + position + idx));
+            auto low_nibbles = _mm256_and_si256(bytes, nibble);
+            auto high_nibbles = _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble);
+            buckets = _mm256_and_si256(buckets, _mm256_shuffle_epi8(low[idx], low_nibbles));
+            buckets = _mm256_and_si256(buckets, _mm256_shuffle_epi8(high[idx], high_nibbles));
+        }
+        auto empty = static_cast<uint32_t>(
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(buckets, _mm256_setzero_si256())));
+        if (empty != 0xffffffff) {
+            return position + __builtin_ctz(~empty);
+        }
+    }
+    return FindScalar(masks, length, data, position, size);
+}
+
+#endif
+
+FindFunction GetFind() {
+    static const FindFunction find = [] {
+        FindFunction detected = FindScalar;
+#ifdef PREFILTER_X86
+        if (__builtin_cpu_supports("avx2")) {
+            detected = FindAVX2;
+        } else if (__builtin_cpu_supports("ssse3")) {
+            detected = FindSSSE3;
+        }
+#endif
+        return detected;
+    }();
+    return find;
+}
+
+}  // namespace
+
+PrefixFilter::PrefixFilter(const std::vector<std::string>& strings) {
+    length_ = kMaxLength;
+    for (const auto& string : strings) {
+        if (string.empty()) {
+            throw std::runtime_error("prefilter of an empty string");
+        }
+        length_ = std::min(length_, string.size());
+    }
+
+    // Strings with the same prefix share a bucket, and neighbouring prefixes, which often
+    // share their first bytes, mostly do as well.
+    std::vector<std::string> prefixes;
+    for (const auto& string : strings) {
+        prefixes.push_back(string.substr(0, length_));
+    }
+    std::sort(prefixes.begin(), prefixes.end());
+    prefixes.erase(std::unique(prefixes.begin(), prefixes.end()), prefixes.end());
+
+    for (size_t rank = 0; rank < prefixes.size(); ++rank) {
+        uint8_t bucket = 1 << (rank * 8 / prefixes.size());
+        for (size_t idx = 0; idx < length_; ++idx) {
+            auto byte = static_cast<uint8_t>(prefixes[rank][idx]);
+            masks_[idx].low[byte & 0x0f] |= bucket;
+            masks_[idx].high[byte >> 4] |= bucket;
+        }
+    }
+}
+
+PrefixFilter::PrefixFilter(size_t length, const std::array<Masks, kMaxLength>& masks)
+    : length_(length), masks_(masks) {
+    if (length == 0 || length > kMaxLength) {
+        throw std::runtime_error("invalid prefilter length");
+    }
+}
+
+size_t PrefixFilter::Find(std::string_view text, size_t begin) const {
+    return GetFind()(masks_.data(), length_, reinterpret_cast<const uint8_t*>(text.data()), begin,
+                     text.size());
+}
+
+}  // namespace aho_corasick
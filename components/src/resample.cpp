@@ -0,0 +1,286 @@
+#include "resample.h"
+
+#include <cmath>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RESAMPLE_X86
+#include <immintrin.h>
+#endif
+
+namespace resample {
+
+namespace {
+
+// Pixels are processed as four floats, the last one unused, so that a pixel fills an SSE
+// register in the horizontal pass.
+constexpr size_t kChannels = 4;
+
+double Support(Filter filter) {
+    switch (filter) {
+        case Filter::kBox:
+            return 0.5;
+        case Filter::kBilinear:
+            return 1.0;
+        case Filter::kLanczos3:
+            return 3.0;
+    }
+    throw std::runtime_error("unknown filter");
+}
+
+double Sinc(double x) {
+    if (x == 0.0) {
+        return 1.0;
+    }
+    const double pi = std::atan(1.0) * 4;
+    return std::sin(pi * x) / (pi * x);
+}
+
+double Evaluate(Filter filter, double x) {
+    switch (filter) {
+        case Filter::kBox:
+            return (x >= -0.5 && x < 0.5) ? 1.0 : 0.0;
+        case Filter::kBilinear:
+            return std::max(0.0, 1.0 - std::abs(x));
+        case Filter::kLanczos3:
+            return std::abs(x) < 3.0 ? Sinc(x) * Sinc(x / 3.0) : 0.0;
+    }
+    throw std::runtime_error("unknown filter");
+}
+
+// Filter taps of every output position along one axis. Position out reads the size inputs
+// starting at first[out], weighted by weights[out * size + k]. Positions near an edge, where
+// the filter is cut off, have zero weights and are renormalized.
+struct Taps {
+    std::vector<size_t> first;
+    std::vector<float> weights;
+    size_t size = 0;
+};
+
+Taps ComputeTaps(Filter filter, size_t in_size, size_t out_size) {
+    double ratio = static_cast<double>(in_size) / out_size;
+    double scale = std::max(ratio, 1.0);
+    double support = Support(filter) * scale;
+
+    Taps taps;
+    taps.size = std::min<size_t>(std::ceil(2 * support) + 2, in_size);
+    taps.first.resize(out_size);
+    taps.weights.assign(out_size * taps.size, 0.0f);
+
+    std::vector<double> weights;
+    for (size_t out = 0; out < out_size; ++out) {
+        double center = (out + 0.5) * ratio;
+        auto begin = static_cast<ptrdiff_t>(std::floor(center - support));
+        auto end = static_cast<ptrdiff_t>(std::ceil(center + support));
+        begin = std::max<ptrdiff_t>(begin, 0);
+        end = std::min<ptrdiff_t>(end, in_size);
+
+        weights.clear();
+        double total = 0.0;
+        for (auto in = begin; in < end; ++in) {
+            weights.push_back(Evaluate(filter, (in + 0.5 - center) / scale));
+            total += weights.back();
+        }
+
+        size_t first = std::min<size_t>(begin, in_size - taps.size);
+        taps.first[out] = first;
+
+        float* row = taps.weights.data() + out * taps.size + (begin - first);
+        for (size_t idx = 0; idx < weights.size(); ++idx) {
+            row[idx] = static_cast<float>(weights[idx] / total);
+        }
+    }
+    return taps;
+}
+
+void HorizontalScalar(const float* input, const Taps& taps, size_t out_width, float* output) {
+    for (size_t x = 0; x < out_width; ++x) {
+        const float* weights = taps.weights.data() + x * taps.size;
+        const float* pixels = input + taps.first[x] * kChannels;
+
+        float sum[kChannels] = {};
+        for (size_t k = 0; k < taps.size; ++k) {
+            for (size_t channel = 0; channel < kChannels; ++channel) {
+                sum[channel] += weights[k] * pixels[k * kChannels + channel];
+            }
+        }
+        std::copy(sum, sum + kChannels, output + x * kChannels);
+    }
+}
+
+// Sums the rows of the taps, weighted, over count floats.
+void VerticalScalar(const float* const* rows, const float* weights, size_t num_rows,
+                    size_t count, float* output) {
+    std::fill(output, output + count, 0.0f);
+    for (size_t k = 0; k < num_rows; ++k) {
+        for (size_t idx = 0; idx < count; ++idx) {
+            output[idx] += weights[k] * rows[k][idx];
+        }
+    }
+}
+
+#ifdef RESAMPLE_X86
+
+// Same operation order per lane as the scalar passes, without fused multiply-adds, so the
+// results are identical.
+__attribute__((target("sse2"))) void HorizontalSSE2(const float* input, const Taps& taps,
+                                                    size_t out_width, float* output) {
+    for (size_t x = 0; x < out_width; ++x) {
+        const float* weights = taps.weights.data() + x * taps.size;
+        const float* pixels = input + taps.first[x] * kChannels;
+
+        __m128 sum = _mm_setzero_ps();
+        for (size_t k = 0; k < taps.size; ++k) {
+            auto pixel = _mm_loadu_ps(pixels + k * kChannels);
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), pixel));
+        }
+        _mm_storeu_ps(output + x * kChannels, sum);
+    }
+}
+
+__attribute__((target("avx2"))) void VerticalAVX2(const float* const* rows, const float* weights,
+                                                  size_t num_rows, size_t count, float* output) {
+    size_t idx = 0;
+    for (; idx + 8 <= count; idx += 8) {
+        __m256 sum = _mm256_setzero_ps();
+        for (size_t k = 0; k < num_rows; ++k) {
+            auto values = _mm256_loadu_ps(rows[k] + idx);
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(weights[k]), values));
+        }
+        _mm256_storeu_ps(output + idx, sum);
+    }
+
+    for (; idx < count; ++idx) {
+        float sum = 0.0f;
+        for (size_t k = 0; k < num_rows; ++k) {
+            sum += weights[k] * rows[k][idx];
+        }
+        output[idx] = sum;
+    }
+}
+
+#endif
+
+struct Passes {
+    void (*horizontal)(const float* input, const Taps& taps, size_t out_width, float* output);
+    void (*vertical)(const float* const* rows, const float* weights, size_t num_rows,
+                     size_t count, float* output);
+};
+
+const Passes kScalarPasses{HorizontalScalar, VerticalScalar};
+
+const Passes& GetPasses() {
+    static const Passes passes = [] {
+        Passes detected = kScalarPasses;
+#ifdef RESAMPLE_X86
+        if (__builtin_cpu_supports("sse2")) {
+            detected.horizontal = HorizontalSSE2;
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            detected.vertical = VerticalAVX2;
+        }
+#endif
+        return detected;
+    }();
+    return passes;
+}
+
+// Calls function(begin, end) for consecutive bands of [0, num_rows), one per thread.
+template <class Function>
+void ForEachBand(size_t num_threads, size_t num_rows, Function function) {
+    num_threads = std::min(std::max<size_t>(num_threads, 1), num_rows);
+    if (num_threads <= 1) {
+        function(size_t(0), num_rows);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    for (size_t thread_idx = 0; thread_idx < num_threads; ++thread_idx) {
+        threads.emplace_back(function, num_rows * thread_idx / num_threads,
+                             num_rows * (thread_idx + 1) / num_threads);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+int ToByte(float value) {
+    return std::clamp(static_cast<int>(std::lround(value)), 0, 255);
+}
+
+}  // namespace
+
+Image Resize(const Image& image, size_t width, size_t height, const ResizeOptions& options) {
+    if (width == 0 || height == 0) {
+        throw std::runtime_error("resize to an empty image");
+    }
+    if (image.Width() == 0 || image.Height() == 0) {
+        throw std::runtime_error("resize of an empty image");
+    }
+
+    const auto& passes = options.use_simd ? GetPasses() : kScalarPasses;
+    auto horizontal = ComputeTaps(options.filter, image.Width(), width);
+    auto vertical = ComputeTaps(options.filter, image.Height(), height);
+
+    // Input rows filtered horizontally, each width pixels long.
+    const size_t row_size = width * kChannels;
+    std::vector<float> filtered(image.Height() * row_size);
+
+    ForEachBand(options.num_threads, image.Height(), [&](size_t begin, size_t end) {
+        std::vector<float> row(image.Width() * kChannels, 0.0f);
+        for (size_t y = begin; y < end; ++y) {
+            for (size_t x = 0; x < image.Width(); ++x) {
+                auto pixel = image.GetPixel(y, x);
+                row[x * kChannels] = pixel.r;
+                row[x * kChannels + 1] = pixel.g;
+                row[x * kChannels + 2] = pixel.b;
+            }
+            passes.horizontal(row.data(), horizontal, width, filtered.data() + y * row_size);
+        }
+    });
+
+    Image resized(width, height);
+    resized.SetComment(image.GetComment());
+
+    ForEachBand(options.num_threads, height, [&](size_t begin, size_t end) {
+        std::vector<float> row(row_size);
+        std::vector<const float*> rows(vertical.size);
+        for (size_t y = begin; y < end; ++y) {
+            for (size_t k = 0; k < vertical.size; ++k) {
+                rows[k] = filtered.data() + (vertical.first[y] + k) * row_size;
+            }
+            passes.vertical(rows.data(), vertical.weights.data() + y * vertical.size,
+                            vertical.size, row_size, row.data());
+
+            for (size_t x = 0; x < width; ++x) {
+                const float* pixel = row.data() + x * kChannels;
+                resized.SetPixel(y, x, {ToByte(pixel[0]), ToByte(pixel[1]), ToByte(pixel[2])});
+            }
+        }
+    });
+
+    return resized;
+}
+
+Image Thumbnail(const Image& image, size_t max_width, size_t max_height,
+                const ResizeOptions& options) {
+    size_t width = image.Width(), height = image.Height();
+    if (width <= max_width && height <= max_height) {
+        return image;
+    }
+
+    // Compares the aspect ratios without rounding to see which side limits the size.
+    if (width * max_height > height * max_width) {
+        height = std::max<size_t>((height * max_width + width / 2) / width, 1);
+        width = max_width;
+    } else {
+        width = std::max<size_t>((width * max_height + height / 2) / height, 1);
+        height = max_height;
+    }
+    return Resize(image, width, height, options);
+}
+
+}  // namespace resample
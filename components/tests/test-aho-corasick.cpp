@@ -1,9 +1,24 @@
+#include <random>
+#include <string>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <numeric>
+#include <optional>
+#include <mutex>
+#include <atomic>
+#include <sstream>
+#include <thread>
+#include <tuple>
 #include <vector>
+#include <algorithm>
 
 #include <gtest/gtest.h>
 
 #include "itertools.h"
 #include "aho-corasick.h"
+#include "dynamic-automaton.h"
+#include "double-array-automaton.h"
 
 TEST(Automaton, Build) {
     std::vector<std::string> for_trie = {"a", "ab", "bb", "bz"};
@@ -32,3 +47,999 @@ TEST(Automaton, Build) {
         }
     }
 }
+
+std::string RandomString(std::mt19937* generator, const std::string& alphabet, size_t length) {
+    std::uniform_int_distribution<size_t> letter(0, alphabet.size() - 1);
+    std::string result;
+    for (size_t idx = 0; idx < length; ++idx) {
+        result.push_back(alphabet[letter(*generator)]);
+    }
+    return result;
+}
+
+// Sorted ids of the patterns which end at every position of the text.
+std::vector<std::vector<size_t>> NaiveMatches(const std::vector<std::string>& patterns,
+                                              const std::string& text) {
+    std::vector<std::vector<size_t>> matches(text.size());
+    for (size_t id = 0; id < patterns.size(); ++id) {
+        const auto& pattern = patterns[id];
+        for (size_t end = pattern.size(); end <= text.size(); ++end) {
+            if (text.compare(end - pattern.size(), pattern.size(), pattern) == 0) {
+                matches[end - 1].push_back(id);
+            }
+        }
+    }
+    return matches;
+}
+
+// Sorted ids of the patterns which the automaton reports at every position of the text.
+std::vector<std::vector<size_t>> AutomatonMatches(const aho_corasick::Automaton& automaton,
+                                                  const std::string& text) {
+    std::vector<std::vector<size_t>> matches(text.size());
+    auto state = automaton.Root();
+    for (size_t position = 0; position < text.size(); ++position) {
+        state = state.Next(text[position]);
+        state.TraverseTerminal([&](size_t id) { matches[position].push_back(id); });
+        std::sort(matches[position].begin(), matches[position].end());
+    }
+    return matches;
+}
+
+TEST(Automaton, MatchesNaiveSearch) {
+    // Bytes above 0x7f check that negative chars index the transitions correctly.
+    const std::string alphabet = "abc\x80\xff";
+    std::mt19937 generator(5);
+    std::uniform_int_distribution<size_t> length(1, 6);
+
+    std::vector<std::string> patterns;
+    auto builder = aho_corasick::AutomatonBuilder();
+    for (size_t id = 0; id < 60; ++id) {
+        patterns.push_back(RandomString(&generator, alphabet, length(generator)));
+        builder.Add(patterns.back(), id);
+    }
+
+    auto text = RandomString(&generator, alphabet, 5000);
+    auto expected = NaiveMatches(patterns, text);
+
+    for (bool precompute : {true, false}) {
+        auto automaton = builder.Build({precompute});
+        auto actual = AutomatonMatches(*automaton, text);
+        for (size_t position = 0; position < text.size(); ++position) {
+            ASSERT_EQ(expected[position], actual[position]) << "at " << position;
+        }
+    }
+}
+
+TEST(Automaton, SharedBetweenThreads) {
+    std::mt19937 generator(6);
+    std::uniform_int_distribution<size_t> length(1, 8);
+
+    std::vector<std::string> patterns;
+    auto builder = aho_corasick::AutomatonBuilder();
+    for (size_t id = 0; id < 200; ++id) {
+        patterns.push_back(RandomString(&generator, "abcd", length(generator)));
+        builder.Add(patterns.back(), id);
+    }
+
+    for (bool precompute : {true, false}) {
+        std::shared_ptr<const aho_corasick::Automaton> automaton = builder.Build({precompute});
+
+        std::vector<std::string> texts;
+        for (size_t thread_idx = 0; thread_idx < 4; ++thread_idx) {
+            texts.push_back(RandomString(&generator, "abcd", 20000));
+        }
+
+        std::vector<std::vector<std::vector<size_t>>> results(texts.size());
+        std::vector<std::thread> threads;
+        for (size_t thread_idx = 0; thread_idx < texts.size(); ++thread_idx) {
+            threads.emplace_back([&, thread_idx] {
+                results[thread_idx] = AutomatonMatches(*automaton, texts[thread_idx]);
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        for (size_t thread_idx = 0; thread_idx < texts.size(); ++thread_idx) {
+            ASSERT_EQ(NaiveMatches(patterns, texts[thread_idx]), results[thread_idx]);
+        }
+    }
+}
+
+TEST(Automaton, FindAll) {
+    std::mt19937 generator(7);
+    std::uniform_int_distribution<size_t> length(1, 5);
+
+    std::vector<std::string> patterns;
+    auto builder = aho_corasick::AutomatonBuilder();
+    for (size_t id = 0; id < 40; ++id) {
+        patterns.push_back(RandomString(&generator, "xyz\xfe", length(generator)));
+        builder.Add(patterns.back(), id);
+    }
+    auto automaton = builder.Build();
+
+    std::vector<aho_corasick::Match> matches;
+    for (size_t text_length : {3000, 100, 0}) {
+        auto text = RandomString(&generator, "xyz\xfe", text_length);
+        automaton->FindAll(text, &matches);
+
+        std::vector<std::vector<size_t>> actual(text.size());
+        for (size_t idx = 0; idx < matches.size(); ++idx) {
+            ASSERT_GT(matches[idx].end, 0);
+            ASSERT_LE(matches[idx].end, text.size());
+            if (idx > 0) {
+                ASSERT_LE(matches[idx - 1].end, matches[idx].end);
+            }
+            actual[matches[idx].end - 1].push_back(matches[idx].pattern_id);
+        }
+        for (auto& ids : actual) {
+            std::sort(ids.begin(), ids.end());
+        }
+        ASSERT_EQ(NaiveMatches(patterns, text), actual);
+
+        size_t num_scanned = 0;
+        automaton->Scan(text, [&](size_t pattern_id, size_t end) {
+            ASSERT_EQ(matches[num_scanned], (aho_corasick::Match{pattern_id, end}));
+            ++num_scanned;
+        });
+        ASSERT_EQ(matches.size(), num_scanned);
+    }
+}
+
+TEST(Automaton, ParallelMatchesSequential) {
+    std::mt19937 generator(8);
+    std::uniform_int_distribution<size_t> length(1, 9);
+
+    auto builder = aho_corasick::AutomatonBuilder();
+    for (size_t id = 0; id < 80; ++id) {
+        builder.Add(RandomString(&generator, "ab", length(generator)), id);
+    }
+    auto automaton = builder.Build();
+    ASSERT_EQ(automaton->MaxLength(), 9);
+
+    auto text = RandomString(&generator, "ab", 50000);
+    std::vector<aho_corasick::Match> expected, actual;
+    automaton->FindAll(text, &expected);
+
+    for (size_t chunk_size : {1, 5, 8, 9, 1000, 100000}) {
+        for (size_t num_threads : {1, 3}) {
+            aho_corasick::Automaton::ParallelScanOptions options{num_threads, chunk_size};
+            automaton->FindAllParallel(text, options, &actual);
+            ASSERT_EQ(expected, actual) << chunk_size << " " << num_threads;
+        }
+    }
+
+    std::mutex mutex;
+    std::vector<std::vector<aho_corasick::Match>> chunks((text.size() + 999) / 1000);
+    automaton->ScanChunks(text, {3, 1000}, [&](size_t chunk_idx, const auto& matches) {
+        std::lock_guard lock(mutex);
+        ASSERT_TRUE(chunks[chunk_idx].empty());
+        chunks[chunk_idx] = matches;
+    });
+    actual.clear();
+    for (const auto& chunk : chunks) {
+        for (const auto& match : chunk) {
+            actual.push_back(match);
+        }
+    }
+    ASSERT_EQ(expected, actual);
+
+    auto failing = [](size_t chunk_idx, const auto&) {
+        if (chunk_idx == 7) {
+            throw std::runtime_error("stop");
+        }
+    };
+    ASSERT_THROW(automaton->ScanChunks(text, {3, 1000}, failing), std::runtime_error);
+    ASSERT_THROW(automaton->FindAllParallel(text, {1, 0}, &actual), std::runtime_error);
+}
+
+TEST(StreamMatcher, SpansPieces) {
+    std::mt19937 generator(9);
+    std::uniform_int_distribution<size_t> length(1, 7);
+
+    std::vector<std::string> patterns;
+    auto builder = aho_corasick::AutomatonBuilder();
+    for (size_t id = 0; id < 50; ++id) {
+        patterns.push_back(RandomString(&generator, "abc", length(generator)));
+        builder.Add(patterns.back(), id);
+    }
+    auto automaton = builder.Build();
+
+    auto text = RandomString(&generator, "abc", 20000);
+    std::vector<aho_corasick::Match> expected;
+    automaton->FindAll(text, &expected);
+
+    using Occurrence = std::tuple<size_t, uint64_t, uint64_t>;
+    std::vector<Occurrence> actual;
+    auto on_match = [&](size_t pattern_id, uint64_t start, uint64_t end) {
+        actual.emplace_back(pattern_id, start, end);
+    };
+    auto check = [&] {
+        ASSERT_EQ(expected.size(), actual.size());
+        for (size_t idx = 0; idx < expected.size(); ++idx) {
+            auto [pattern_id, start, end] = actual[idx];
+            ASSERT_EQ(expected[idx], (aho_corasick::Match{pattern_id, end}));
+            ASSERT_EQ(text.substr(start, end - start), patterns[pattern_id]);
+        }
+    };
+
+    aho_corasick::StreamMatcher matcher(*automaton);
+    std::uniform_int_distribution<size_t> piece_size(0, 10);
+    for (size_t position = 0; position < text.size();) {
+        auto size = std::min(piece_size(generator), text.size() - position);
+        matcher.Feed(std::string_view(text).substr(position, size), on_match);
+        position += size;
+    }
+    ASSERT_EQ(matcher.Offset(), text.size());
+    check();
+
+    actual.clear();
+    matcher.Reset();
+    std::istringstream stream(text);
+    matcher.Feed(stream, on_match, 333);
+    ASSERT_EQ(matcher.Offset(), text.size());
+    check();
+}
+
+TEST(Automaton, ByteClasses) {
+    std::mt19937 generator(10);
+
+    auto builder = aho_corasick::AutomatonBuilder();
+    std::vector<std::string> patterns = {"ab", "ba", "aab", "b"};
+    for (size_t id = 0; id < patterns.size(); ++id) {
+        builder.Add(patterns[id], id);
+    }
+    auto automaton = builder.Build();
+    ASSERT_EQ(automaton->NumClasses(), 3);
+    // Rows of 3 classes are padded to 4 entries.
+    ASSERT_EQ(automaton->GetMemoryUsage().transition_bytes,
+              automaton->NumStates() * 4 * sizeof(aho_corasick::Automaton::StateId));
+
+    // Bytes outside the patterns share one class and restart the matching.
+    auto text = RandomString(&generator, "abxy\x80", 3000);
+    ASSERT_EQ(NaiveMatches(patterns, text), AutomatonMatches(*automaton, text));
+
+    // With every byte in some string each byte is a class of its own.
+    std::string all_bytes;
+    for (int byte = 0; byte < 256; ++byte) {
+        all_bytes.push_back(static_cast<char>(byte));
+    }
+    patterns.clear();
+    builder = aho_corasick::AutomatonBuilder();
+    for (size_t id = 0; id < 300; ++id) {
+        patterns.push_back(RandomString(&generator, all_bytes, 2));
+        builder.Add(patterns.back(), id);
+    }
+    patterns.push_back(all_bytes);
+    builder.Add(all_bytes, patterns.size() - 1);
+    automaton = builder.Build();
+    ASSERT_EQ(automaton->NumClasses(), 256);
+
+    text = RandomString(&generator, all_bytes, 100000) + all_bytes;
+    ASSERT_EQ(NaiveMatches(patterns, text), AutomatonMatches(*automaton, text));
+
+    automaton = aho_corasick::AutomatonBuilder().Build();
+    ASSERT_EQ(automaton->NumClasses(), 1);
+    ASSERT_EQ(AutomatonMatches(*automaton, "abc"), std::vector<std::vector<size_t>>(3));
+}
+
+TEST(Prefilter, NoFalseNegatives) {
+    std::mt19937 generator(11);
+    for (size_t round = 0; round < 50; ++round) {
+        std::uniform_int_distribution<size_t> length(1 + round % 4, 6);
+        std::vector<std::string> patterns;
+        for (size_t id = 0; id < 1 + round % 20; ++id) {
+            patterns.push_back(RandomString(&generator, "abcdq\x80\xf1", length(generator)));
+        }
+        aho_corasick::PrefixFilter filter(patterns);
+        size_t shortest = std::min_element(patterns.begin(), patterns.end(), [](auto& a, auto& b) {
+                              return a.size() < b.size();
+                          })->size();
+        ASSERT_EQ(filter.Length(), std::min<size_t>(shortest, 3));
+
+        auto text = RandomString(&generator, "abcdefq\x80\xf1\xff", 200 + round);
+        size_t candidate = filter.Find(text, 0);
+        for (size_t start = 0; start < text.size(); ++start) {
+            if (candidate < start) {
+                candidate = filter.Find(text, start);
+            }
+            for (const auto& pattern : patterns) {
+                if (text.compare(start, pattern.size(), pattern) == 0) {
+                    ASSERT_EQ(candidate, start);
+                }
+            }
+        }
+    }
+}
+
+TEST(Prefilter, MatchesUnfilteredScan) {
+    using Prefilter = aho_corasick::BuildOptions::Prefilter;
+    std::mt19937 generator(12);
+
+    for (size_t round = 0; round < 30; ++round) {
+        std::uniform_int_distribution<size_t> length(1 + round % 3, 8);
+        auto builder = aho_corasick::AutomatonBuilder();
+        for (size_t id = 0; id < 1 + round; ++id) {
+            builder.Add(RandomString(&generator, "abcxyz\x90", length(generator)), id);
+        }
+        auto filtered = builder.Build({true, Prefilter::kAlways});
+        auto unfiltered = builder.Build({true, Prefilter::kNever});
+        ASSERT_TRUE(filtered->HasPrefilter());
+        ASSERT_FALSE(unfiltered->HasPrefilter());
+
+        // Mostly bytes outside the patterns, so that long stretches are skipped.
+        std::string text;
+        std::uniform_int_distribution<int> kind(0, 9);
+        for (size_t idx = 0; idx < 5000; ++idx) {
+            text += kind(generator) == 0 ? RandomString(&generator, "abcxyz\x90", 1)
+                                         : RandomString(&generator, "mnop", 1);
+        }
+
+        std::vector<aho_corasick::Match> expected, actual;
+        unfiltered->FindAll(text, &expected);
+        filtered->FindAll(text, &actual);
+        ASSERT_EQ(expected, actual);
+
+        actual.clear();
+        aho_corasick::StreamMatcher matcher(*filtered);
+        for (size_t position = 0; position < text.size(); position += 37) {
+            matcher.Feed(std::string_view(text).substr(position, 37),
+                         [&actual](size_t pattern_id, uint64_t, uint64_t end) {
+                             actual.push_back({pattern_id, end});
+                         });
+        }
+        ASSERT_EQ(expected, actual);
+    }
+
+    auto builder = aho_corasick::AutomatonBuilder();
+    builder.Add("a", 0);
+    ASSERT_TRUE(builder.Build()->HasPrefilter());
+    builder.Add("", 1);
+    ASSERT_FALSE(builder.Build({true, Prefilter::kAlways})->HasPrefilter());
+    for (size_t id = 2; id <= aho_corasick::BuildOptions::kAutoPrefilterStrings; ++id) {
+        builder.Add("b", id);
+    }
+    ASSERT_FALSE(builder.Build()->HasPrefilter());
+}
+
+TEST(AutomatonImage, RoundTrip) {
+    using Prefilter = aho_corasick::BuildOptions::Prefilter;
+    std::mt19937 generator(13);
+    std::uniform_int_distribution<size_t> length(1, 7);
+
+    auto builder = aho_corasick::AutomatonBuilder();
+    for (size_t id = 0; id < 300; ++id) {
+        builder.Add(RandomString(&generator, "abcd\xe0", length(generator)), id * 1000000007);
+    }
+    auto text = RandomString(&generator, "abcdef\xe0", 20000);
+
+    for (auto [precompute, prefilter] : {std::pair{true, Prefilter::kAlways},
+                                         std::pair{false, Prefilter::kNever}}) {
+        auto built = builder.Build({precompute, prefilter});
+        std::ostringstream stream;
+        built->Save(stream);
+        auto image = stream.str();
+
+        auto loaded = aho_corasick::Automaton::FromImage(image);
+        ASSERT_EQ(built->NumStates(), loaded->NumStates());
+        ASSERT_EQ(built->NumClasses(), loaded->NumClasses());
+        ASSERT_EQ(built->MaxLength(), loaded->MaxLength());
+        ASSERT_EQ(built->HasPrefilter(), loaded->HasPrefilter());
+
+        std::vector<aho_corasick::Match> expected, actual;
+        built->FindAll(text, &expected);
+        loaded->FindAll(text, &actual);
+        ASSERT_FALSE(expected.empty());
+        ASSERT_EQ(expected, actual);
+        ASSERT_EQ(AutomatonMatches(*built, text), AutomatonMatches(*loaded, text));
+
+        auto path = testing::TempDir() + "automaton-image-test";
+        {
+            std::ofstream file(path, std::ios::binary);
+            file << image;
+        }
+        auto mapped = aho_corasick::Automaton::Load(path);
+        std::remove(path.c_str());
+        mapped->FindAll(text, &actual);
+        ASSERT_EQ(expected, actual);
+    }
+}
+
+TEST(AutomatonImage, RejectsBrokenImages) {
+    auto builder = aho_corasick::AutomatonBuilder();
+    builder.Add("needle", 0);
+    builder.Add("haystack", 1);
+    std::ostringstream stream;
+    builder.Build()->Save(stream);
+    const auto image = stream.str();
+
+    auto load = [](std::string broken, bool verify_checksum = true) {
+        return aho_corasick::Automaton::FromImage(broken, nullptr, verify_checksum);
+    };
+    ASSERT_NO_THROW(load(image));
+
+    auto corrupted = image;
+    corrupted[corrupted.size() / 2] ^= 1;
+    ASSERT_THROW(load(corrupted), std::runtime_error);
+
+    auto wrong_version = image;
+    wrong_version[8] = 99;
+    ASSERT_THROW(load(wrong_version), std::runtime_error);
+
+    ASSERT_THROW(load(image.substr(0, image.size() - 64), false), std::runtime_error);
+    ASSERT_THROW(load(image.substr(0, 16)), std::runtime_error);
+    ASSERT_THROW(load("not an automaton image, not at all, in any way whatsoever......"),
+                 std::runtime_error);
+    ASSERT_THROW(aho_corasick::Automaton::Load(testing::TempDir() + "no-such-image"),
+                 std::runtime_error);
+}
+
+// Sorted ids of the matches at every position of a text of the given size.
+std::vector<std::vector<size_t>> ByEnd(const std::vector<aho_corasick::Match>& matches,
+                                       size_t size) {
+    std::vector<std::vector<size_t>> result(size);
+    for (const auto& match : matches) {
+        result[match.end - 1].push_back(match.pattern_id);
+    }
+    for (auto& ids : result) {
+        std::sort(ids.begin(), ids.end());
+    }
+    return result;
+}
+
+std::unique_ptr<aho_corasick::Automaton> BuildReference(
+    const std::multimap<size_t, std::string>& strings) {
+    aho_corasick::AutomatonBuilder builder;
+    for (const auto& [id, string] : strings) {
+        builder.Add(string, id);
+    }
+    return builder.Build();
+}
+
+TEST(DynamicAutomaton, MatchesRebuild) {
+    std::mt19937 generator(14);
+    std::uniform_int_distribution<size_t> length(1, 5), id(0, 40), operation(0, 3);
+
+    aho_corasick::DynamicAutomaton::Options options;
+    options.merge_threshold = 16;
+    options.background_merge = false;
+    aho_corasick::DynamicAutomaton automaton(options);
+
+    std::multimap<size_t, std::string> live;
+    auto text = RandomString(&generator, "abc", 2000);
+    std::vector<aho_corasick::Match> expected, actual;
+
+    for (size_t step = 0; step < 300; ++step) {
+        if (operation(generator) == 0) {
+            auto removed = id(generator);
+            automaton.Remove(removed);
+            live.erase(removed);
+        } else if (step % 50 == 49) {
+            std::vector<std::pair<std::string, size_t>> added;
+            std::vector<size_t> removed = {id(generator), id(generator)};
+            for (auto removed_id : removed) {
+                live.erase(removed_id);
+            }
+            for (size_t idx = 0; idx < 5; ++idx) {
+                added.emplace_back(RandomString(&generator, "abc", length(generator)),
+                                   id(generator));
+                live.emplace(added.back().second, added.back().first);
+            }
+            automaton.Update(removed, added);
+        } else {
+            auto string = RandomString(&generator, "abc", length(generator));
+            auto added = id(generator);
+            automaton.Add(string, added);
+            live.emplace(added, string);
+        }
+
+        BuildReference(live)->FindAll(text, &expected);
+        automaton.GetSnapshot()->FindAll(text, &actual);
+        ASSERT_EQ(ByEnd(expected, text.size()), ByEnd(actual, text.size())) << "step " << step;
+    }
+
+    ASSERT_GT(automaton.GetStats().merges, 0);
+    automaton.Merge();
+    auto stats = automaton.GetStats();
+    ASSERT_EQ(stats.base_strings, live.size());
+    ASSERT_EQ(stats.delta_strings, 0);
+    ASSERT_EQ(stats.removed_ids, 0);
+}
+
+TEST(DynamicAutomaton, ScansDuringBackgroundMerges) {
+    aho_corasick::DynamicAutomaton::Options options;
+    options.merge_threshold = 50;
+    aho_corasick::DynamicAutomaton automaton(options);
+
+    std::mt19937 generator(15);
+    auto text = RandomString(&generator, "xyz", 5000);
+
+    std::atomic<bool> done = false;
+    std::atomic<size_t> num_scans = 0;
+    std::thread reader([&] {
+        std::vector<aho_corasick::Match> matches;
+        while (!done) {
+            auto snapshot = automaton.GetSnapshot();
+            snapshot->FindAll(text, &matches);
+            for (const auto& match : matches) {
+                ASSERT_LE(match.end, text.size());
+            }
+            ++num_scans;
+        }
+    });
+
+    std::multimap<size_t, std::string> live;
+    std::uniform_int_distribution<size_t> length(2, 6);
+    for (size_t id = 0; id < 600; ++id) {
+        auto string = RandomString(&generator, "xyz", length(generator));
+        automaton.Add(string, id);
+        live.emplace(id, string);
+        if (id % 3 == 0) {
+            automaton.Remove(id / 2);
+            live.erase(id / 2);
+        }
+    }
+    automaton.Merge();
+    done = true;
+    reader.join();
+
+    ASSERT_GT(num_scans, 0);
+    ASSERT_GT(automaton.GetStats().merges, 1);
+
+    std::vector<aho_corasick::Match> expected, actual;
+    BuildReference(live)->FindAll(text, &expected);
+    automaton.GetSnapshot()->FindAll(text, &actual);
+    ASSERT_EQ(ByEnd(expected, text.size()), ByEnd(actual, text.size()));
+}
+
+TEST(DynamicAutomaton, SurvivesFailedMerges) {
+    for (bool background : {false, true}) {
+        std::atomic<bool> fail = true;
+        aho_corasick::DynamicAutomaton::Options options;
+        options.merge_threshold = 4;
+        options.background_merge = background;
+        options.build_base = [&fail](const auto& strings, const auto& build_options) {
+            if (fail) {
+                throw std::runtime_error("too many automaton states");
+            }
+            aho_corasick::AutomatonBuilder builder;
+            for (const auto& [string, id] : strings) {
+                builder.Add(string, id);
+            }
+            return std::shared_ptr<const aho_corasick::Automaton>(builder.Build(build_options));
+        };
+        aho_corasick::DynamicAutomaton automaton(options);
+
+        std::vector<std::string> strings = {"ab", "bc", "abc", "c"};
+        for (size_t id = 0; id < 3; ++id) {
+            automaton.Add(strings[id], id);
+        }
+        if (background) {
+            automaton.Add(strings[3], 3);
+            ASSERT_THROW(automaton.Merge(), std::runtime_error);
+        } else {
+            ASSERT_THROW(automaton.Add(strings[3], 3), std::runtime_error);
+        }
+
+        auto stats = automaton.GetStats();
+        ASSERT_EQ(stats.merges, 0);
+        ASSERT_EQ(stats.base_strings, 0);
+        ASSERT_EQ(stats.delta_strings, 4);
+        std::vector<aho_corasick::Match> expected = {{0, 2}, {2, 3}, {1, 3}, {3, 3}}, actual;
+        automaton.GetSnapshot()->FindAll("abc", &actual);
+        ASSERT_EQ(expected, actual);
+
+        // Neither the merge state nor the error outlives the failure.
+        fail = false;
+        automaton.Merge();
+        stats = automaton.GetStats();
+        ASSERT_EQ(stats.merges, 1);
+        ASSERT_EQ(stats.base_strings, 4);
+        ASSERT_EQ(stats.delta_strings, 0);
+        automaton.GetSnapshot()->FindAll("abc", &actual);
+        ASSERT_EQ(expected, actual);
+        automaton.Remove(1);
+        ASSERT_EQ(automaton.GetStats().removed_ids, 1);
+    }
+}
+
+TEST(DoubleArrayAutomaton, MatchesAutomaton) {
+    std::mt19937 generator(16);
+    const std::string all_bytes = [] {
+        std::string bytes(256, '\0');
+        std::iota(bytes.begin(), bytes.end(), 0);
+        return bytes;
+    }();
+
+    const std::vector<std::string> alphabets = {"ab", "abcd", std::string("x\0\xff", 3), all_bytes};
+    for (const auto& alphabet : alphabets) {
+        for (size_t num_patterns : {1, 10, 300}) {
+            std::uniform_int_distribution<size_t> length(0, 6);
+            aho_corasick::AutomatonBuilder builder;
+            aho_corasick::DoubleArrayBuilder double_array_builder;
+            for (size_t id = 0; id < num_patterns; ++id) {
+                // Repeats some strings under other ids.
+                auto pattern = RandomString(&generator, alphabet, length(generator));
+                builder.Add(pattern, id);
+                double_array_builder.Add(pattern, id);
+                if (id % 7 == 0) {
+                    builder.Add(pattern, id + 1000);
+                    double_array_builder.Add(pattern, id + 1000);
+                }
+            }
+
+            auto automaton = builder.Build();
+            auto double_array = double_array_builder.Build();
+            auto text = RandomString(&generator, alphabet, 3000);
+
+            std::vector<aho_corasick::Match> expected, actual;
+            automaton->FindAll(text, &expected);
+            double_array->FindAll(text, &actual);
+            ASSERT_EQ(expected, actual);
+            ASSERT_EQ(automaton->NumStates(), double_array->NumStates());
+            ASSERT_EQ(automaton->MaxLength(), double_array->MaxLength());
+        }
+    }
+
+    auto empty = aho_corasick::DoubleArrayBuilder().Build();
+    std::vector<aho_corasick::Match> matches;
+    empty->FindAll("abc", &matches);
+    ASSERT_TRUE(matches.empty());
+}
+
+TEST(DoubleArrayAutomaton, SmallerThanDenseTable) {
+    std::mt19937 generator(17);
+    std::uniform_int_distribution<size_t> length(4, 12);
+    aho_corasick::AutomatonBuilder builder;
+    aho_corasick::DoubleArrayBuilder double_array_builder;
+    for (size_t id = 0; id < 2000; ++id) {
+        auto pattern = RandomString(&generator, "abcdefghijklmnopqrstuvwxyz", length(generator));
+        builder.Add(pattern, id);
+        double_array_builder.Add(pattern, id);
+    }
+    auto automaton = builder.Build();
+    auto double_array = double_array_builder.Build();
+
+    // Nearly every slot holds a state.
+    ASSERT_LT(double_array->NumSlots(), double_array->NumStates() * 11 / 10 + 256);
+    ASSERT_LT(double_array->GetMemoryUsage().Total() * 5, automaton->GetMemoryUsage().Total());
+
+    auto text = RandomString(&generator, "abcdefghijklmnopqrstuvwxyz", 20000);
+    for (auto [begin, end] : {std::pair<size_t, size_t>{0, 20000}, {5, 17}, {1000, 19999}}) {
+        std::vector<aho_corasick::Match> expected, actual;
+        automaton->ScanRange(text, begin, end, [&expected](size_t id, size_t end) {
+            expected.push_back({id, end});
+        });
+        double_array->ScanRange(text, begin, end, [&actual](size_t id, size_t end) {
+            actual.push_back({id, end});
+        });
+        ASSERT_EQ(expected, actual);
+    }
+}
+
+// Everything the matching API reports for the text, written once for either backend.
+template <class AutomatonType>
+std::vector<std::vector<size_t>> MatchThroughApi(const AutomatonType& automaton,
+                                                 const std::string& text) {
+    std::vector<std::vector<size_t>> results;
+    auto add_matches = [&results](const std::vector<aho_corasick::Match>& matches) {
+        results.emplace_back();
+        for (const auto& match : matches) {
+            results.back().push_back(match.pattern_id);
+            results.back().push_back(match.end);
+        }
+    };
+
+    for (auto prefix : {text.substr(0, 0), text.substr(0, 1), text.substr(0, 5), text}) {
+        auto first = automaton.FindFirst(prefix);
+        results.push_back({automaton.Contains(prefix), first.has_value()});
+        if (first) {
+            add_matches({*first});
+        }
+    }
+
+    std::vector<aho_corasick::Match> matches;
+    automaton.FindAllParallel(text, {3, 100}, &matches);
+    add_matches(matches);
+
+    std::vector<std::vector<aho_corasick::Match>> chunks((text.size() + 99) / 100);
+    std::mutex mutex;
+    automaton.ScanChunks(text, {3, 100}, [&](size_t chunk_idx, const auto& found) {
+        std::lock_guard lock(mutex);
+        chunks[chunk_idx] = found;
+    });
+    for (const auto& chunk : chunks) {
+        add_matches(chunk);
+    }
+
+    results.emplace_back();
+    aho_corasick::BasicStreamMatcher matcher(automaton);
+    for (size_t position = 0; position < text.size(); position += 7) {
+        matcher.Feed(std::string_view(text).substr(position, 7),
+                     [&results](size_t pattern_id, uint64_t start, uint64_t end) {
+                         results.back().insert(results.back().end(), {pattern_id, start, end});
+                     });
+    }
+
+    auto node = automaton.Root();
+    for (auto character : text) {
+        node = node.Next(character);
+        results.push_back({node.IsTerminal(), static_cast<bool>(node)});
+        node.TraverseTerminal([&results](size_t id) { results.back().push_back(id); });
+    }
+    return results;
+}
+
+TEST(DoubleArrayAutomaton, SameApiAsAutomaton) {
+    std::mt19937 generator(18);
+    for (auto [num_patterns, alphabet] : {std::pair<size_t, std::string>{0, "ab"},
+                                          {5, "abc"},
+                                          {100, "abcd"},
+                                          {200, "xyz"}}) {
+        std::uniform_int_distribution<size_t> length(0, 5);
+        aho_corasick::AutomatonBuilder builder;
+        aho_corasick::DoubleArrayBuilder double_array_builder;
+        for (size_t id = 0; id < num_patterns; ++id) {
+            auto pattern = RandomString(&generator, alphabet, length(generator));
+            builder.Add(pattern, id);
+            double_array_builder.Add(pattern, id);
+        }
+        auto automaton = builder.Build();
+        auto double_array = double_array_builder.Build();
+
+        for (auto text : {RandomString(&generator, alphabet, 1000), std::string("qqqqqq")}) {
+            ASSERT_EQ(MatchThroughApi(*automaton, text), MatchThroughApi(*double_array, text));
+        }
+    }
+}
+
+TEST(CaseFolding, FoldCase) {
+    using aho_corasick::CaseFolding;
+    using aho_corasick::FoldCase;
+
+    ASSERT_EQ(FoldCase("Hello, WORLD! Été", CaseFolding::kNone), "Hello, WORLD! Été");
+    ASSERT_EQ(FoldCase("Hello, WORLD! Été", CaseFolding::kAscii), "hello, world! Été");
+    ASSERT_EQ(FoldCase("Hello, WORLD! Été", CaseFolding::kUtf8), "hello, world! été");
+    ASSERT_EQ(FoldCase("ÀÉÎÕÜ ÆØÞ Ÿ µ Straße", CaseFolding::kUtf8), "àéîõü æøþ ÿ μ straße");
+    ASSERT_EQ(FoldCase("ŁÓDŹ ĀĞŽ", CaseFolding::kUtf8), "łódź āğž");
+    ASSERT_EQ(FoldCase("ΣΊΣΥΦΟΣ ς Ω ϐ", CaseFolding::kUtf8), "σίσυφοσ σ ω β");
+    ASSERT_EQ(FoldCase("ПРИВЕТ ЁЖ Ѣ Ӂ", CaseFolding::kUtf8), "привет ёж ѣ ӂ");
+    // Foldings which change the length are left out.
+    ASSERT_EQ(FoldCase("ſ", CaseFolding::kUtf8), "ſ");
+    // So are invalid sequences.
+    ASSERT_EQ(FoldCase("\xc3 \xc3\xc3\x89 \x89", CaseFolding::kUtf8), "\xc3 \xc3\xc3\xa9 \x89");
+}
+
+std::string RandomCharacters(std::mt19937* generator, const std::vector<std::string>& characters,
+                             size_t count) {
+    std::uniform_int_distribution<size_t> character(0, characters.size() - 1);
+    std::string result;
+    for (size_t idx = 0; idx < count; ++idx) {
+        result += characters[character(*generator)];
+    }
+    return result;
+}
+
+TEST(Automaton, CaseFoldingMatchesFoldedText) {
+    using aho_corasick::CaseFolding;
+    using Prefilter = aho_corasick::BuildOptions::Prefilter;
+
+    {
+        aho_corasick::AutomatonBuilder builder;
+        builder.Add("Straße", 0);
+        builder.Add("ПРИВЕТ", 1);
+        builder.Add("σοφία", 2);
+        auto automaton = builder.Build({true, Prefilter::kAuto, CaseFolding::kUtf8});
+
+        std::vector<aho_corasick::Match> matches;
+        automaton->FindAll("STRAßE, Привет, ΣΟΦΊΑ, ΣΟΦΙΑ", &matches);
+        const std::vector<aho_corasick::Match> expected = {{0, 7}, {1, 21}, {2, 33}};
+        ASSERT_EQ(expected, matches);
+    }
+
+    const std::vector<std::string> characters = {"a", "B", "b", "é", "É", "σ", "Σ", "ς", "π",
+                                                 "Π", "п", "П", "р", "Р", "ÿ", "Ÿ", "ł", "Ł"};
+    // Texts also hold invalid sequences and characters the patterns lack.
+    auto text_characters = characters;
+    text_characters.insert(text_characters.end(), {"\xc3", "\xcf", "\xa9", "\x80", "Ё", "x"});
+
+    std::mt19937 generator(18);
+    std::uniform_int_distribution<size_t> length(1, 4);
+    for (auto folding : {CaseFolding::kAscii, CaseFolding::kUtf8}) {
+        for (size_t num_patterns : {1, 5, 100}) {
+            std::vector<std::string> patterns;
+            for (size_t id = 0; id < num_patterns; ++id) {
+                patterns.push_back(RandomCharacters(&generator, characters, length(generator)));
+            }
+
+            // Lowercase-then-match.
+            aho_corasick::AutomatonBuilder reference_builder;
+            for (size_t id = 0; id < patterns.size(); ++id) {
+                reference_builder.Add(aho_corasick::FoldCase(patterns[id], folding), id);
+            }
+            auto reference = reference_builder.Build({true, Prefilter::kNever});
+
+            auto text = RandomCharacters(&generator, text_characters, 3000);
+            std::vector<aho_corasick::Match> expected, actual;
+            reference->FindAll(aho_corasick::FoldCase(text, folding), &expected);
+            ASSERT_TRUE(num_patterns < 100 || !expected.empty());
+
+            for (bool precompute : {true, false}) {
+                for (auto prefilter : {Prefilter::kAlways, Prefilter::kNever}) {
+                    aho_corasick::AutomatonBuilder builder;
+                    for (size_t id = 0; id < patterns.size(); ++id) {
+                        builder.Add(patterns[id], id);
+                    }
+                    auto automaton = builder.Build({precompute, prefilter, folding});
+
+                    automaton->FindAll(text, &actual);
+                    ASSERT_EQ(expected, actual);
+                    automaton->FindAllParallel(text, {1, 7}, &actual);
+                    ASSERT_EQ(expected, actual);
+                }
+            }
+        }
+    }
+}
+
+// Non-overlapping occurrences from left to right: at the leftmost start, the first pattern or
+// the longest one, then on from its end, or from the next byte after an empty one.
+std::vector<aho_corasick::Match> NaiveLeftmost(const std::vector<std::string>& patterns,
+                                               const std::string& text, bool longest) {
+    std::vector<aho_corasick::Match> matches;
+    for (size_t position = 0; position <= text.size();) {
+        std::optional<size_t> best;
+        size_t best_start = 0;
+        for (size_t start = position; start <= text.size() && !best; ++start) {
+            for (size_t id = 0; id < patterns.size(); ++id) {
+                if (text.compare(start, patterns[id].size(), patterns[id]) == 0 &&
+                    (!best || (longest && patterns[id].size() > patterns[*best].size()))) {
+                    best = id;
+                    best_start = start;
+                }
+            }
+        }
+        if (!best) {
+            break;
+        }
+        size_t end = best_start + patterns[*best].size();
+        matches.push_back({*best, end});
+        position = std::max(end, position + 1);
+    }
+    return matches;
+}
+
+TEST(Automaton, LeftmostMatchKinds) {
+    using aho_corasick::MatchKind;
+    using Prefilter = aho_corasick::BuildOptions::Prefilter;
+
+    auto find_all = [](const std::vector<std::string>& patterns, MatchKind kind,
+                       const std::string& text) {
+        aho_corasick::AutomatonBuilder builder;
+        for (size_t id = 0; id < patterns.size(); ++id) {
+            builder.Add(patterns[id], id);
+        }
+        aho_corasick::BuildOptions options;
+        options.match_kind = kind;
+        std::vector<aho_corasick::Match> matches;
+        builder.Build(options)->FindAll(text, &matches);
+        return matches;
+    };
+
+    using Matches = std::vector<aho_corasick::Match>;
+    ASSERT_EQ(Matches({{0, 7}}),
+              find_all({"Samwise", "Sam"}, MatchKind::kLeftmostFirst, "Samwise"));
+    ASSERT_EQ(Matches({{0, 3}}),
+              find_all({"Sam", "Samwise"}, MatchKind::kLeftmostFirst, "Samwise"));
+    ASSERT_EQ(Matches({{1, 7}}),
+              find_all({"Sam", "Samwise"}, MatchKind::kLeftmostLongest, "Samwise"));
+    ASSERT_EQ(Matches({{1, 3}, {2, 7}}),
+              find_all({"abcd", "bc", "cde"}, MatchKind::kLeftmostFirst, "abcxcde"));
+    ASSERT_EQ(Matches({{0, 4}}), find_all({"abcd", "bc"}, MatchKind::kLeftmostLongest, "abcd"));
+    ASSERT_EQ(Matches({{0, 0}, {1, 2}, {0, 2}}),
+              find_all({"", "a"}, MatchKind::kLeftmostLongest, "xa"));
+
+    const std::string alphabet = "abc";
+    std::mt19937 generator(19);
+    std::uniform_int_distribution<size_t> length(1, 5);
+    for (auto kind : {MatchKind::kLeftmostFirst, MatchKind::kLeftmostLongest}) {
+        for (size_t num_patterns : {1, 8, 60}) {
+            for (bool with_empty : {false, true}) {
+                std::vector<std::string> patterns;
+                for (size_t id = 0; id < num_patterns; ++id) {
+                    patterns.push_back(RandomString(&generator, alphabet, length(generator)));
+                }
+                if (with_empty) {
+                    patterns.insert(patterns.begin() + patterns.size() / 2, "");
+                }
+
+                auto text = RandomString(&generator, alphabet + "x", 2000);
+                auto expected = NaiveLeftmost(patterns, text, kind == MatchKind::kLeftmostLongest);
+                bool any = std::any_of(patterns.begin(), patterns.end(), [&](const auto& pattern) {
+                    return text.find(pattern) != std::string::npos;
+                });
+
+                for (bool precompute : {true, false}) {
+                    for (auto prefilter : {Prefilter::kAlways, Prefilter::kNever}) {
+                        aho_corasick::AutomatonBuilder builder;
+                        for (size_t id = 0; id < patterns.size(); ++id) {
+                            builder.Add(patterns[id], id);
+                        }
+                        aho_corasick::BuildOptions options = {precompute, prefilter};
+                        options.match_kind = kind;
+                        auto automaton = builder.Build(options);
+
+                        std::vector<aho_corasick::Match> actual;
+                        automaton->FindAll(text, &actual);
+                        ASSERT_EQ(expected, actual);
+
+                        auto first = automaton->FindFirst(text);
+                        ASSERT_EQ(!expected.empty(), first.has_value());
+                        if (first) {
+                            ASSERT_EQ(expected.front(), *first);
+                        }
+                        ASSERT_EQ(any, automaton->Contains(text));
+                    }
+                }
+            }
+        }
+    }
+}
+
+TEST(Automaton, ContainsAndFindFirst) {
+    std::mt19937 generator(20);
+    std::uniform_int_distribution<size_t> length(3, 6);
+
+    std::vector<std::string> patterns;
+    aho_corasick::AutomatonBuilder builder;
+    for (size_t id = 0; id < 30; ++id) {
+        patterns.push_back(RandomString(&generator, "abcd", length(generator)));
+        builder.Add(patterns.back(), id);
+    }
+
+    for (auto prefilter : {aho_corasick::BuildOptions::Prefilter::kAlways,
+                           aho_corasick::BuildOptions::Prefilter::kNever}) {
+        auto automaton = builder.Build({true, prefilter});
+        for (size_t size : {0, 5, 50, 500}) {
+            auto text = RandomString(&generator, "abcde", size);
+            std::vector<aho_corasick::Match> matches;
+            automaton->FindAll(text, &matches);
+
+            ASSERT_EQ(!matches.empty(), automaton->Contains(text));
+            auto first = automaton->FindFirst(text);
+            ASSERT_EQ(!matches.empty(), first.has_value());
+            if (first) {
+                ASSERT_EQ(matches.front(), *first);
+            }
+        }
+    }
+}
+
+TEST(Automaton, LeftmostImagesAndRestrictions) {
+    aho_corasick::AutomatonBuilder builder;
+    builder.Add("ab", 0);
+    builder.Add("abcd", 1);
+    builder.Add("cde", 2);
+    aho_corasick::BuildOptions options;
+    options.match_kind = aho_corasick::MatchKind::kLeftmostLongest;
+    auto automaton = builder.Build(options);
+
+    std::ostringstream stream;
+    automaton->Save(stream);
+    auto image = stream.str();
+    auto loaded = aho_corasick::Automaton::FromImage(image);
+
+    ASSERT_EQ(aho_corasick::MatchKind::kLeftmostLongest, loaded->GetMatchKind());
+    std::vector<aho_corasick::Match> expected, actual;
+    automaton->FindAll("abcde abcd", &expected);
+    loaded->FindAll("abcde abcd", &actual);
+    ASSERT_EQ(expected, actual);
+    ASSERT_EQ(std::vector<aho_corasick::Match>({{1, 4}, {1, 10}}), actual);
+
+    ASSERT_THROW(automaton->ScanRange("abcd", 1, 3, [](size_t, size_t) {}), std::runtime_error);
+    ASSERT_THROW(automaton->FindAllParallel("abcd", {}, &actual), std::runtime_error);
+    ASSERT_THROW(aho_corasick::StreamMatcher{*automaton}, std::runtime_error);
+    aho_corasick::DynamicAutomaton::Options dynamic_options;
+    dynamic_options.build = options;
+    ASSERT_THROW(aho_corasick::DynamicAutomaton{dynamic_options}, std::runtime_error);
+}
@@ -1,9 +1,14 @@
+#include <array>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include <vector>
 
 #include <gtest/gtest.h>
 
 #include "byte-streams.h"
+#include "mapped-file.h"
 
 TEST(BitReader, LittleEndiannes) {
     std::stringstream ss;
@@ -72,3 +77,78 @@ TEST(BitReader, ReadNBitsBE) {
     ASSERT_EQ(byte_streams::ComposeNBitsBE(3, reader), 7);
     ASSERT_EQ(byte_streams::ComposeNBitsBE(2, reader), 1);
 }
+
+TEST(BitWriter, StuffingAndPadding) {
+    std::vector<uint8_t> written;
+    byte_streams::BitWriter writer(&written);
+
+    writer.Write(0b001, 3);
+    writer.Write(0xff, 8);
+    writer.Write(0b10, 2);
+    writer.Flush();
+
+    // 001 11111 | 111 10 111: the first byte is not 0xff, the second is and gets stuffed.
+    std::vector<uint8_t> expected = {0x3f, 0xf7};
+    ASSERT_EQ(written, expected);
+
+    written.clear();
+    writer.Write(0xffff, 16);
+    writer.Flush();
+    expected = {0xff, 0x00, 0xff, 0x00};
+    ASSERT_EQ(written, expected);
+}
+
+TEST(ByteStream, BulkReads) {
+    std::string data = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+    for (size_t filler = 0; filler < 1000; ++filler) {
+        data.push_back(static_cast<char>(filler));
+    }
+    data += "tail";
+
+    std::stringstream ss(data);
+    byte_streams::ByteStream reader(ss);
+
+    ASSERT_EQ(reader.ReadBE<uint16_t>(), 0x0102);
+    ASSERT_EQ(reader.ReadBE<uint32_t>(), 0x03040506u);
+    ASSERT_EQ(reader.Yield(), 7);
+
+    std::array<uint8_t, 3> bytes;
+    reader.ReadInto(bytes.data(), bytes.size());
+    ASSERT_EQ(bytes, (std::array<uint8_t, 3>{8, 9, 10}));
+
+    reader.Skip(1000);
+    std::string tail(4, '\0');
+    reader.ReadInto(tail.data(), tail.size());
+    ASSERT_EQ(tail, "tail");
+    ASSERT_FALSE(reader.IsFinished());
+
+    // Mixing with the istream interface sees the same position.
+    ss.seekg(-2, std::ios_base::cur);
+    ASSERT_EQ(reader.Yield(), 'i');
+
+    ASSERT_THROW(reader.Skip(2), std::runtime_error);
+    ASSERT_TRUE(reader.IsFinished());
+    ASSERT_TRUE(ss.eof());
+    ASSERT_THROW(reader.Yield(), std::runtime_error);
+}
+
+TEST(MappedFile, ViewsContents) {
+    auto path = testing::TempDir() + "mapped-file-test";
+    std::string contents(100000, 'x');
+    contents[12345] = '\0';
+    contents.back() = 'y';
+    {
+        std::ofstream file(path, std::ios::binary);
+        file << contents;
+    }
+    using Access = byte_streams::MappedFile::Access;
+    for (auto access : {Access::kSequential, Access::kRandom, Access::kWillNeed}) {
+        ASSERT_EQ(byte_streams::MappedFile(path, access).View(), contents);
+    }
+
+    std::ofstream(path, std::ios::binary | std::ios::trunc).close();
+    ASSERT_TRUE(byte_streams::MappedFile(path).View().empty());
+
+    std::remove(path.c_str());
+    ASSERT_THROW(byte_streams::MappedFile{path}, std::runtime_error);
+}
@@ -0,0 +1,164 @@
+#include <queue>
+#include <random>
+#include <vector>
+#include <sstream>
+#include <functional>
+
+#include <gtest/gtest.h>
+
+#include "huffman.h"
+#include "byte-streams.h"
+
+// Total number of bits with unrestricted Huffman codes.
+uint64_t HuffmanCost(const std::vector<uint64_t>& frequencies) {
+    std::priority_queue<uint64_t, std::vector<uint64_t>, std::greater<>> queue;
+    for (auto frequency : frequencies) {
+        if (frequency > 0) {
+            queue.push(frequency);
+        }
+    }
+
+    uint64_t cost = 0;
+    while (queue.size() > 1) {
+        auto first = queue.top();
+        queue.pop();
+        auto second = queue.top();
+        queue.pop();
+        cost += first + second;
+        queue.push(first + second);
+    }
+    return cost;
+}
+
+uint64_t Cost(const std::vector<uint64_t>& frequencies, const std::vector<uint8_t>& lengths) {
+    uint64_t cost = 0;
+    for (size_t symbol = 0; symbol < frequencies.size(); ++symbol) {
+        cost += frequencies[symbol] * lengths[symbol];
+    }
+    return cost;
+}
+
+void ExpectCompleteCode(const std::vector<uint8_t>& lengths, uint8_t max_length) {
+    uint64_t kraft = 0;
+    for (auto length : lengths) {
+        ASSERT_LE(length, max_length);
+        if (length > 0) {
+            kraft += uint64_t(1) << (max_length - length);
+        }
+    }
+    ASSERT_EQ(kraft, uint64_t(1) << max_length);
+}
+
+TEST(LimitedCodeLengths, MatchesHuffmanWhenLimitIsLoose) {
+    std::mt19937 generator(3);
+    std::uniform_int_distribution<uint64_t> frequency(0, 1000);
+
+    for (size_t num_symbols : {2, 3, 17, 162, 256}) {
+        std::vector<uint64_t> frequencies(num_symbols);
+        for (auto& value : frequencies) {
+            value = frequency(generator);
+        }
+        frequencies[0] = frequencies[1] = 1;
+
+        auto lengths = huffman::LimitedCodeLengths(frequencies, 32);
+        ExpectCompleteCode(lengths, 32);
+        ASSERT_EQ(Cost(frequencies, lengths), HuffmanCost(frequencies));
+    }
+}
+
+TEST(LimitedCodeLengths, RespectsLimit) {
+    // Fibonacci frequencies make the unrestricted code as deep as there are symbols.
+    std::vector<uint64_t> frequencies = {1, 1};
+    while (frequencies.size() < 30) {
+        frequencies.push_back(frequencies[frequencies.size() - 1] +
+                              frequencies[frequencies.size() - 2]);
+    }
+
+    auto unlimited = huffman::LimitedCodeLengths(frequencies, 32);
+    ASSERT_EQ(*std::max_element(unlimited.begin(), unlimited.end()), 29);
+
+    auto lengths = huffman::LimitedCodeLengths(frequencies, 16);
+    ExpectCompleteCode(lengths, 16);
+    ASSERT_GT(Cost(frequencies, lengths), Cost(frequencies, unlimited));
+
+    // The limit is exactly enough for 2^max_length symbols.
+    std::vector<uint64_t> flat(256, 5);
+    lengths = huffman::LimitedCodeLengths(flat, 8);
+    ASSERT_EQ(lengths, std::vector<uint8_t>(256, 8));
+    ASSERT_THROW(huffman::LimitedCodeLengths(flat, 7), std::runtime_error);
+}
+
+TEST(LimitedCodeLengths, Degenerate) {
+    ASSERT_EQ(huffman::LimitedCodeLengths({}, 16), std::vector<uint8_t>());
+    ASSERT_EQ(huffman::LimitedCodeLengths({0, 7, 0}, 16), std::vector<uint8_t>({0, 1, 0}));
+}
+
+TEST(BuildCanonicalTable, RoundTrip) {
+    std::mt19937 generator(5);
+    std::vector<uint64_t> frequencies(256);
+    for (size_t value = 0; value < frequencies.size(); ++value) {
+        frequencies[value] = (value % 3 == 0) ? 0 : 1 + generator() % (1 << (value % 20));
+    }
+
+    auto table = huffman::BuildCanonicalTable(frequencies, 16, true);
+    ASSERT_EQ(table.per_level.size(), 16);
+
+    auto codes = huffman::CanonicalCodes(table.per_level, table.values);
+    for (const auto& code : codes) {
+        ASSERT_FALSE(code.length > 0 && code.bits == (1u << code.length) - 1);
+    }
+
+    std::vector<uint8_t> message;
+    for (size_t value = 0; value < frequencies.size(); ++value) {
+        if (frequencies[value] > 0) {
+            message.push_back(value);
+        }
+    }
+
+    std::vector<uint8_t> written;
+    byte_streams::BitWriter writer(&written);
+    for (auto value : message) {
+        writer.Write(codes[value].bits, codes[value].length);
+    }
+    writer.Flush();
+
+    auto tree = huffman::HuffmanTree<uint8_t, uint8_t>::FromSequence(table.per_level, table.values);
+    auto decoder = huffman::LookupDecoder<uint8_t>::FromSequence(table.per_level, table.values);
+
+    std::string unstuffed;
+    for (size_t idx = 0; idx < written.size(); ++idx) {
+        unstuffed.push_back(written[idx]);
+        if (written[idx] == 0xff) {
+            ++idx;
+        }
+    }
+    byte_streams::BufferBitStream bits(reinterpret_cast<const uint8_t*>(unstuffed.data()),
+                                       unstuffed.size());
+    for (auto value : message) {
+        auto node = tree.root.get();
+        auto start = bits.Position();
+        while (!node->IsTerminal()) {
+            node = bits.Yield() ? node->right : node->left;
+        }
+        ASSERT_EQ(node->value.value(), value);
+
+        auto end = bits.Position();
+        bits.Seek(start);
+        ASSERT_EQ(decoder.Decode(bits), value);
+        ASSERT_EQ(bits.Position(), end);
+    }
+}
+
+TEST(LookupDecoder, RejectsOversubscribedCodes) {
+    using Decoder = huffman::LookupDecoder<uint8_t>;
+    // Three codes of one bit, and two of one bit followed by one of two bits.
+    ASSERT_THROW(Decoder::FromSequence(std::vector<uint8_t>{3}, {1, 2, 3}), std::runtime_error);
+    ASSERT_THROW(Decoder::FromSequence(std::vector<uint8_t>{2, 1}, {1, 2, 3}), std::runtime_error);
+    // 513 codes of 9 bits would fill one entry past the lookup table.
+    std::vector<uint8_t> values(513);
+    std::vector<uint16_t> per_level(9);
+    per_level[8] = 513;
+    ASSERT_THROW(Decoder::FromSequence(per_level, values), std::runtime_error);
+
+    ASSERT_NO_THROW(Decoder::FromSequence(std::vector<uint8_t>{1, 2}, {1, 2, 3}));
+}
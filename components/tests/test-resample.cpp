@@ -0,0 +1,125 @@
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "resample.h"
+
+const std::vector<resample::Filter> kFilters = {resample::Filter::kBox, resample::Filter::kBilinear,
+                                                resample::Filter::kLanczos3};
+
+Image RandomImage(size_t width, size_t height, uint32_t seed) {
+    std::mt19937 generator(seed);
+    std::uniform_int_distribution<int> value(0, 255);
+
+    Image image(width, height);
+    for (size_t y = 0; y < height; ++y) {
+        for (size_t x = 0; x < width; ++x) {
+            image.SetPixel(y, x, {value(generator), value(generator), value(generator)});
+        }
+    }
+    return image;
+}
+
+void ExpectSamePixels(const Image& expected, const Image& actual) {
+    ASSERT_EQ(expected.Width(), actual.Width());
+    ASSERT_EQ(expected.Height(), actual.Height());
+
+    for (size_t y = 0; y < expected.Height(); ++y) {
+        for (size_t x = 0; x < expected.Width(); ++x) {
+            auto lhs = expected.GetPixel(y, x), rhs = actual.GetPixel(y, x);
+            ASSERT_EQ(lhs.r, rhs.r);
+            ASSERT_EQ(lhs.g, rhs.g);
+            ASSERT_EQ(lhs.b, rhs.b);
+        }
+    }
+}
+
+TEST(Resample, ConstantStaysConstant) {
+    Image image(37, 23);
+    for (size_t y = 0; y < image.Height(); ++y) {
+        for (size_t x = 0; x < image.Width(); ++x) {
+            image.SetPixel(y, x, {200, 17, 93});
+        }
+    }
+
+    for (auto filter : kFilters) {
+        for (auto [width, height] : {std::pair{5, 4}, {12, 23}, {37, 9}, {80, 51}, {1, 1}}) {
+            auto resized = resample::Resize(image, width, height, {filter});
+            ASSERT_EQ(resized.Width(), width);
+            ASSERT_EQ(resized.Height(), height);
+
+            for (size_t y = 0; y < resized.Height(); ++y) {
+                for (size_t x = 0; x < resized.Width(); ++x) {
+                    auto pixel = resized.GetPixel(y, x);
+                    ASSERT_EQ(pixel.r, 200);
+                    ASSERT_EQ(pixel.g, 17);
+                    ASSERT_EQ(pixel.b, 93);
+                }
+            }
+        }
+    }
+}
+
+TEST(Resample, SameSizeKeepsPixels) {
+    auto image = RandomImage(31, 17, 1);
+    for (auto filter : kFilters) {
+        ExpectSamePixels(image, resample::Resize(image, 31, 17, {filter}));
+    }
+}
+
+TEST(Resample, BoxAveragesBlocks) {
+    auto image = RandomImage(64, 48, 2);
+    auto resized = resample::Resize(image, 32, 24, {resample::Filter::kBox});
+
+    for (size_t y = 0; y < resized.Height(); ++y) {
+        for (size_t x = 0; x < resized.Width(); ++x) {
+            int sum = 0;
+            for (size_t dy = 0; dy < 2; ++dy) {
+                for (size_t dx = 0; dx < 2; ++dx) {
+                    sum += image.GetPixel(2 * y + dy, 2 * x + dx).g;
+                }
+            }
+            ASSERT_EQ(resized.GetPixel(y, x).g, (sum + 2) / 4);
+        }
+    }
+}
+
+TEST(Resample, ThreadsGiveSameResult) {
+    auto image = RandomImage(203, 151, 3);
+    for (auto filter : kFilters) {
+        auto expected = resample::Resize(image, 64, 47, {filter, 1});
+        ExpectSamePixels(expected, resample::Resize(image, 64, 47, {filter, 3}));
+    }
+}
+
+TEST(Resample, SimdMatchesScalar) {
+    auto image = RandomImage(203, 151, 5);
+    for (auto filter : kFilters) {
+        // Down and up, with widths which leave partial vectors at the end of the rows.
+        for (auto [width, height] : {std::pair{64, 47}, {17, 9}, {1, 3}, {419, 305}, {203, 77}}) {
+            resample::ResizeOptions scalar;
+            scalar.filter = filter;
+            scalar.use_simd = false;
+            ExpectSamePixels(resample::Resize(image, width, height, scalar),
+                             resample::Resize(image, width, height, {filter}));
+        }
+    }
+}
+
+TEST(Resample, Thumbnail) {
+    auto image = RandomImage(640, 480, 4);
+    image.SetComment("kept");
+
+    auto thumbnail = resample::Thumbnail(image, 160, 160);
+    ASSERT_EQ(thumbnail.Width(), 160);
+    ASSERT_EQ(thumbnail.Height(), 120);
+    ASSERT_EQ(thumbnail.GetComment(), "kept");
+
+    thumbnail = resample::Thumbnail(image, 1000, 90);
+    ASSERT_EQ(thumbnail.Width(), 120);
+    ASSERT_EQ(thumbnail.Height(), 90);
+
+    ExpectSamePixels(image, resample::Thumbnail(image, 640, 1000));
+    ASSERT_THROW(resample::Resize(image, 0, 10), std::runtime_error);
+}